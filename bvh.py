@@ -0,0 +1,236 @@
+#!python3
+
+"""
+Bounding volume hierarchy display list builder for F3DEX3.
+
+Converts a list of objects (display lists with axis-aligned bounding boxes, all
+in the same model space, e.g. the static geometry of a level) into a balanced
+BVH made of display lists. Each node loads the 8 corners of its bounds with
+gsSPVertex and tests them with gsSPCullDisplayList; if the node is offscreen
+(or, except in NOC, behind the occlusion plane), the node's display list ends
+and the whole subtree is skipped. Otherwise the node calls its children with
+gsSPDisplayList, and jumps to the last one with gsSPBranchList so that it does
+not take a DL stack entry. Leaves call the objects' display lists.
+
+The nodes do not load any matrix: their bounds are transformed by whatever
+model matrix is current when the BVH is called. So an object display list which
+loads or multiplies the model matrix (or pushes it) must restore the original
+one (e.g. with gsSPPopMatrix) before it returns. Otherwise the bounds of the
+next sibling node are transformed by the object's matrix, and it is culled or
+drawn wrongly.
+
+The input is a text file with one object per line:
+name minX minY minZ maxX maxY maxZ
+where name is the object's display list. The bounds are integers, as they are
+loaded as vertices.
+
+Each node costs a vertex load of 8 vertices and a display list call, so a node
+only pays for itself if it often culls more than that. Use --leaf-size to stop
+splitting at a few objects per leaf. Each level of the tree uses one entry of
+the RSP's 18-entry display list stack while its children are drawn (except the
+last child), so --max-depth limits the depth; the game's own display list
+nesting above the BVH must fit in the rest.
+
+Usage:
+python3 bvh.py objects.txt --name level_bvh > level_bvh.inc.c
+
+Other scripts can import this module and use buildBvh / encodeBvh directly.
+perf_suite.py runs a tree laid out by encodeBvh on each microcode in the RSP
+simulator, and checks that the objects drawn match a walk of the tree.
+"""
+
+import argparse
+import sys
+
+import gbi
+
+VERTEX_BUFFER_SIZE = 56
+DL_STACK_SIZE = 18
+S16_MIN = -0x8000
+S16_MAX = 0x7FFF
+
+
+class Object:
+    def __init__(self, name, bmin, bmax):
+        self.name = name
+        self.bmin = tuple(bmin)
+        self.bmax = tuple(bmax)
+
+    def center2(self, axis):
+        return self.bmin[axis] + self.bmax[axis]
+
+
+class Node:
+    def __init__(self, objects, children):
+        self.objects = objects    # Objects drawn by this node if leaf, else empty
+        self.children = children  # Child nodes if interior, else empty
+        everything = self.allObjects()
+        self.bmin = tuple(min(o.bmin[a] for o in everything) for a in range(3))
+        self.bmax = tuple(max(o.bmax[a] for o in everything) for a in range(3))
+        self.index = None
+
+    def allObjects(self):
+        ret = list(self.objects)
+        for c in self.children:
+            ret += c.allObjects()
+        return ret
+
+    def depth(self):
+        return 1 + max([c.depth() for c in self.children], default=0)
+
+    def numNodes(self):
+        return 1 + sum(c.numNodes() for c in self.children)
+
+    def postOrder(self):
+        ret = []
+        for c in self.children:
+            ret += c.postOrder()
+        return ret + [self]
+
+    def corners(self):
+        ret = []
+        for i in range(8):
+            ret.append((self.bmax[0] if i & 1 else self.bmin[0],
+                self.bmax[1] if i & 2 else self.bmin[1],
+                self.bmax[2] if i & 4 else self.bmin[2]))
+        return ret
+
+    def calls(self):
+        """The display lists this node calls, as Node or Object."""
+        return self.children if len(self.children) > 0 else self.objects
+
+
+def buildBvh(objects, leafSize=1, maxDepth=8):
+    """
+    Builds a balanced BVH: each node splits its objects in half at the median
+    along the longest axis of the objects' centers. Returns the root Node.
+    """
+    if len(objects) == 0:
+        raise RuntimeError("No objects")
+    def build(objs, depth):
+        if len(objs) <= leafSize or depth >= maxDepth:
+            return Node(objs, [])
+        axis = max(range(3), key=lambda a:
+            max(o.center2(a) for o in objs) - min(o.center2(a) for o in objs))
+        objs = sorted(objs, key=lambda o: (o.center2(axis), o.name))
+        half = len(objs) // 2
+        return Node([], [build(objs[:half], depth + 1), build(objs[half:], depth + 1)])
+    return build(list(objects), 1)
+
+
+def nodeCmds(node, boundsAddr, callAddrs, boundsSlot):
+    """
+    The commands of one node's display list. boundsAddr is the address of its
+    8 bounds vertices and callAddrs those of the display lists it calls.
+    """
+    cmds = [gbi.gsSPVertex(boundsAddr, 8, boundsSlot),
+        gbi.gsSPCullDisplayList(boundsSlot, boundsSlot + 7)]
+    for a in callAddrs[:-1]:
+        cmds.append(gbi.gsSPDisplayList(a))
+    cmds.append(gbi.gsSPBranchList(callAddrs[-1]))
+    return cmds
+
+
+def encodeBvh(root, base, objectAddrs, boundsSlot=VERTEX_BUFFER_SIZE - 8):
+    """
+    Lays out the BVH in binary starting at address base: all the node display
+    lists, then all the bounds vertices. objectAddrs maps object names to the
+    addresses of their display lists. Returns (data, root DL address).
+    """
+    nodes = root.postOrder()
+    addr = base
+    dlAddrs = {}
+    for n in nodes:
+        dlAddrs[id(n)] = addr
+        addr += 8 * (2 + len(n.calls()))
+    boundsAddrs = {}
+    for n in nodes:
+        boundsAddrs[id(n)] = addr
+        addr += 8 * 0x10
+    data = b""
+    for n in nodes:
+        calls = [dlAddrs[id(c)] if isinstance(c, Node) else objectAddrs[c.name] for c in n.calls()]
+        data += gbi.cmdsToBytes(nodeCmds(n, boundsAddrs[id(n)], calls, boundsSlot))
+    for n in nodes:
+        data += b"".join(gbi.Vtx(*c) for c in n.corners())
+    return data, dlAddrs[id(root)]
+
+
+def emitC(root, name, boundsSlot, out):
+    nodes = root.postOrder()
+    for i, n in enumerate(nodes):
+        n.index = i
+    def nodeName(n):
+        return name if n is root else f"{name}_node{n.index}"
+    for o in root.allObjects():
+        print(f"extern Gfx {o.name}[];", file=out)
+    print("", file=out)
+    for n in nodes:
+        print(f"static Vtx {nodeName(n)}_bounds[8] = {{", file=out)
+        for x, y, z in n.corners():
+            print(f"    {{{{{{{x}, {y}, {z}}}, 0, {{0, 0}}, {{0, 0, 0, 0}}}}}},", file=out)
+        print("};", file=out)
+    print("", file=out)
+    for n in nodes:
+        storage = "" if n is root else "static "
+        print(f"{storage}Gfx {nodeName(n)}[] = {{", file=out)
+        print(f"    gsSPVertex({nodeName(n)}_bounds, 8, {boundsSlot}),", file=out)
+        print(f"    gsSPCullDisplayList({boundsSlot}, {boundsSlot + 7}),", file=out)
+        calls = [nodeName(c) if isinstance(c, Node) else c.name for c in n.calls()]
+        for c in calls[:-1]:
+            print(f"    gsSPDisplayList({c}),", file=out)
+        print(f"    gsSPBranchList({calls[-1]}),", file=out)
+        print("};", file=out)
+        print("", file=out)
+
+
+def readObjects(path):
+    objects = []
+    names = set()
+    with open(path, "r") as f:
+        for lineNum, l in enumerate(f):
+            l = l.split("#")[0].strip()
+            if len(l) == 0:
+                continue
+            toks = l.split()
+            if len(toks) != 7:
+                raise RuntimeError(f"{path}:{lineNum + 1}: expected name and 6 bounds")
+            b = [int(t, 0) for t in toks[1:]]
+            for x in b:
+                if x < S16_MIN or x > S16_MAX:
+                    raise RuntimeError(f"{path}:{lineNum + 1}: bound {x} out of s16 range")
+            if any(b[a] > b[a + 3] for a in range(3)):
+                raise RuntimeError(f"{path}:{lineNum + 1}: min > max")
+            if toks[0] in names:
+                raise RuntimeError(f"{path}:{lineNum + 1}: duplicate object {toks[0]}")
+            names.add(toks[0])
+            objects.append(Object(toks[0], b[0:3], b[3:6]))
+    return objects
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build an F3DEX3 BVH display list from object bounds")
+    parser.add_argument("input", help="Text file with name and min / max bounds per line")
+    parser.add_argument("--name", default="bvh", help="Name of the root display list (default bvh)")
+    parser.add_argument("--leaf-size", type=int, default=1,
+        help="Maximum objects per leaf (default 1)")
+    parser.add_argument("--max-depth", type=int, default=8,
+        help="Maximum tree depth, i.e. DL stack entries used (default 8)")
+    parser.add_argument("--bounds-slot", type=int, default=VERTEX_BUFFER_SIZE - 8,
+        help=f"First of 8 vertex buffer slots for the bounds (default {VERTEX_BUFFER_SIZE - 8})")
+    args = parser.parse_args()
+
+    if args.bounds_slot < 0 or args.bounds_slot + 8 > VERTEX_BUFFER_SIZE:
+        raise RuntimeError(f"Bounds slots must be within 0-{VERTEX_BUFFER_SIZE - 1}")
+    if args.max_depth < 1 or args.max_depth >= DL_STACK_SIZE:
+        raise RuntimeError(f"Max depth must be 1-{DL_STACK_SIZE - 1}")
+    objects = readObjects(args.input)
+    root = buildBvh(objects, max(1, args.leaf_size), args.max_depth)
+    emitC(root, args.name, args.bounds_slot, sys.stdout)
+
+    print(f"{len(objects)} objects: {root.numNodes()} nodes, depth {root.depth()}",
+        file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
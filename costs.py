@@ -0,0 +1,61 @@
+#!python3
+
+"""
+RSP cycle costs of the F3DEX3 codepaths, shared by the host tools which
+estimate the cost of a display list without running it (dlanalyze.py,
+vtxpartition.py, skinpartition.py). Most come from the cycle count table in
+docs/Documentation/Performance.md, and are given as (F3DEX3_NOC, F3DEX3) unless
+noted; the rest are rough estimates, which perf_suite.py and rspsim.py can
+measure for a specific case. When the table changes, update these to match.
+"""
+
+# Command dispatch, and small commands which are just sent to the RDP
+DISPATCH_CYCLES = 10
+SMALL_RDP_CYCLES = 4
+
+# Tris: the first and second tri of a pair, and the extra per tri of a snake
+TRI_FIRST_CYCLES = (150, 152)
+TRI_SECOND_CYCLES = (149, 151)
+SNAKE_EXTRA_CYCLES = 10.5
+
+# Cycles per vertex pair, by lighting and number of lights
+PAIR_CYCLES_NONE = (54, 70)
+PAIR_CYCLES_DIR = [(65, 81), (70, 86), (77, 93), (84, 100), (91, 107),
+    (98, 114), (105, 121), (112, 128), (119, 135), (126, 142)]
+PAIR_CYCLES_POINT = [(117, 133), (194, 210), (271, 287), (348, 364), (425, 441),
+    (502, 518), (579, 595), (656, 672), (733, 749), (810, 826)]
+
+# Extra cycles per vertex pair for vertex features, as (ltbasic, ltadv)
+PACKED_NORMALS_CYCLES = (6, -3)
+LIGHTTOALPHA_CYCLES = (10, 6)
+AMBOCCLUSION_CYCLES = (9, 0)
+# Extra cycles per vertex pair in ltadv, the same in every build
+SPECULAR_OR_FRESNEL_CYCLES = 47
+FRESNEL_CYCLES = 23
+SPECULAR_PER_LIGHT_CYCLES = 13
+
+# Light direction transform after a matrix change, per number of directional
+# lights, the same in every build
+LIGHT_XFRM_CYCLES = [92, 92, 93, 118, 119, 144, 145, 170, 171, 196]
+
+# Per gsSPVertex command, not counting the vertex pairs: dispatch, setup before
+# the DMA, and roughly the DMA wait and the setup after the DMA. Estimate.
+LOAD_OVERHEAD_CYCLES = 100
+
+# Measured with rspsim.py on F3DEX3_BrZ: a matrix load command including
+# dispatch and DMA, the MVP recompute at the next vertex load after a matrix
+# change, and loading one of overlays 2-4 (mostly the DMA wait). A matrix change
+# costs MTX_CYCLES + MVP_RECOMPUTE_CYCLES.
+MTX_CYCLES = 100
+MVP_RECOMPUTE_CYCLES = 110
+OVERLAY_LOAD_CYCLES = 290
+CULLDL_CYCLES = 20
+
+
+def pairCycles(lighting, numLights, noc):
+    """Cycles per vertex pair; lighting is "none", "dir", or "point"."""
+    col = 0 if noc else 1
+    if lighting == "none":
+        return PAIR_CYCLES_NONE[col]
+    table = PAIR_CYCLES_DIR if lighting == "dir" else PAIR_CYCLES_POINT
+    return table[numLights][col]
@@ -0,0 +1,67 @@
+/*
+Per-object frustum culling from an axis-aligned bounding box, on the CPU.
+
+SPCullDisplayList needs the bounding box corners to be loaded with SPVertex
+first, which is a full vertex pass for 8 vertices (plus the DMA of them, and
+they take up 8 slots of the vertex buffer). There is no room left in IMEM for a
+microcode command which transforms a box directly, and putting one in an
+overlay would cost more in overlay loads than the vertex pass it replaces. But
+the test itself is tiny, so just do it on the CPU before emitting the object's
+display list at all. This costs roughly 50 floating point operations per
+object, and a culled object costs the RSP nothing--not even a command.
+
+The box is offscreen if all 8 corners are on the outside of the same screen
+edge, or all are behind the camera plane. This is the same test as
+SPCullDisplayList (with CLIP_SCRN_NPXY | CLIP_CAMPLANE). Instead of transforming
+the 8 corners, each clip space plane (e.g. w + x for the left screen edge) is
+evaluated only at the one corner where it is largest; if it is <= 0 there, it is
+<= 0 at all the corners.
+
+This does not test the occlusion plane. Objects which may be hidden by the
+occlusion plane can still use SPCullDisplayList after this test passes, see
+Performance.md.
+*/
+
+static float BoxPlaneMax(const float* p, const Vec3f* boxMin, const Vec3f* boxMax){
+    return p[3]
+        + p[0] * (p[0] > 0.0f ? boxMax->x : boxMin->x)
+        + p[1] * (p[1] > 0.0f ? boxMax->y : boxMin->y)
+        + p[2] * (p[2] > 0.0f ? boxMax->z : boxMin->z);
+}
+
+/*
+mvp is the full model * view * projection matrix for the object, e.g.
+SkinMatrix_MtxFMtxFMult(&play->viewProjectionMtxF, &modelMtxF, &mvp). The box
+is in model space.
+*/
+bool BoxIsOffscreen(MtxF* mvp, const Vec3f* boxMin, const Vec3f* boxMax){
+    float rx[4] = {mvp->xx, mvp->xy, mvp->xz, mvp->xw};
+    float ry[4] = {mvp->yx, mvp->yy, mvp->yz, mvp->yw};
+    float rw[4] = {mvp->wx, mvp->wy, mvp->wz, mvp->ww};
+    float planes[5][4];
+    for(s32 c=0; c<4; ++c){
+        planes[0][c] = rw[c] + rx[c]; // -X screen edge
+        planes[1][c] = rw[c] - rx[c]; // +X screen edge
+        planes[2][c] = rw[c] + ry[c]; // -Y screen edge
+        planes[3][c] = rw[c] - ry[c]; // +Y screen edge
+        planes[4][c] = rw[c];         // Camera plane
+    }
+    for(s32 p=0; p<5; ++p){
+        if(BoxPlaneMax(planes[p], boxMin, boxMax) <= 0.0f){
+            return true;
+        }
+    }
+    return false;
+}
+
+void someObjectDrawFunction(PlayState* play, MtxF* modelMtxF) {
+    static Vec3f ObjectBoundsMin = {-40.0f,  0.0f, -40.0f};
+    static Vec3f ObjectBoundsMax = { 40.0f, 90.0f,  40.0f};
+    MtxF mvp;
+    SkinMatrix_MtxFMtxFMult(&play->viewProjectionMtxF, modelMtxF, &mvp);
+    if(BoxIsOffscreen(&mvp, &ObjectBoundsMin, &ObjectBoundsMax)){
+        return;
+    }
+
+    ...
+}
@@ -0,0 +1,206 @@
+/*
+Decoding the F3DEX3 performance counters, deriving the usual metrics from them,
+and keeping the min / average / max over a number of frames.
+
+The structs in docs/Code/Counters.md use bitfields, which are laid out by the
+compiler: they are correct for the game, but not on a little-endian PC reading a
+dump of the counters, or with a compiler which orders bitfields differently.
+F3DEX3CountersDecode reads the raw big-endian words of the yield data footer
+directly, so this file gives the same results in the game and in a tool on the
+host reading captured footers (e.g. written to a file by the game over USB, or
+by an emulator). It only needs the u8 / u16 / u32 / s32 / f32 types; see
+counters.h for building it on a PC, e.g.:
+
+gcc -O2 -Wall -DF3DEX3_COUNTERS_HOST -c cpu/counters.c
+
+docs/Code/Counters.md shows how to call it in the game and in a host tool.
+
+Each set of counters comes from a different microcode version (see
+profrotate.c), so F3DEX3Counters keeps which sets it has. The metrics which need
+counters from two sets (e.g. cycles per vertex needs vertexProcCycles from A and
+vertexCount from B or the default) are only valid when both were captured; with
+the rotation, they are from nearby frames.
+*/
+
+#include "counters.h"
+
+static u32 CountersWord(const u8* raw, s32 i){
+    raw += 4 * i;
+    return ((u32)raw[0] << 24) | ((u32)raw[1] << 16) | ((u32)raw[2] << 8) | raw[3];
+}
+
+/*
+raw is the first 16 bytes of the F3DEX3YieldDataFooter, as written by the
+microcode version of the given set. Only the counters of that set are updated.
+*/
+void F3DEX3CountersDecode(F3DEX3Counters* c, const u8* raw, F3DEX3CounterSet set){
+    u32 w0 = CountersWord(raw, 0);
+    u32 w1 = CountersWord(raw, 1);
+    u32 w2 = CountersWord(raw, 2);
+    u32 w3 = CountersWord(raw, 3);
+    switch(set){
+    case COUNTERS_SET_DEFAULT:
+        c->vertexCount = w0 >> 16;
+        c->rdpOutTriCount = w0 & 0xFFFF;
+        c->rspInTriCount = w1 >> 14;
+        c->rectCount = w1 & 0x3FFF;
+        c->stallRDPFifoFullCycles = w2;
+        break;
+    case COUNTERS_SET_A:
+        c->vertexProcCycles = w0;
+        c->fetchedDLCommandCount = w1 >> 16;
+        c->dlCommandCountA = w1 & 0xFFFF;
+        c->stallRDPFifoFullCycles = w2;
+        c->triProcCycles = w3;
+        break;
+    case COUNTERS_SET_B:
+        c->vertexCount = w0 >> 16;
+        c->litVertexCount = w0 & 0xFFFF;
+        c->occlusionPlaneCullCount = w1 >> 14;
+        c->clippedTriCount = w1 & 0x3FFF;
+        c->allOverlayLoadCount = w2 >> 14;
+        c->lightingOverlayLoadCount = w2 & 0x3FFF;
+        c->clippingOverlayLoadCount = w3 >> 14;
+        c->miscOverlayLoadCount = w3 & 0x3FFF;
+        break;
+    case COUNTERS_SET_C:
+        c->ex3UcodeCycles = w0;
+        c->commandsSampledGclkActive = w1 >> 16;
+        c->dlCommandCount = w1 & 0xFFFF;
+        c->smallRDPCommandCount = w2 >> 14;
+        c->matrixCount = w2 & 0x3FFF;
+        c->stallDMACycles = w3;
+        break;
+    default:
+        return;
+    }
+    c->sets |= 1 << set;
+}
+
+static f32 MetricRatio(u32 num, u32 den, f32 scale){
+    return den == 0 ? -1.0f : (f32)num * scale / (f32)den;
+}
+
+/*
+Computes the metrics, or -1 for those whose counters have not been decoded.
+frameCycles is the RCP cycles per frame, e.g. 62500000 / 20 at 20 FPS.
+*/
+void F3DEX3CountersMetrics(const F3DEX3Counters* c, u32 frameCycles, f32* metrics){
+    s32 hasDefB = COUNTERS_HAS(c, COUNTERS_SET_DEFAULT) || COUNTERS_HAS(c, COUNTERS_SET_B);
+    s32 hasStall = COUNTERS_HAS(c, COUNTERS_SET_DEFAULT) || COUNTERS_HAS(c, COUNTERS_SET_A);
+    for(s32 i=0; i<METRIC_COUNT; ++i){
+        metrics[i] = -1.0f;
+    }
+    if(COUNTERS_HAS(c, COUNTERS_SET_C)){
+        metrics[METRIC_RSP_UTILIZATION] = MetricRatio(c->ex3UcodeCycles, frameCycles, 100.0f);
+        metrics[METRIC_DMA_STALL_PCT] = MetricRatio(c->stallDMACycles, c->ex3UcodeCycles, 100.0f);
+        // Same 16 bit wrap as the DL fetch metric below
+        if(c->dlCommandCount >= c->commandsSampledGclkActive){
+            metrics[METRIC_RDP_BUSY_PCT] = MetricRatio(c->commandsSampledGclkActive, c->dlCommandCount, 100.0f);
+        }
+        if(hasStall){
+            metrics[METRIC_FIFO_STALL_PCT] = MetricRatio(c->stallRDPFifoFullCycles, c->ex3UcodeCycles, 100.0f);
+        }
+    }
+    if(COUNTERS_HAS(c, COUNTERS_SET_A)){
+        // Both are 16 bit counters. If fetched has wrapped and executed has not,
+        // the difference and the fetched count are both wrong, so leave it -1.
+        if(c->fetchedDLCommandCount >= c->dlCommandCountA){
+            metrics[METRIC_DL_FETCH_WASTE_PCT] = MetricRatio(
+                c->fetchedDLCommandCount - c->dlCommandCountA, c->fetchedDLCommandCount, 100.0f);
+        }
+        if(hasDefB){
+            metrics[METRIC_CYCLES_PER_VERTEX] = MetricRatio(c->vertexProcCycles, c->vertexCount, 1.0f);
+        }
+        if(COUNTERS_HAS(c, COUNTERS_SET_DEFAULT)){
+            metrics[METRIC_CYCLES_PER_TRI] = MetricRatio(c->triProcCycles, c->rspInTriCount, 1.0f);
+        }
+    }
+    if(COUNTERS_HAS(c, COUNTERS_SET_B)){
+        metrics[METRIC_OVERLAY_LOADS] = (f32)c->allOverlayLoadCount;
+    }
+}
+
+/*
+Min / average / max of each metric over the last COUNTERS_WINDOW frames, updated
+every frame. Frames where a metric was not valid (-1) are left out of it.
+*/
+void F3DEX3MetricStatsInit(F3DEX3MetricStats* s){
+    for(s32 f=0; f<COUNTERS_WINDOW; ++f){
+        for(s32 i=0; i<METRIC_COUNT; ++i){
+            s->history[f][i] = -1.0f;
+        }
+    }
+    for(s32 i=0; i<METRIC_COUNT; ++i){
+        s->min[i] = s->avg[i] = s->max[i] = -1.0f;
+    }
+    s->next = 0;
+}
+
+void F3DEX3MetricStatsAdd(F3DEX3MetricStats* s, const f32* metrics){
+    for(s32 i=0; i<METRIC_COUNT; ++i){
+        s->history[s->next][i] = metrics[i];
+    }
+    if(++s->next >= COUNTERS_WINDOW) s->next = 0;
+    for(s32 i=0; i<METRIC_COUNT; ++i){
+        f32 mn = 0.0f, mx = 0.0f, sum = 0.0f;
+        s32 count = 0;
+        for(s32 f=0; f<COUNTERS_WINDOW; ++f){
+            f32 m = s->history[f][i];
+            if(m < 0.0f) continue;
+            if(count == 0 || m < mn) mn = m;
+            if(count == 0 || m > mx) mx = m;
+            sum += m;
+            ++count;
+        }
+        if(count == 0){
+            s->min[i] = s->avg[i] = s->max[i] = -1.0f;
+        }else{
+            s->min[i] = mn;
+            s->avg[i] = sum / (f32)count;
+            s->max[i] = mx;
+        }
+    }
+}
+
+/*
+raw is the profiling buffer of a CFG_PROFILING_TAGS microcode (see
+gSPProfilingBuffer in gbi.h), which the game zeroed before the frame, so the
+records end at the first zero tag or after maxRecords. The cycles, vertices,
+tris, and rects from each record to the next are added to the entry for its
+tag in tags, in the order the tags first appear; returns the number of entries
+used. The last record has nothing after it, so it only ends the one before;
+put e.g. gDPNoOpTag with a tag of its own at the end of the frame's display
+list. Records after maxTags different tags have been seen are left out.
+*/
+s32 F3DEX3TagRecordsDecode(const u8* raw, s32 maxRecords, F3DEX3TagStats* tags, s32 maxTags){
+    s32 numTags = 0;
+    for(s32 r=0; r+1<maxRecords; ++r){
+        const u8* cur = raw + r * F3DEX3_TAG_RECORD_SIZE;
+        const u8* next = cur + F3DEX3_TAG_RECORD_SIZE;
+        u32 tag = CountersWord(cur, 0);
+        if(tag == 0 || CountersWord(next, 0) == 0) break;
+        s32 t;
+        for(t=0; t<numTags; ++t){
+            if(tags[t].tag == tag) break;
+        }
+        if(t == numTags){
+            if(numTags >= maxTags) continue;
+            tags[t].tag = tag;
+            tags[t].count = tags[t].cycles = tags[t].vertexCount = 0;
+            tags[t].rdpOutTriCount = tags[t].rspInTriCount = tags[t].rectCount = 0;
+            ++numTags;
+        }
+        // DPC_CLOCK is 24 bits; the counters are the default set, which wrap
+        // at their widths (see F3DEX3CountersDecode)
+        u32 a0 = CountersWord(cur, 2), a1 = CountersWord(next, 2);
+        u32 b0 = CountersWord(cur, 3), b1 = CountersWord(next, 3);
+        tags[t].count += 1;
+        tags[t].cycles += (CountersWord(next, 1) - CountersWord(cur, 1)) & 0xFFFFFF;
+        tags[t].vertexCount += ((a1 >> 16) - (a0 >> 16)) & 0xFFFF;
+        tags[t].rdpOutTriCount += (a1 - a0) & 0xFFFF;
+        tags[t].rspInTriCount += ((b1 >> 14) - (b0 >> 14)) & 0x3FFFF;
+        tags[t].rectCount += (b1 - b0) & 0x3FFF;
+    }
+    return numTags;
+}
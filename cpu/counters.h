@@ -0,0 +1,108 @@
+/*
+Decoding the F3DEX3 performance counters, see counters.c and
+docs/Code/Counters.md.
+
+In the game, include this after the libultra types (u8, u32, f32, etc.). On a
+PC, define F3DEX3_COUNTERS_HOST to get them from stdint.h instead.
+*/
+
+#ifndef F3DEX3_COUNTERS_H
+#define F3DEX3_COUNTERS_H
+
+#ifdef F3DEX3_COUNTERS_HOST
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef float f32;
+#endif
+
+// Which microcode version wrote a footer. Same order as ProfSet in
+// profrotate.c, so its values can be passed directly.
+typedef enum {
+    COUNTERS_SET_DEFAULT,
+    COUNTERS_SET_A, // CFG_PROFILING_A
+    COUNTERS_SET_B, // CFG_PROFILING_B
+    COUNTERS_SET_C, // CFG_PROFILING_C
+    COUNTERS_SET_COUNT
+} F3DEX3CounterSet;
+
+typedef struct {
+    u32 sets; // Bit per F3DEX3CounterSet which has been decoded into this
+    // Default
+    u32 vertexCount;        // Also in B
+    u32 rdpOutTriCount;
+    u32 rspInTriCount;
+    u32 rectCount;
+    u32 stallRDPFifoFullCycles; // Also in A
+    // A
+    u32 vertexProcCycles;
+    u32 fetchedDLCommandCount;
+    u32 dlCommandCountA;    // Same counter as dlCommandCount, from the A frame
+    u32 triProcCycles;
+    // B
+    u32 litVertexCount;
+    u32 occlusionPlaneCullCount;
+    u32 clippedTriCount;
+    u32 allOverlayLoadCount;
+    u32 lightingOverlayLoadCount;
+    u32 clippingOverlayLoadCount;
+    u32 miscOverlayLoadCount;
+    // C
+    u32 ex3UcodeCycles;
+    u32 commandsSampledGclkActive;
+    u32 dlCommandCount;
+    u32 smallRDPCommandCount;
+    u32 matrixCount;
+    u32 stallDMACycles;
+} F3DEX3Counters;
+
+#define COUNTERS_HAS(c, set) (((c)->sets & (1 << (set))) != 0)
+
+typedef enum {
+    METRIC_RSP_UTILIZATION,   // % of the frame time the RSP ran F3DEX3 (C)
+    METRIC_CYCLES_PER_VERTEX, // Including the vertex DMA (A and default / B)
+    METRIC_CYCLES_PER_TRI,    // Per input tri, not including FIFO stalls (A and default)
+    METRIC_FIFO_STALL_PCT,    // % of F3DEX3 time stalled on a full RDP FIFO (default / A, and C)
+    METRIC_DMA_STALL_PCT,     // % of F3DEX3 time stalled on other DMAs (C)
+    METRIC_RDP_BUSY_PCT,      // Approximate % of the time the RDP was not waiting for memory (C)
+    METRIC_OVERLAY_LOADS,     // Overlay loads per frame (B)
+    METRIC_DL_FETCH_WASTE_PCT, // % of fetched DL commands which were not executed (A)
+    METRIC_COUNT
+} F3DEX3Metric;
+
+// Number of frames the min / average / max are over
+#define COUNTERS_WINDOW 30
+
+typedef struct {
+    f32 min[METRIC_COUNT];
+    f32 avg[METRIC_COUNT];
+    f32 max[METRIC_COUNT];
+    // Metrics of the last COUNTERS_WINDOW frames, -1 if not valid
+    f32 history[COUNTERS_WINDOW][METRIC_COUNT];
+    s32 next; // Row of history to write next
+} F3DEX3MetricStats;
+
+// Totals per tag from the records of the CFG_PROFILING_TAGS microcodes (see
+// gSPProfilingBuffer in gbi.h): everything from each record to the next.
+typedef struct {
+    u32 tag;
+    u32 count;          // Times the tag was run
+    u32 cycles;         // RCP cycles
+    u32 vertexCount;
+    u32 rdpOutTriCount;
+    u32 rspInTriCount;
+    u32 rectCount;
+} F3DEX3TagStats;
+
+// Size of one record in the buffer
+#define F3DEX3_TAG_RECORD_SIZE 16
+
+void F3DEX3CountersDecode(F3DEX3Counters* c, const u8* raw, F3DEX3CounterSet set);
+void F3DEX3CountersMetrics(const F3DEX3Counters* c, u32 frameCycles, f32* metrics);
+void F3DEX3MetricStatsInit(F3DEX3MetricStats* s);
+void F3DEX3MetricStatsAdd(F3DEX3MetricStats* s, const f32* metrics);
+s32 F3DEX3TagRecordsDecode(const u8* raw, s32 maxRecords, F3DEX3TagStats* tags, s32 maxTags);
+
+#endif
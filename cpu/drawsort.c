@@ -0,0 +1,211 @@
+/*
+Sorting opaque draws by material, so F3DEX3's auto-batched rendering can skip
+their texture loads.
+
+The microcode remembers the address of the last material display list it ran
+(see the comment near SPDontSkipTexLoadsAcross in gbi.h). When the same material
+display list runs again, with only vertices and tris from other display lists in
+between, its texture loads are skipped, as the textures are still in TMEM. But
+if objects are drawn in scene graph order, consecutive draws rarely use the same
+material. So instead of drawing directly, add each draw here, and then emit them
+all sorted by layer and then by material address.
+
+Draws are only reordered within the same layer, and layers are emitted in
+ascending order. Use a different layer for anything whose order matters, e.g.
+each render mode which does not use the Z buffer, or decals which must be drawn
+after what they are on. Within a layer, draws of the same material stay in the
+order they were added.
+
+The geometry display lists must not contain any materials (set image commands),
+as those would replace the last material address. Each draw still runs its
+whole material display list, so any other state it sets is correct regardless
+of the order; only the texture loads are skipped.
+*/
+
+typedef struct {
+    Gfx* material;  // Material display list
+    Gfx* geometry;  // Drawn after the material
+    Mtx* mtx;       // Model matrix, or NULL to keep the current one
+    u16 layer;      // Draws are only reordered within a layer
+    u16 order;      // Order added, to keep sorting stable
+} DrawSortEntry;
+
+typedef struct {
+    DrawSortEntry* entries;
+    s32 count;
+    s32 capacity;
+} DrawSortList;
+
+typedef struct {
+    s32 draws;
+    s32 texLoadsSkipped;         // Texture loads the microcode will skip
+    s32 texLoadsSkippedUnsorted; // Same, if the draws had not been sorted
+    s32 materialsUncounted;      // Repeats not counted above, in either order
+} DrawSortStats;
+
+void DrawSortInit(DrawSortList* list, DrawSortEntry* buf, s32 capacity){
+    list->entries = buf;
+    list->count = 0;
+    list->capacity = capacity;
+}
+
+/*
+Returns false if the list is full; draw it directly in that case.
+*/
+bool DrawSortAdd(DrawSortList* list, u16 layer, Gfx* material, Gfx* geometry, Mtx* mtx){
+    if(list->count >= list->capacity){
+        return false;
+    }
+    DrawSortEntry* e = &list->entries[list->count];
+    e->material = material;
+    e->geometry = geometry;
+    e->mtx = mtx;
+    e->layer = layer;
+    e->order = list->count++;
+    return true;
+}
+
+#define DRAWSORT_MAX_MATERIAL_CMDS 64
+
+/*
+Number of texture loads the microcode skips when a material display list is
+repeated, or -1 if it could not be counted.
+
+This follows what the microcode does: a material starts at the first set image
+command, and ends at a call, branch, return, vertex, tri, or rectangle command.
+Only the loads between those are skipped. The first level of G_DL is followed,
+because a set image command in the called display list starts a second material
+at a different address, after which the repeat no longer matches and nothing is
+skipped. A display list called from there is not followed, so it counts as -1,
+as does reaching DRAWSORT_MAX_MATERIAL_CMDS commands without the end.
+*/
+static s32 MaterialTexLoads(Gfx* material){
+    Gfx* dl = SEGMENTED_TO_VIRTUAL(material);
+    Gfx* ret = NULL;
+    bool followed = false;
+    s32 materials = 0;
+    bool inMaterial = false;
+    s32 loads = 0;
+    for(s32 i=0; i<DRAWSORT_MAX_MATERIAL_CMDS; ++i, ++dl){
+        u8 cmd = dl->words.w0 >> 24;
+        switch(cmd){
+        case G_SETTIMG: case G_SETZIMG: case G_SETCIMG:
+            if(!inMaterial){
+                inMaterial = true;
+                ++materials;
+            }
+            break;
+        case G_LOADBLOCK: case G_LOADTILE: case G_LOADTLUT:
+            if(inMaterial) ++loads;
+            break;
+        case G_DL:
+            inMaterial = false;
+            if(followed) return -1;
+            followed = true;
+            if(((dl->words.w0 >> 16) & 0xFF) == G_DL_PUSH){
+                ret = dl;
+            }
+            dl = (Gfx*)SEGMENTED_TO_VIRTUAL(dl->words.w1) - 1;
+            break;
+        case G_ENDDL:
+            inMaterial = false;
+            if(ret == NULL) return (materials == 1) ? loads : 0;
+            dl = ret;
+            ret = NULL;
+            break;
+        case G_VTX: case G_TRI1: case G_TRI2: case G_QUAD: case G_TRISNAKE:
+        case G_CULLDL: case G_BRANCH_WZ: case G_RDPHALF_2: case G_FILLRECT:
+            inMaterial = false;
+            break;
+        }
+    }
+    return -1;
+}
+
+static s32 DrawSortTexLoadsSkipped(DrawSortList* list, s32* uncounted){
+    s32 skipped = 0;
+    for(s32 i=1; i<list->count; ++i){
+        if(list->entries[i].material == list->entries[i-1].material){
+            s32 loads = MaterialTexLoads(list->entries[i].material);
+            if(loads < 0){
+                ++*uncounted;
+            }else{
+                skipped += loads;
+            }
+        }
+    }
+    return skipped;
+}
+
+static s32 DrawSortCompare(const DrawSortEntry* a, const DrawSortEntry* b){
+    if(a->layer != b->layer) return a->layer < b->layer ? -1 : 1;
+    if(a->material != b->material) return a->material < b->material ? -1 : 1;
+    return a->order < b->order ? -1 : (a->order > b->order ? 1 : 0);
+}
+
+static void DrawSortSort(DrawSortList* list){
+    // Shell sort: no qsort in libultra, and the order field makes it stable
+    DrawSortEntry* e = list->entries;
+    s32 n = list->count;
+    for(s32 gap = n / 2; gap > 0; gap /= 2){
+        for(s32 i=gap; i<n; ++i){
+            DrawSortEntry tmp = e[i];
+            s32 j = i;
+            for(; j >= gap && DrawSortCompare(&e[j-gap], &tmp) > 0; j -= gap){
+                e[j] = e[j-gap];
+            }
+            e[j] = tmp;
+        }
+    }
+}
+
+/*
+Sorts and emits all the draws, and empties the list. stats may be NULL; the
+texture load counts scan the material display lists, so only ask for them when
+they will be displayed. If stats->materialsUncounted is nonzero, some repeated
+materials could not be scanned (see MaterialTexLoads), and both counts are lower
+bounds.
+*/
+void DrawSortFlush(DrawSortList* list, Gfx** gfxP, DrawSortStats* stats){
+    Gfx* gfx = *gfxP;
+    if(stats != NULL){
+        stats->draws = list->count;
+        stats->materialsUncounted = 0;
+        stats->texLoadsSkippedUnsorted =
+            DrawSortTexLoadsSkipped(list, &stats->materialsUncounted);
+    }
+    DrawSortSort(list);
+    if(stats != NULL){
+        stats->texLoadsSkipped =
+            DrawSortTexLoadsSkipped(list, &stats->materialsUncounted);
+    }
+    for(s32 i=0; i<list->count; ++i){
+        DrawSortEntry* e = &list->entries[i];
+        if(e->mtx != NULL){
+            gSPMatrix(gfx++, e->mtx, G_MTX_MODEL | G_MTX_LOAD | G_MTX_NOPUSH);
+        }
+        gSPDisplayList(gfx++, e->material);
+        gSPDisplayList(gfx++, e->geometry);
+    }
+    list->count = 0;
+    *gfxP = gfx;
+}
+
+void someSceneDrawFunction(PlayState* play) {
+    static DrawSortEntry sDrawSortBuf[256];
+    static DrawSortList sDrawSort;
+    ...
+
+    DrawSortInit(&sDrawSort, sDrawSortBuf, ARRAY_COUNT(sDrawSortBuf));
+    // For each opaque object, instead of gSPDisplayList(POLY_OPA_DISP++, ...):
+    //     DrawSortAdd(&sDrawSort, 0, gRockMaterialDL, gRockGeometryDL, rockMtx);
+    ...
+
+    OPEN_DISPS(play->state.gfxCtx);
+    DrawSortStats stats;
+    DrawSortFlush(&sDrawSort, &POLY_OPA_DISP, &stats);
+    // Optional: print stats.texLoadsSkipped vs. stats.texLoadsSkippedUnsorted
+    CLOSE_DISPS(play->state.gfxCtx);
+
+    ...
+}
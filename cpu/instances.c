@@ -0,0 +1,101 @@
+/*
+Drawing many copies of the same small model (grass, fences, coins, etc.).
+
+If each copy is drawn as its own actor / object, each one runs the whole model
+display list, including the material: texture loads, combiner, othermode, etc.
+Instead, split the model into a material display list and a geometry display
+list (the SPVertex and triangles only), and draw the material once followed by
+the geometry of each copy with its own matrix. Then each extra copy costs one
+SPMatrix, the SPDisplayList call, and the vertices and tris themselves.
+
+There is no microcode command which replays a display list per matrix. It would
+not save much more than this: the vertices have to be transformed again for
+every copy anyway, and the vertex DMA is almost entirely hidden behind the
+vertex setup (see the packed vertex format discussion in Design
+Tradeoffs.md). And there is no IMEM or DMEM left for it.
+
+For copies which only differ by position, InstancesDraw writes the matrices
+directly in fixed point, which is much cheaper than building a MtxF and
+converting it. It also frustum culls each copy with BoxIsOffscreen (boxcull.c)
+by moving the bounds instead of multiplying matrices, and skips the material if
+no copies are visible.
+
+The geometry display list must not change any material state (it would not be
+restored for the next copy) and must end with SPEndDisplayList. The matrices are
+loaded with G_MTX_LOAD, so the model matrix is whatever the last copy used
+afterwards.
+*/
+
+typedef struct {
+    Gfx* material; // Drawn once before all visible copies
+    Gfx* geometry; // Drawn once per visible copy
+    Vec3f boundsMin; // Model space bounds of the geometry
+    Vec3f boundsMax;
+} InstancedModel;
+
+/*
+Translation matrix in the RSP fixed point format, equivalent to guTranslate
+but without any float matrix math.
+*/
+void InstanceTranslationMtx(Mtx* m, f32 x, f32 y, f32 z){
+    s32 fx = (s32)(x * 65536.0f);
+    s32 fy = (s32)(y * 65536.0f);
+    s32 fz = (s32)(z * 65536.0f);
+    // Integer parts
+    m->m[0][0] = 0x00010000; m->m[0][1] = 0;
+    m->m[0][2] = 0x00000001; m->m[0][3] = 0;
+    m->m[1][0] = 0;          m->m[1][1] = 0x00010000;
+    m->m[1][2] = (fx & 0xFFFF0000) | ((u32)fy >> 16);
+    m->m[1][3] = (fz & 0xFFFF0000) | 0x00000001;
+    // Fractional parts
+    m->m[2][0] = 0; m->m[2][1] = 0;
+    m->m[2][2] = 0; m->m[2][3] = 0;
+    m->m[3][0] = 0; m->m[3][1] = 0;
+    m->m[3][2] = (fx << 16) | (fy & 0xFFFF);
+    m->m[3][3] = (fz << 16);
+}
+
+/*
+Draws the copies of model at positions which are on screen. viewProj is the
+camera view * projection matrix, e.g. &play->viewProjectionMtxF. mtxBuf must
+have room for count matrices and stay valid until the RSP is done, e.g.
+GRAPH_ALLOC. Returns the number of copies drawn.
+*/
+s32 InstancesDraw(Gfx** gfxP, MtxF* viewProj, const InstancedModel* model,
+        const Vec3f* positions, s32 count, Mtx* mtxBuf){
+    Gfx* gfx = *gfxP;
+    s32 drawn = 0;
+    for(s32 i=0; i<count; ++i){
+        const Vec3f* p = &positions[i];
+        Vec3f bmin = {model->boundsMin.x + p->x, model->boundsMin.y + p->y, model->boundsMin.z + p->z};
+        Vec3f bmax = {model->boundsMax.x + p->x, model->boundsMax.y + p->y, model->boundsMax.z + p->z};
+        if(BoxIsOffscreen(viewProj, &bmin, &bmax)){
+            continue;
+        }
+        if(drawn == 0){
+            gSPDisplayList(gfx++, model->material);
+        }
+        Mtx* m = &mtxBuf[drawn++];
+        InstanceTranslationMtx(m, p->x, p->y, p->z);
+        gSPMatrix(gfx++, m, G_MTX_MODEL | G_MTX_LOAD | G_MTX_NOPUSH);
+        gSPDisplayList(gfx++, model->geometry);
+    }
+    *gfxP = gfx;
+    return drawn;
+}
+
+void someGrassDrawFunction(PlayState* play) {
+    static InstancedModel GrassModel = {
+        gGrassMaterialDL, gGrassGeometryDL,
+        {-10.0f, 0.0f, -10.0f}, {10.0f, 25.0f, 10.0f}
+    };
+    ...
+
+    OPEN_DISPS(play->state.gfxCtx);
+    Mtx* mtxBuf = GRAPH_ALLOC(play->state.gfxCtx, sGrassCount * sizeof(Mtx));
+    InstancesDraw(&POLY_OPA_DISP, &play->viewProjectionMtxF, &GrassModel,
+        sGrassPositions, sGrassCount, mtxBuf);
+    CLOSE_DISPS(play->state.gfxCtx);
+
+    ...
+}
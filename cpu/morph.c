@@ -0,0 +1,139 @@
+/*
+Morph target (blend shape) vertex blending for faces, water surfaces, etc.
+
+F3DEX3 doesn't blend vertices itself. A G_VTX variant which DMAs target B next
+to target A needs 16 more bytes of DMEM per vertex of the load (8 if only
+positions are blended), 896 for a full 56 vertex load, far more than the free
+DMEM (see "Free IMEM and DMEM" in docs/Documentation/Performance.md for the free
+memory of each build). Target A is DMAed into the end of the vertex buffer range
+it is transformed into, so there is no room there either. The only way to get
+the space is to shrink the vertex buffer, 38 bytes per slot, to 39 vertices,
+which every display list would have to be built for. The code needs a second DMA
+in G_VTX and a moveword for the weight (about 6 instructions), and the load,
+subtract, scale, and add of B's position and color in the vertex loop (about 10
+instructions and 10 cycles per vertex pair, 14% of an unlit pair), in the main
+loop and again in ltadv: about 25 instructions, 100 bytes, which only NOC _PA
+and _PB have free. So the CPU still writes the blended Vtx array, but this keeps
+that cheap:
+
+- Only the vertices which actually differ between the two targets are stored
+  (MorphBuildDeltas, once at load time) and touched each frame. For a face,
+  usually only a small part of the head mesh moves.
+- The output is double buffered, since the RSP may still be reading last
+  frame's vertices. Both buffers start as copies of target A, and only the
+  morphing vertices are ever written again.
+- Each buffer remembers the weight it was blended with, so when the weight does
+  not change (e.g. the mouth is closed), nothing is written at all.
+
+So per frame the game only sets one weight, and the cost is proportional to
+the number of morphing vertices, not the mesh size.
+
+Vertex colors are blended as unsigned, or if lit is set, the normals are
+blended as signed. Blending normals linearly does not keep them normalized,
+but for small deformations the error is not visible.
+*/
+
+typedef struct {
+    u16 index;   // Vertex index in the mesh
+    s16 dPos[3]; // Target B minus target A; must fit in s16
+    s16 dCn[4];  // Color or normal + alpha, target B minus target A
+} MorphDelta;
+
+typedef struct {
+    const Vtx* a;
+    const MorphDelta* deltas;
+    s32 numVerts;
+    s32 numDeltas;
+    Vtx* out[2];      // numVerts each
+    s32 outWeight[2]; // Weight each buffer was last blended with
+    u8 lit;
+    u8 frame;
+} MorphMesh;
+
+/*
+Writes the differences between the two targets into deltas (which must have
+room for numVerts entries) and returns how many there are. Only the position and
+color / normal are morphed; the texture coordinates and flag are from a.
+*/
+s32 MorphBuildDeltas(const Vtx* a, const Vtx* b, s32 numVerts, u8 lit, MorphDelta* deltas){
+    s32 num = 0;
+    for(s32 i=0; i<numVerts; ++i){
+        const Vtx_t* va = &a[i].v;
+        const Vtx_t* vb = &b[i].v;
+        MorphDelta* d = &deltas[num];
+        s32 any = 0;
+        for(s32 c=0; c<3; ++c){
+            d->dPos[c] = vb->ob[c] - va->ob[c];
+            any |= d->dPos[c];
+        }
+        for(s32 c=0; c<4; ++c){
+            if(lit && c < 3){
+                d->dCn[c] = (s8)vb->cn[c] - (s8)va->cn[c];
+            }else{
+                d->dCn[c] = vb->cn[c] - va->cn[c];
+            }
+            any |= d->dCn[c];
+        }
+        if(any != 0){
+            d->index = i;
+            ++num;
+        }
+    }
+    return num;
+}
+
+void MorphInit(MorphMesh* m, const Vtx* a, const MorphDelta* deltas,
+        s32 numVerts, s32 numDeltas, u8 lit, Vtx* out0, Vtx* out1){
+    m->a = a;
+    m->deltas = deltas;
+    m->numVerts = numVerts;
+    m->numDeltas = numDeltas;
+    m->out[0] = out0;
+    m->out[1] = out1;
+    m->lit = lit;
+    m->frame = 0;
+    for(s32 f=0; f<2; ++f){
+        bcopy(a, m->out[f], numVerts * sizeof(Vtx));
+        m->outWeight[f] = 0;
+    }
+}
+
+/*
+Blends with weight 0 (target A) to 0x8000 (target B) into the buffer for this
+frame, and returns it for gSPVertex. Call once per frame.
+*/
+Vtx* MorphUpdate(MorphMesh* m, s32 weight){
+    weight = CLAMP(weight, 0, 0x8000);
+    m->frame ^= 1;
+    Vtx* out = m->out[m->frame];
+    if(m->outWeight[m->frame] == weight){
+        return out;
+    }
+    m->outWeight[m->frame] = weight;
+    for(s32 i=0; i<m->numDeltas; ++i){
+        const MorphDelta* d = &m->deltas[i];
+        const Vtx_t* va = &m->a[d->index].v;
+        Vtx_t* vo = &out[d->index].v;
+        for(s32 c=0; c<3; ++c){
+            vo->ob[c] = va->ob[c] + ((d->dPos[c] * weight) >> 15);
+        }
+        for(s32 c=0; c<4; ++c){
+            s32 base = (m->lit && c < 3) ? (s8)va->cn[c] : va->cn[c];
+            vo->cn[c] = base + ((d->dCn[c] * weight) >> 15);
+        }
+    }
+    return out;
+}
+
+void someFaceDrawFunction(PlayState* play, MorphMesh* face) {
+    ...
+
+    // Once at load time:
+    //     numDeltas = MorphBuildDeltas(faceNeutralVtx, faceSmileVtx, FACE_NUM_VTX, false, faceDeltas);
+    //     MorphInit(face, faceNeutralVtx, faceDeltas, FACE_NUM_VTX, numDeltas, false, faceVtx0, faceVtx1);
+    // The face display list uses segment 0x08 for its vertices.
+    Vtx* vtx = MorphUpdate(face, (s32)(sSmileAmount * 0x8000));
+    gSPSegment(POLY_OPA_DISP++, 0x08, vtx);
+
+    ...
+}
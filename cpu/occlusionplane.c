@@ -33,8 +33,20 @@ the one which you think is most optimal. Some criteria to use for this include:
     of the finite plane
 You can get even more relevant metrics by using parts of the code here. For
 example, the screen area of the occlusion plane can be computed from the clipped
-screen-space polygon. However, it's probably not worth it to run that much of
-the code here for every candidate occlusion plane.
+screen-space polygon. Running all of ComputeOcclusionPlane for every candidate
+would be too expensive, but EvaluateOcclusionPlaneCandidates below does just
+the screen area part for a whole array of candidates at once, and
+ComputeBestOcclusionPlane uses it to pick the candidate which occludes the most
+(weighted) screen area.
+
+The RSP reads the occlusion plane at the start of every SPVertex, so you can
+also use different occlusion planes for different objects in the same frame
+(e.g. in a city scene with several large walls). Compute the planes for the
+few best candidates, and before drawing each object, send the plane whose
+candidate hides that object, as chosen by SelectObjectOcclusionPlane. Only
+emit a new SPOcclusionPlane command when the choice changes; each one costs a
+small DMA (see Performance.md). Don't change the plane between an object's
+SPVertex and its triangles.
 
 4. Take a look at the commented out code using occPlaneMessage. Except for
 "Offscreen" and the candidate counts, all the messages written to it represent
@@ -227,6 +239,113 @@ static OcclusionPlane sNoOcclusionPlane = {
     0x7FFF
 };
 
+// Assigns the candidate edges to the four edge equations and writes the
+// resulting occlusion plane. Shared by the float and fixed-point versions.
+static OcclusionPlane* AssignEdgeEquations(PlayState* play, EdgeCandidate cands[4][3],
+        u8* numCands, u8* candsForEdge, u8 totalEdges, s16 kx, s16 ky, s16 kz, s16 kc){
+    // Assign candidates to equations.
+    while(true){
+        // Check fail condition: if now there is some edge which has no candidates
+        for(s32 e=0; e<totalEdges; ++e){
+            if(candsForEdge[e] == 0){
+                //sprintf(occPlaneMessage, "Edge %d now has no cands", e);
+                return &sNoOcclusionPlane;
+            }
+        }
+        // Check done condition: all equations have 0 or 1 candidates
+        bool done = true;
+        for(s32 q=0; q<4; ++q){
+            if(numCands[q] >= 2){
+                done = false;
+                break;
+            }
+        }
+        if(done) break;
+        // Check for an equation which has more than one candidate edge, but
+        // one of those edges only has one candidate, so that edge has to be
+        // assigned to that equation.
+        bool madeChange = false;
+        for(s32 q=0; q<4 && !madeChange; ++q){
+            if(numCands[q] <= 1) continue;
+            for(s32 c=0; c<numCands[q]; ++c){
+                if(candsForEdge[cands[q][c].edgeID] == 1){
+                    madeChange = true;
+                    // Decrement num candidates for other edges in this equation
+                    for(s32 i=0; i<numCands[q]; ++i){
+                        if(i == c) continue;
+                        --(candsForEdge[cands[q][i].edgeID]);
+                    }
+                    // Move found edge to position 0 and truncate list
+                    cands[q][0] = cands[q][c];
+                    numCands[q] = 1;
+                    break;
+                }
+            }
+        }
+        if(madeChange) continue; // Restart loop
+        // Take the first equation which has more than one candidate edge, and
+        // assign the edge with smallest abs(cScale)
+        for(s32 q=0; q<4; ++q){
+            if(numCands[q] <= 1) continue;
+            s32 bestC = 0;
+            s32 bestScale = ABS((s32)cands[q][0].cScale);
+            for(s32 c=1; c<numCands[q]; ++c){
+                s32 scale = ABS((s32)cands[q][c].cScale);
+                if(scale < bestScale){
+                    bestScale = scale;
+                    bestC = c;
+                }
+            }
+            // Assigning equation q to edge e (edge currently as candidate bestC)
+            s32 e = cands[q][bestC].edgeID;
+            // Decrement num candidates for other edges in this equation
+            for(s32 i=0; i<numCands[q]; ++i){
+                if(i == bestC) continue;
+                --(candsForEdge[cands[q][i].edgeID]);
+            }
+            // Move found edge to position 0 and truncate list
+            cands[q][0] = cands[q][bestC];
+            numCands[q] = 1;
+            // Remove this edge from other candidate lists
+            for(s32 j=0; j<4; ++j){
+                if(q == j) continue;
+                s32 i;
+                for(i=0; i<numCands[j]; ++i){
+                    if(cands[j][i].edgeID == e) break;
+                }
+                if(i == numCands[j]) continue;
+                for(; i<numCands[j] - 1; ++i){
+                    cands[j][i] = cands[j][i+1];
+                }
+                --(numCands[j]);
+                --(candsForEdge[e]);
+            }
+            if(candsForEdge[e] != 1){
+                //sprintf(occPlaneMessage, "Internal error 2");
+                return &sNoOcclusionPlane;
+            }
+            madeChange = true;
+            break;
+        }
+        if(!madeChange){
+            //sprintf(occPlaneMessage, "Internal error 1");
+            return &sNoOcclusionPlane;
+        }
+    }
+    
+    // Move equations to occlusion plane
+    OcclusionPlane* occ = Graph_Alloc(play->state.gfxCtx, sizeof(OcclusionPlane));
+    for(s32 q=0; q<4; ++q){
+        occ->c[q]   = (numCands[q] == 0) ? 0x0000 : cands[q][0].cScale;
+        occ->c[q+4] = (numCands[q] == 0) ? 0x7FFF : cands[q][0].cOffset;
+    }
+    occ->o.kx = kx;
+    occ->o.ky = ky;
+    occ->o.kz = kz;
+    occ->o.kc = kc;
+    return occ;
+}
+
 OcclusionPlane* ComputeOcclusionPlane(PlayState* play, Vec3f* worldBounds){
     //occPlaneMessage[0] = 0;
     
@@ -382,109 +501,620 @@ OcclusionPlane* ComputeOcclusionPlane(PlayState* play, Vec3f* worldBounds){
     //sprintf(occPlaneMessage, "%de %dv %d> %d^ %d<", totalEdges,
     //    numCands[0], numCands[1], numCands[2], numCands[3]);
     
-    // Assign candidates to equations.
-    while(true){
-        // Check fail condition: if now there is some edge which has no candidates
-        for(s32 e=0; e<totalEdges; ++e){
-            if(candsForEdge[e] == 0){
-                //sprintf(occPlaneMessage, "Edge %d now has no cands", e);
-                return &sNoOcclusionPlane;
-            }
+    return AssignEdgeEquations(play, cands, numCands, candsForEdge, totalEdges,
+        kx, ky, kz, kc);
+}
+
+/*
+Fixed-point version of ComputeOcclusionPlane, which does not use the FPU. The
+world-space bounds are integers, and the view * projection matrix must first be
+converted with OcclusionPlaneMtxFToFixed (once per frame, after the camera is
+updated; this is the only part which uses floats).
+
+The resulting coefficients match ComputeOcclusionPlane to within 1 LSB, and
+the two agree on whether the plane is enabled, as long as the quad is entirely
+in front of the camera and every edge of the clipped polygon spans at least 2
+pixels along the axis of the equation it is fit to. Outside that, results are
+ill-conditioned and may differ by more:
+  - A short edge's slope: a fraction of a pixel of error in its endpoints
+    changes cScale by several LSBs. Both versions are off from the exact
+    result here, in different ways.
+  - A quad crossing the camera plane can produce a vertex clipped first at
+    W = 0 and then at a screen edge, so it has a tiny W. Clip coordinates have
+    a fixed 12 fractional bits, which is then a few hundredths of a pixel.
+  - Planes tiny on screen (a few world units, thousands of units away) differ
+    in most coefficients, and occasionally on whether the plane is degenerate.
+    Compared to a double precision reference, float is further off than fixed
+    point here.
+occlusionplane_fuzz.c checks this on the host.
+
+This is not a faster drop-in replacement, and its speed has not been measured.
+The products, divisions and the square root use 64-bit integers, which with a
+32-bit ABI (as OoT and most N64 games are built) are library calls, and a
+single 64-bit divide takes far longer than the FPU's single precision divide.
+It may well be slower than ComputeOcclusionPlane on the VR4300. Its use is for
+code which can't use the FPU at that point, or which needs results that are
+the same on every platform. Otherwise, keep ComputeOcclusionPlane unless
+profiling both in your game shows this one is faster.
+*/
+
+// View * projection matrix in fixed point. The 3x3 part is s7.24 and the
+// translation column is s19.12, the same format as the clip space coordinates.
+// This covers clip space coordinates of +/- 512K, far more than any level needs.
+typedef struct {
+    s32 m[4][3]; // [row: clip x, y, z, w][column: world x, y, z]
+    s32 t[4];
+} OcclusionPlaneFixMtx;
+
+#define OCC_FIX_MTX_SHIFT 24
+#define OCC_FIX_CLIP_SHIFT 12
+// Extra fractional bits of screen space coordinates, beyond the viewport's
+// quarter pixels. The edge slopes need about as much precision as float.
+#define OCC_FIX_SCRN_SHIFT 16
+#define OCC_FIX_SCRN_MAX (1 << 30)
+
+typedef struct {
+    Vec3i clip;
+    s32 w;
+    s32 scrnX;
+    s32 scrnY;
+    u8 isScreenEdge;
+} ClipVertexFixed;
+
+static s32 FixToS32(float f, s32 shift){
+    f *= (float)(1 << shift);
+    f += (f < 0.0f) ? -0.5f : 0.5f;
+    f = CLAMP(f, -2147483520.0f, 2147483520.0f);
+    return (s32)f;
+}
+
+void OcclusionPlaneMtxFToFixed(MtxF* mf, OcclusionPlaneFixMtx* fix){
+    float rows[4][4] = {
+        {mf->xx, mf->xy, mf->xz, mf->xw},
+        {mf->yx, mf->yy, mf->yz, mf->yw},
+        {mf->zx, mf->zy, mf->zz, mf->zw},
+        {mf->wx, mf->wy, mf->wz, mf->ww},
+    };
+    for(s32 r=0; r<4; ++r){
+        for(s32 c=0; c<3; ++c){
+            fix->m[r][c] = FixToS32(rows[r][c], OCC_FIX_MTX_SHIFT);
         }
-        // Check done condition: all equations have 0 or 1 candidates
-        bool done = true;
-        for(s32 q=0; q<4; ++q){
-            if(numCands[q] >= 2){
-                done = false;
+        fix->t[r] = FixToS32(rows[r][3], OCC_FIX_CLIP_SHIFT);
+    }
+}
+
+static s32 FixDivClamp(s64 num, s64 den){
+    // Clamped so that far offscreen points can't overflow later math. Points
+    // which end up in the clipped polygon are always well within this.
+    s64 q = num / den;
+    return (s32)CLAMP(q, -OCC_FIX_SCRN_MAX, OCC_FIX_SCRN_MAX);
+}
+
+static s16 FixToS16Clamp(s64 x){
+    return (s16)CLAMP(x, -32768, 32767);
+}
+
+// Returns a + (b - a) * CLAMP(num / den, 0, 1), like the clip fade in ClipPolygon
+static s32 FixLerp(s32 a, s32 b, s64 num, s64 den){
+    if(den == 0) return b;
+    if(den < 0){
+        num = -num;
+        den = -den;
+    }
+    if(num <= 0) return a;
+    if(num >= den) return b;
+    s64 prod = ((s64)b - a) * num;
+    return a + (s32)((prod + ((prod < 0) ? -den : den) / 2) / den);
+}
+
+static u32 FixSqrt64(u64 x){
+    u64 res = 0;
+    u64 bit = 1ULL << 62;
+    while(bit > x) bit >>= 2;
+    while(bit != 0){
+        if(x >= res + bit){
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        }else{
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (u32)res;
+}
+
+void ClipToScreenSpaceFixed(PlayState* play, ClipVertexFixed* v){
+    if(v->w <= 0){
+        // Behind camera plane
+        v->scrnX = OCC_FIX_SCRN_MAX;
+        v->scrnY = OCC_FIX_SCRN_MAX;
+        return;
+    }
+    Vp* vp = &play->view.vp;
+    v->scrnX = FixDivClamp((s64)vp->vp.vscale[0] * v->clip.x * (1 << OCC_FIX_SCRN_SHIFT), v->w)
+        + vp->vp.vtrans[0] * (1 << OCC_FIX_SCRN_SHIFT);
+    v->scrnY = FixDivClamp((s64)vp->vp.vscale[1] * v->clip.y * (1 << OCC_FIX_SCRN_SHIFT), v->w)
+        + vp->vp.vtrans[1] * (1 << OCC_FIX_SCRN_SHIFT);
+}
+
+bool ClipPolygonFixed(PlayState* play, ClipVertexFixed* verts, s8* indices, s8** idxFinalStart, s8** idxFinalEnd){
+    // Same as ClipPolygon, see there
+    s8 igen = 4; // gen vertex pointer
+    s32 idxSelect = 0;
+    ClipVertexFixed* v3 = &verts[indices[3]];
+    s8* idxWrite;
+    for(s32 condition=4; condition>=0; --condition){
+        s8* idxRead = &indices[idxSelect];
+        idxSelect ^= 10;
+        idxWrite = &indices[idxSelect];
+        while(true){
+            s8 i2 = *idxRead;
+            if(i2 < 0) break;
+            ClipVertexFixed* v2 = &verts[i2];
+            ++idxRead;
+            bool v2Offscreen, v3Offscreen;
+            switch(condition){
+            case 4: // -W
+                v2Offscreen = v2->w <= 0;
+                v3Offscreen = v3->w <= 0;
+                break;
+            case 3: // +X
+                v2Offscreen = v2->clip.x >= v2->w;
+                v3Offscreen = v3->clip.x >= v3->w;
+                break;
+            case 2: // -X
+                v2Offscreen = v2->clip.x <= -v2->w;
+                v3Offscreen = v3->clip.x <= -v3->w;
+                break;
+            case 1: // +Y
+                v2Offscreen = v2->clip.y >= v2->w;
+                v3Offscreen = v3->clip.y >= v3->w;
+                break;
+            case 0: // -Y
+                v2Offscreen = v2->clip.y <= -v2->w;
+                v3Offscreen = v3->clip.y <= -v3->w;
                 break;
             }
-        }
-        if(done) break;
-        // Check for an equation which has more than one candidate edge, but
-        // one of those edges only has one candidate, so that edge has to be
-        // assigned to that equation.
-        bool madeChange = false;
-        for(s32 q=0; q<4 && !madeChange; ++q){
-            if(numCands[q] <= 1) continue;
-            for(s32 c=0; c<numCands[q]; ++c){
-                if(candsForEdge[cands[q][c].edgeID] == 1){
-                    madeChange = true;
-                    // Decrement num candidates for other edges in this equation
-                    for(s32 i=0; i<numCands[q]; ++i){
-                        if(i == c) continue;
-                        --(candsForEdge[cands[q][i].edgeID]);
-                    }
-                    // Move found edge to position 0 and truncate list
-                    cands[q][0] = cands[q][c];
-                    numCands[q] = 1;
-                    break;
+            if(v2Offscreen != v3Offscreen){
+                // Clip this edge
+                ClipVertexFixed* v19 = v2;
+                if(v2Offscreen){
+                    v19 = v3;
+                    v3 = v2;
+                }
+                // v19 is on screen, v3 is off screen
+                s64 clOnScreen, clOffScreen;
+                if(condition == 4){
+                    clOnScreen = 0;
+                    clOffScreen = 0;
+                }else if(condition <= 1){
+                    clOnScreen = v19->clip.y;
+                    clOffScreen = v3->clip.y;
+                }else{
+                    clOnScreen = v19->clip.x;
+                    clOffScreen = v3->clip.x;
+                }
+                if(condition & 1){
+                    clOnScreen -= v19->w;
+                    clOffScreen -= v3->w;
+                }else{
+                    clOnScreen += v19->w;
+                    clOffScreen += v3->w;
+                }
+                s64 clBase = clOnScreen;
+                s64 clDiff = clOnScreen - clOffScreen;
+                if(igen >= 14){
+                    // Too many generated vertices
+                    return false;
                 }
+                if(idxWrite - &indices[idxSelect] >= 9){
+                    // Polygon has too many vertices
+                    return false;
+                }
+                verts[igen].clip.x = FixLerp(v19->clip.x, v3->clip.x, clBase, clDiff);
+                verts[igen].clip.y = FixLerp(v19->clip.y, v3->clip.y, clBase, clDiff);
+                verts[igen].w = FixLerp(v19->w, v3->w, clBase, clDiff);
+                // Put the new vertex exactly on the screen edge, rather than
+                // wherever the rounding of the lerps left it.
+                if(condition == 3){
+                    verts[igen].clip.x = verts[igen].w;
+                }else if(condition == 2){
+                    verts[igen].clip.x = -verts[igen].w;
+                }else if(condition == 1){
+                    verts[igen].clip.y = verts[igen].w;
+                }else if(condition == 0){
+                    verts[igen].clip.y = -verts[igen].w;
+                }
+                verts[igen].isScreenEdge = v2Offscreen || v3->isScreenEdge;
+                ClipToScreenSpaceFixed(play, &verts[igen]);
+                *idxWrite = igen;
+                ++idxWrite;
+                ++igen;
             }
-        }
-        if(madeChange) continue; // Restart loop
-        // Take the first equation which has more than one candidate edge, and
-        // assign the edge with smallest abs(cScale)
-        for(s32 q=0; q<4; ++q){
-            if(numCands[q] <= 1) continue;
-            s32 bestC = 0;
-            s32 bestScale = ABS((s32)cands[q][0].cScale);
-            for(s32 c=1; c<numCands[q]; ++c){
-                s32 scale = ABS((s32)cands[q][c].cScale);
-                if(scale < bestScale){
-                    bestScale = scale;
-                    bestC = c;
+            if(!v2Offscreen){
+                if(idxWrite - &indices[idxSelect] >= 9){
+                    // Polygon has too many vertices
+                    return false;
                 }
+                *idxWrite = i2;
+                ++idxWrite;
             }
-            // Assigning equation q to edge e (edge currently as candidate bestC)
-            s32 e = cands[q][bestC].edgeID;
-            // Decrement num candidates for other edges in this equation
-            for(s32 i=0; i<numCands[q]; ++i){
-                if(i == bestC) continue;
-                --(candsForEdge[cands[q][i].edgeID]);
+            v3 = v2;
+        }
+        *idxWrite = -1;
+        if(idxWrite - &indices[idxSelect] < 3){
+            // Less than 3 verts in written polygon
+            return false;
+        }
+        v3 = &verts[*(idxWrite-1)];
+    }
+    *idxFinalStart = &indices[idxSelect];
+    *idxFinalEnd = idxWrite;
+    return true;
+}
+
+OcclusionPlane* ComputeOcclusionPlaneFixed(PlayState* play, const OcclusionPlaneFixMtx* mtx, Vec3s* worldBounds){
+    ClipVertexFixed verts[14];
+    s8 indices[20];
+    for(s32 i=0; i<4; ++i){
+        s32 out[4];
+        for(s32 r=0; r<4; ++r){
+            s64 acc = (s64)mtx->m[r][0] * worldBounds[i].x
+                    + (s64)mtx->m[r][1] * worldBounds[i].y
+                    + (s64)mtx->m[r][2] * worldBounds[i].z;
+            out[r] = (s32)(acc >> (OCC_FIX_MTX_SHIFT - OCC_FIX_CLIP_SHIFT)) + mtx->t[r];
+        }
+        verts[i].clip.x = out[0];
+        verts[i].clip.y = out[1];
+        verts[i].clip.z = out[2];
+        verts[i].w = out[3];
+        ClipToScreenSpaceFixed(play, &verts[i]);
+        verts[i].isScreenEdge = 0;
+        indices[i] = i;
+    }
+    indices[4] = -1;
+    
+    // Clip space plane, same as Math3D_DefPlane(v0, v2, v1)
+    s64 ax = verts[2].clip.x - verts[0].clip.x, bx = verts[1].clip.x - verts[0].clip.x;
+    s64 ay = verts[2].clip.y - verts[0].clip.y, by = verts[1].clip.y - verts[0].clip.y;
+    s64 az = verts[2].clip.z - verts[0].clip.z, bz = verts[1].clip.z - verts[0].clip.z;
+    s64 n[3] = {ay * bz - az * by, az * bx - ax * bz, ax * by - ay * bx};
+    // Scale the normal down so its squared length can't overflow
+    u64 maxN = 0;
+    for(s32 i=0; i<3; ++i){
+        u64 a = (n[i] < 0) ? -n[i] : n[i];
+        if(a > maxN) maxN = a;
+    }
+    s32 shift = 0;
+    while((maxN >> shift) >= (1ULL << 30)) ++shift;
+    for(s32 i=0; i<3; ++i) n[i] >>= shift;
+    u64 lenSq = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+    // Math3D_DefPlane gives a zero plane if the length is under 0.008. The clip
+    // coordinates have OCC_FIX_CLIP_SHIFT fractional bits, so n has 24 and lenSq
+    // has 48: 18014398509 is (0.008 * 2^24)^2.
+    if(shift == 0 && lenSq < 18014398509ULL){
+        return &sNoOcclusionPlane;
+    }
+    s64 len = FixSqrt64(lenSq);
+    s16 kx = FixToS16Clamp((n[0] * 32768) / len);
+    s16 ky = FixToS16Clamp((n[1] * 32768) / len);
+    s16 kz = FixToS16Clamp((n[2] * 32768) / len);
+    s64 dot = n[0] * verts[0].clip.x + n[1] * verts[0].clip.y + n[2] * verts[0].clip.z;
+    s16 kc = FixToS16Clamp(dot / (len << (OCC_FIX_CLIP_SHIFT + 1)));
+    if((kx | ky | kz) == 0){
+        // Degenerate plane, disable the clipping
+        return &sNoOcclusionPlane;
+    }
+    
+    s8 *idxFinalStart, *idxFinalEnd, *idx;
+    if(!ClipPolygonFixed(play, verts, indices, &idxFinalStart, &idxFinalEnd)){
+        return &sNoOcclusionPlane;
+    }
+    
+    EdgeCandidate cands[4][3];
+    u8 numCands[4];
+    numCands[0] = numCands[1] = numCands[2] = numCands[3] = 0;
+    u8 totalEdges = 0;
+    u8 candsForEdge[4];
+    
+    ClipVertexFixed* vtxA;
+    ClipVertexFixed* vtxB = &verts[*(idxFinalEnd-1)];
+    idx = idxFinalStart;
+    while(idx < idxFinalEnd){
+        vtxA = vtxB;
+        vtxB = &verts[*idx];
+        ++idx;
+        if(vtxA->isScreenEdge) continue;
+        if(totalEdges >= 4){
+            return &sNoOcclusionPlane;
+        }
+        
+        u8 numCandsFit = 0;
+        s32 dx = vtxB->scrnX - vtxA->scrnX;
+        s32 dy = vtxB->scrnY - vtxA->scrnY;
+        for(s32 q=0; q<4; ++q){
+            s32 du, dv, uA, vA; // Equation V <> U * cScale + cOffset
+            if((q & 1)){
+                dv = dx;
+                du = dy;
+                vA = vtxA->scrnX;
+                uA = vtxA->scrnY;
+            }else{
+                du = dx;
+                dv = dy;
+                uA = vtxA->scrnX;
+                vA = vtxA->scrnY;
             }
-            // Move found edge to position 0 and truncate list
-            cands[q][0] = cands[q][bestC];
-            numCands[q] = 1;
-            // Remove this edge from other candidate lists
-            for(s32 j=0; j<4; ++j){
-                if(q == j) continue;
-                s32 i;
-                for(i=0; i<numCands[j]; ++i){
-                    if(cands[j][i].edgeID == e) break;
-                }
-                if(i == numCands[j]) continue;
-                for(; i<numCands[j] - 1; ++i){
-                    cands[j][i] = cands[j][i+1];
-                }
-                --(numCands[j]);
-                --(candsForEdge[e]);
+            if((q == 0 || q == 3) != (du > 0)) continue;
+            if(ABS((s64)dv) >= 8 * ABS((s64)du)) continue;
+            // cScale is dv / du / 8 as s0.15; cOffset is (vA - uA * dv / du) / 2
+            // in quarter pixels, computed as one division to keep it exact.
+            s32 cScale = (s32)(((s64)dv * 4096) / du);
+            s64 num = (s64)vA * du - (s64)uA * dv;
+            s64 den = (s64)du * (2 << OCC_FIX_SCRN_SHIFT);
+            if(q >= 2){
+                cScale = -cScale;
+            }else{
+                num = -num;
             }
-            if(candsForEdge[e] != 1){
-                //sprintf(occPlaneMessage, "Internal error 2");
+            s64 cOffset = num / den;
+            if(ABS(cOffset) > 32767 || (ABS(cOffset) == 32767 && num % den != 0)) continue;
+            
+            if(numCands[q] >= 3){
                 return &sNoOcclusionPlane;
             }
-            madeChange = true;
-            break;
+            EdgeCandidate* cand = &cands[q][numCands[q]];
+            cand->cScale = (s16)cScale;
+            cand->cOffset = (s16)cOffset;
+            cand->edgeID = totalEdges;
+            ++numCandsFit;
+            ++(numCands[q]);
         }
-        if(!madeChange){
-            //sprintf(occPlaneMessage, "Internal error 1");
+        if(numCandsFit == 0 || numCandsFit > 3){
             return &sNoOcclusionPlane;
         }
+        candsForEdge[totalEdges] = numCandsFit;
+        
+        ++totalEdges;
     }
     
-    // Move equations to occlusion plane
-    OcclusionPlane* occ = Graph_Alloc(play->state.gfxCtx, sizeof(OcclusionPlane));
-    for(s32 q=0; q<4; ++q){
-        occ->c[q]   = (numCands[q] == 0) ? 0x0000 : cands[q][0].cScale;
-        occ->c[q+4] = (numCands[q] == 0) ? 0x7FFF : cands[q][0].cOffset;
+    return AssignEdgeEquations(play, cands, numCands, candsForEdge, totalEdges,
+        kx, ky, kz, kc);
+}
+
+// Number of candidates transformed at once; more are done in several batches.
+#define OCC_EVAL_MAX_CANDS 64
+
+// Candidate vertices transformed to clip space, structure-of-arrays so the
+// transform loops are simple and pipeline well. Vertex v of candidate c is at
+// index c * 4 + v.
+static float sOccEvalX[OCC_EVAL_MAX_CANDS * 4];
+static float sOccEvalY[OCC_EVAL_MAX_CANDS * 4];
+static float sOccEvalZ[OCC_EVAL_MAX_CANDS * 4];
+static float sOccEvalW[OCC_EVAL_MAX_CANDS * 4];
+static u8 sOccEvalFacing[OCC_EVAL_MAX_CANDS];
+
+static float PolygonArea2(ClipVertex* verts, s8* idxStart, s8* idxEnd){
+    // Twice the area of the screen-space polygon
+    float a = 0.0f;
+    Vec2f* prev = &verts[*(idxEnd-1)].scrn;
+    for(s8* idx = idxStart; idx < idxEnd; ++idx){
+        Vec2f* cur = &verts[*idx].scrn;
+        a += prev->x * cur->y - cur->x * prev->y;
+        prev = cur;
     }
-    occ->o.kx = kx;
-    occ->o.ky = ky;
-    occ->o.kz = kz;
-    occ->o.kc = kc;
-    return occ;
+    return fabsf(a);
+}
+
+// Evaluates up to OCC_EVAL_MAX_CANDS candidates, see below. bestScore is the
+// best score so far, and is updated if one of these is better.
+static s32 EvaluateOcclusionPlaneCandidateBatch(PlayState* play,
+        const OcclusionPlaneCandidate* cands, s32 numCands, float* scores,
+        float* bestScore){
+    MtxF* mf = &play->viewProjectionMtxF;
+    s32 n = numCands * 4;
+    Vec3f* eye = &play->view.eye;
+    const OcclusionPlaneCandidate* cand = cands;
+    for(s32 i=0; i<n; i+=4, ++cand){
+        for(s32 v=0; v<4; ++v){
+            sOccEvalX[i+v] = cand->v[v].x;
+            sOccEvalY[i+v] = cand->v[v].y;
+            sOccEvalZ[i+v] = cand->v[v].z;
+        }
+        // Camera must be on the front side of the plane. With the winding
+        // order described in someDrawFunction, (v3 - v0) x (v1 - v0) points
+        // towards the front.
+        float ax = sOccEvalX[i+3] - sOccEvalX[i], bx = sOccEvalX[i+1] - sOccEvalX[i];
+        float ay = sOccEvalY[i+3] - sOccEvalY[i], by = sOccEvalY[i+1] - sOccEvalY[i];
+        float az = sOccEvalZ[i+3] - sOccEvalZ[i], bz = sOccEvalZ[i+1] - sOccEvalZ[i];
+        float d = (ay * bz - az * by) * (eye->x - sOccEvalX[i])
+                + (az * bx - ax * bz) * (eye->y - sOccEvalY[i])
+                + (ax * by - ay * bx) * (eye->z - sOccEvalZ[i]);
+        sOccEvalFacing[i >> 2] = d > 0.0f;
+    }
+    // Transform one output component at a time, so W (needed for every
+    // early-out) is done first and stays in sOccEvalW.
+    for(s32 i=0; i<n; ++i){
+        sOccEvalW[i] = mf->wx * sOccEvalX[i] + mf->wy * sOccEvalY[i]
+            + mf->wz * sOccEvalZ[i] + mf->ww;
+    }
+    for(s32 i=0; i<n; ++i){
+        float x = sOccEvalX[i], y = sOccEvalY[i], z = sOccEvalZ[i];
+        sOccEvalX[i] = mf->xx * x + mf->xy * y + mf->xz * z + mf->xw;
+        sOccEvalY[i] = mf->yx * x + mf->yy * y + mf->yz * z + mf->yw;
+        sOccEvalZ[i] = mf->zx * x + mf->zy * y + mf->zz * z + mf->zw;
+    }
+    
+    Vp* vp = &play->view.vp;
+    float scrMinX = (float)(vp->vp.vtrans[0] - ABS(vp->vp.vscale[0]));
+    float scrMaxX = (float)(vp->vp.vtrans[0] + ABS(vp->vp.vscale[0]));
+    float scrMinY = (float)(vp->vp.vtrans[1] - ABS(vp->vp.vscale[1]));
+    float scrMaxY = (float)(vp->vp.vtrans[1] + ABS(vp->vp.vscale[1]));
+    float screenArea2 = 2.0f * (scrMaxX - scrMinX) * (scrMaxY - scrMinY);
+    
+    s32 best = -1;
+    for(s32 c=0; c<numCands; ++c){
+        if(scores != NULL) scores[c] = 0.0f;
+        float weight = cands[c].weight;
+        if(weight <= 0.0f || !sOccEvalFacing[c]) continue;
+        s32 i = c * 4;
+        // Trivial reject: all four verts outside the same clip plane
+        u8 allOut = 0x1F;
+        u8 anyOut = 0;
+        for(s32 v=0; v<4; ++v){
+            float x = sOccEvalX[i+v], y = sOccEvalY[i+v], w = sOccEvalW[i+v];
+            u8 out = (w <= 0.0f) | ((x >= w) << 1) | ((x <= -w) << 2)
+                | ((y >= w) << 3) | ((y <= -w) << 4);
+            allOut &= out;
+            anyOut |= out;
+        }
+        if(allOut != 0) continue;
+        ClipVertex verts[14];
+        for(s32 v=0; v<4; ++v){
+            verts[v].clip.x = sOccEvalX[i+v];
+            verts[v].clip.y = sOccEvalY[i+v];
+            verts[v].clip.z = sOccEvalZ[i+v];
+            verts[v].w = sOccEvalW[i+v];
+            verts[v].isScreenEdge = 0;
+        }
+        // Upper bound on the score: the clamped bounding box if in front of
+        // the camera, else the whole screen.
+        float bound = screenArea2;
+        if(!(anyOut & 1)){
+            float minX = scrMaxX, maxX = scrMinX, minY = scrMaxY, maxY = scrMinY;
+            for(s32 v=0; v<4; ++v){
+                ClipToScreenSpace(play, &verts[v].clip, verts[v].w, &verts[v].scrn);
+                minX = MIN(minX, verts[v].scrn.x);
+                maxX = MAX(maxX, verts[v].scrn.x);
+                minY = MIN(minY, verts[v].scrn.y);
+                maxY = MAX(maxY, verts[v].scrn.y);
+            }
+            minX = MAX(minX, scrMinX);
+            maxX = MIN(maxX, scrMaxX);
+            minY = MAX(minY, scrMinY);
+            maxY = MIN(maxY, scrMaxY);
+            bound = 2.0f * (maxX - minX) * (maxY - minY);
+        }else{
+            for(s32 v=0; v<4; ++v){
+                ClipToScreenSpace(play, &verts[v].clip, verts[v].w, &verts[v].scrn);
+            }
+        }
+        if(bound * weight <= *bestScore) continue;
+        // Clipped screen area
+        s8 indices[20] = {0, 1, 2, 3, -1};
+        s8 *idxStart = indices, *idxEnd = &indices[4];
+        if(anyOut != 0 && !ClipPolygon(play, verts, indices, &idxStart, &idxEnd)){
+            continue;
+        }
+        float area2 = PolygonArea2(verts, idxStart, idxEnd);
+        float score = 0.5f * area2 * weight;
+        if(scores != NULL) scores[c] = score;
+        if(score > *bestScore){
+            *bestScore = score;
+            best = c;
+        }
+    }
+    return best;
+}
+
+/*
+Computes a score for each of the occlusion plane candidates: the screen area
+(in quarter-pixels squared) of the candidate after clipping to the screen,
+times its weight. Candidates which are offscreen, seen from behind or
+edge-on, or smaller than the best candidate so far, get a score of 0 (in the
+last case, an upper bound is checked before doing the clipping). scores may be
+NULL. Returns the index of the best candidate, or -1 if none has a nonzero
+score. Any number of candidates may be passed; they are transformed in batches
+of OCC_EVAL_MAX_CANDS.
+*/
+s32 EvaluateOcclusionPlaneCandidates(PlayState* play,
+        const OcclusionPlaneCandidate* cands, s32 numCands, float* scores){
+    s32 best = -1;
+    float bestScore = 0.0f;
+    for(s32 base=0; base<numCands; base+=OCC_EVAL_MAX_CANDS){
+        s32 b = EvaluateOcclusionPlaneCandidateBatch(play, &cands[base],
+            MIN(numCands - base, OCC_EVAL_MAX_CANDS),
+            (scores != NULL) ? &scores[base] : NULL, &bestScore);
+        if(b >= 0) best = base + b;
+    }
+    return best;
+}
+
+/*
+Picks the best candidate with EvaluateOcclusionPlaneCandidates and computes its
+occlusion plane, or returns the disabled occlusion plane if none are visible.
+*/
+OcclusionPlane* ComputeBestOcclusionPlane(PlayState* play,
+        const OcclusionPlaneCandidate* cands, s32 numCands){
+    s32 best = EvaluateOcclusionPlaneCandidates(play, cands, numCands, NULL);
+    if(best < 0){
+        return &sNoOcclusionPlane;
+    }
+    Vec3f worldBounds[4];
+    for(s32 v=0; v<4; ++v){
+        worldBounds[v].x = cands[best].v[v].x;
+        worldBounds[v].y = cands[best].v[v].y;
+        worldBounds[v].z = cands[best].v[v].z;
+    }
+    return ComputeOcclusionPlane(play, worldBounds);
+}
+
+/*
+Returns whether the candidate's quad hides worldPos from the camera, i.e. the
+camera is in front of the quad, worldPos is behind it, and the line of sight
+from the camera to worldPos passes through the quad.
+*/
+bool OcclusionPlaneCandidateHidesPoint(PlayState* play,
+        const OcclusionPlaneCandidate* cand, Vec3f* worldPos){
+    Vec3f* eye = &play->view.eye;
+    Vec3f v[4];
+    for(s32 i=0; i<4; ++i){
+        v[i].x = cand->v[i].x;
+        v[i].y = cand->v[i].y;
+        v[i].z = cand->v[i].z;
+    }
+    // Front normal, see EvaluateOcclusionPlaneCandidates
+    float ax = v[3].x - v[0].x, bx = v[1].x - v[0].x;
+    float ay = v[3].y - v[0].y, by = v[1].y - v[0].y;
+    float az = v[3].z - v[0].z, bz = v[1].z - v[0].z;
+    float nx = ay * bz - az * by, ny = az * bx - ax * bz, nz = ax * by - ay * bx;
+    float dEye = nx * (eye->x - v[0].x) + ny * (eye->y - v[0].y) + nz * (eye->z - v[0].z);
+    float dPos = nx * (worldPos->x - v[0].x) + ny * (worldPos->y - v[0].y) + nz * (worldPos->z - v[0].z);
+    if(dEye <= 0.0f || dPos >= 0.0f) return false;
+    // Line of sight must be on the same side of all four planes through the
+    // eye and each edge.
+    float px = worldPos->x - eye->x, py = worldPos->y - eye->y, pz = worldPos->z - eye->z;
+    s32 numPos = 0;
+    for(s32 i=0; i<4; ++i){
+        Vec3f* va = &v[i];
+        Vec3f* vb = &v[(i + 1) & 3];
+        float ux = va->x - eye->x, uy = va->y - eye->y, uz = va->z - eye->z;
+        float wx = vb->x - eye->x, wy = vb->y - eye->y, wz = vb->z - eye->z;
+        float t = (uy * wz - uz * wy) * px + (uz * wx - ux * wz) * py + (ux * wy - uy * wx) * pz;
+        if(t > 0.0f) ++numPos;
+        else if(t == 0.0f) return false;
+    }
+    return numPos == 0 || numPos == 4;
+}
+
+/*
+For drawing with several occlusion planes in one frame. cands[i] is the
+candidate planes[i] was computed from, with the most important one (the one to
+use for objects not hidden by any of them) first. Returns the plane to send
+before drawing an object whose bounds are centered at objCenter.
+*/
+OcclusionPlane* SelectObjectOcclusionPlane(PlayState* play,
+        const OcclusionPlaneCandidate** cands, OcclusionPlane** planes, s32 num,
+        Vec3f* objCenter){
+    for(s32 i=0; i<num; ++i){
+        if(OcclusionPlaneCandidateHidesPoint(play, cands[i], objCenter)){
+            return planes[i];
+        }
+    }
+    return planes[0];
 }
 
+#ifndef OCCLUSION_PLANE_NO_EXAMPLE
 void someDrawFunction(PlayState* play) {
     ...
     
@@ -536,3 +1166,4 @@ void someDrawFunction(PlayState* play) {
     
     ...
 }
+#endif
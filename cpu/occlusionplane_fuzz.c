@@ -0,0 +1,273 @@
+/*
+Host test comparing ComputeOcclusionPlaneFixed with ComputeOcclusionPlane in
+occlusionplane.c, over random cameras and occlusion planes. This builds on a PC,
+with minimal stand-ins for the OoT types and functions occlusionplane.c uses:
+
+gcc -O2 -o occlusionplane_fuzz cpu/occlusionplane_fuzz.c -lm
+./occlusionplane_fuzz [seed] [iterations]
+
+Each iteration picks a camera and a quad somewhere in front of it, facing it.
+Every eighth quad is made tiny and far away, so that the clip space plane is
+near the degenerate threshold of Math3D_DefPlane. The checks are:
+  - For all quads which are not tiny, the two versions must agree on whether
+    the occlusion plane is enabled.
+  - For quads which are entirely in front of the camera, and whose clipped
+    polygon has no edge which is a candidate for an equation while being
+    shorter than OCC_FUZZ_MIN_RUN along that equation's U axis, every
+    coefficient must match to within 1 LSB.
+Outside this range the results are ill-conditioned--a short edge's slope, or a
+vertex clipped first by the camera plane and then by a screen edge, which ends
+up with a tiny W--so the two versions can differ by more (see the comment above
+ComputeOcclusionPlaneFixed). Their statistics are only printed. Returns nonzero
+if either check fails.
+
+After changing the fixed-point math, run this with a few seeds.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int8_t s8;
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef int64_t s64;
+typedef uint64_t u64;
+
+typedef struct { float x, y; } Vec2f;
+typedef struct { float x, y, z; } Vec3f;
+typedef struct { s16 x, y, z; } Vec3s;
+typedef struct { s32 x, y, z; } Vec3i;
+// Same layout as OoT: [column][row]
+typedef struct { float xx, yx, zx, wx, xy, yy, zy, wy, xz, yz, zz, wz, xw, yw, zw, ww; } MtxF;
+typedef struct { struct { s16 vscale[4], vtrans[4]; } vp; } Vp;
+typedef struct { Vp vp; Vec3f eye; } View;
+typedef struct { void* gfxCtx; } GameState;
+typedef struct { GameState state; View view; MtxF viewProjectionMtxF; } PlayState;
+// Same as in gbi.h
+typedef struct { struct { s16 x, y, z; } v[4]; float weight; } OcclusionPlaneCandidate;
+typedef union {
+    struct { s16 c0, c1, c2, c3, c4, c5, c6, c7, kx, ky, kz, kc; } o;
+    s16 c[12];
+} OcclusionPlane;
+
+#define CLAMP(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+#define ABS(x) ((x) < 0 ? -(x) : (x))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static OcclusionPlane sAllocBuf[2];
+static s32 sAllocIdx;
+
+static void* Graph_Alloc(void* gfxCtx, size_t size){
+    (void)gfxCtx;
+    (void)size;
+    return &sAllocBuf[sAllocIdx++ & 1];
+}
+
+static void SkinMatrix_Vec3fMtxFMultXYZW(MtxF* mf, Vec3f* src, Vec3f* xyzDest, float* wDest){
+    xyzDest->x = mf->xw + (mf->xx * src->x + mf->xy * src->y + mf->xz * src->z);
+    xyzDest->y = mf->yw + (mf->yx * src->x + mf->yy * src->y + mf->yz * src->z);
+    xyzDest->z = mf->zw + (mf->zx * src->x + mf->zy * src->y + mf->zz * src->z);
+    *wDest = mf->ww + (mf->wx * src->x + mf->wy * src->y + mf->wz * src->z);
+}
+
+static void Math3D_DefPlane(Vec3f* va, Vec3f* vb, Vec3f* vc, float* nx, float* ny, float* nz, float* originDist){
+    *nx = va->y * (vb->z - vc->z) + vb->y * (vc->z - va->z) + vc->y * (va->z - vb->z);
+    *ny = va->z * (vb->x - vc->x) + vb->z * (vc->x - va->x) + vc->z * (va->x - vb->x);
+    *nz = va->x * (vb->y - vc->y) + vb->x * (vc->y - va->y) + vc->x * (va->y - vb->y);
+    float normMagnitude = sqrtf(*nx * *nx + *ny * *ny + *nz * *nz);
+    if(!(fabsf(normMagnitude) < 0.008f)){ // !IS_ZERO
+        float normMagInv = 1.0f / normMagnitude;
+        *nx *= normMagInv;
+        *ny *= normMagInv;
+        *nz *= normMagInv;
+        *originDist = -(*nx * va->x + *ny * va->y + *nz * va->z);
+    }else{
+        *originDist = 0.0f;
+        *nx = *ny = *nz = 0.0f;
+    }
+}
+
+#define OCCLUSION_PLANE_NO_EXAMPLE
+#include "occlusionplane.c"
+
+static float Rand(float lo, float hi){
+    return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
+
+static void SetupCamera(PlayState* play){
+    play->view.vp.vp.vscale[0] = play->view.vp.vp.vtrans[0] = 640;
+    play->view.vp.vp.vscale[1] = play->view.vp.vp.vtrans[1] = 480;
+    Vec3f* eye = &play->view.eye;
+    eye->x = Rand(-3000.0f, 3000.0f);
+    eye->y = Rand(-500.0f, 1500.0f);
+    eye->z = Rand(-3000.0f, 3000.0f);
+    float yaw = Rand(0.0f, 6.2832f), pitch = Rand(-1.0f, 1.0f);
+    float fx = cosf(pitch) * sinf(yaw), fy = sinf(pitch), fz = cosf(pitch) * cosf(yaw);
+    float rl = sqrtf(fx * fx + fz * fz);
+    float rx = fz / rl, rz = -fx / rl;
+    float ux = -rz * fy, uy = rz * fx - rx * fz, uz = rx * fy;
+    float f = 1.0f / tanf(Rand(0.6f, 1.4f) * 0.5f), aspect = 4.0f / 3.0f;
+    float near = Rand(5.0f, 50.0f), far = Rand(3000.0f, 12800.0f);
+    float view[4][4] = {
+        {rx, 0.0f, rz, -(rx * eye->x + rz * eye->z)},
+        {ux, uy, uz, -(ux * eye->x + uy * eye->y + uz * eye->z)},
+        {-fx, -fy, -fz, fx * eye->x + fy * eye->y + fz * eye->z},
+        {0.0f, 0.0f, 0.0f, 1.0f},
+    };
+    float proj[4][4] = {
+        {f / aspect, 0.0f, 0.0f, 0.0f},
+        {0.0f, f, 0.0f, 0.0f},
+        {0.0f, 0.0f, (near + far) / (near - far), 2.0f * near * far / (near - far)},
+        {0.0f, 0.0f, -1.0f, 0.0f},
+    };
+    float m[4][4];
+    for(s32 r=0; r<4; ++r){
+        for(s32 c=0; c<4; ++c){
+            m[r][c] = 0.0f;
+            for(s32 k=0; k<4; ++k) m[r][c] += proj[r][k] * view[k][c];
+        }
+    }
+    MtxF* mf = &play->viewProjectionMtxF;
+    mf->xx = m[0][0]; mf->xy = m[0][1]; mf->xz = m[0][2]; mf->xw = m[0][3];
+    mf->yx = m[1][0]; mf->yy = m[1][1]; mf->yz = m[1][2]; mf->yw = m[1][3];
+    mf->zx = m[2][0]; mf->zy = m[2][1]; mf->zz = m[2][2]; mf->zw = m[2][3];
+    mf->wx = m[3][0]; mf->wy = m[3][1]; mf->wz = m[3][2]; mf->ww = m[3][3];
+}
+
+// Quad facing the camera, in the winding order described in someDrawFunction
+static void MakeQuad(PlayState* play, bool tiny, Vec3s* bounds){
+    Vec3f* eye = &play->view.eye;
+    MtxF* mf = &play->viewProjectionMtxF;
+    // Forward direction is -(row 3 of the view), which is the projection's w row
+    float fx = mf->wx, fy = mf->wy, fz = mf->wz;
+    float d = tiny ? Rand(2000.0f, 12000.0f) : Rand(20.0f, 4000.0f);
+    float cx = eye->x + fx * d + Rand(-d, d) * 0.5f;
+    float cy = eye->y + fy * d + Rand(-d, d) * 0.5f;
+    float cz = eye->z + fz * d + Rand(-d, d) * 0.5f;
+    float a1 = Rand(0.0f, 6.2832f), a2 = Rand(-1.5f, 1.5f);
+    float nx = cosf(a2) * sinf(a1), ny = sinf(a2), nz = cosf(a2) * cosf(a1);
+    if(nx * (eye->x - cx) + ny * (eye->y - cy) + nz * (eye->z - cz) < 0.0f){
+        nx = -nx; ny = -ny; nz = -nz;
+    }
+    float tl = sqrtf(nx * nx + nz * nz);
+    float tx = (tl < 1e-3f) ? 1.0f : -nz / tl, tz = (tl < 1e-3f) ? 0.0f : nx / tl;
+    float bx = ny * tz, by = nz * tx - nx * tz, bz = -ny * tx;
+    if((-tz * by) * nx + (tz * bx - tx * bz) * ny + (tx * by) * nz < 0.0f){
+        tx = -tx; tz = -tz;
+    }
+    float w = tiny ? Rand(0.0f, 3.0f) : Rand(50.0f, 2000.0f);
+    float h = tiny ? Rand(0.0f, 3.0f) : Rand(50.0f, 2000.0f);
+    static const float corners[4][2] = {{-1, -1}, {-1, 1}, {1, 1}, {1, -1}};
+    for(s32 k=0; k<4; ++k){
+        float x = cx + corners[k][0] * w * tx + corners[k][1] * h * bx;
+        float y = cy + corners[k][1] * h * by;
+        float z = cz + corners[k][0] * w * tz + corners[k][1] * h * bz;
+        bounds[k].x = (s16)lrintf(CLAMP(x, -32000.0f, 32000.0f));
+        bounds[k].y = (s16)lrintf(CLAMP(y, -32000.0f, 32000.0f));
+        bounds[k].z = (s16)lrintf(CLAMP(z, -32000.0f, 32000.0f));
+    }
+}
+
+// Shortest run, in screen units (quarter pixels), of any edge of the clipped
+// polygon along the U axis of an equation it is a candidate for. Returns -1 if
+// the quad is not entirely in front of the camera.
+#define OCC_FUZZ_MIN_RUN 8.0f
+static float MinCandidateRun(PlayState* play, Vec3f* worldBounds){
+    ClipVertex verts[14];
+    s8 indices[20];
+    for(s32 i=0; i<4; ++i){
+        SkinMatrix_Vec3fMtxFMultXYZW(&play->viewProjectionMtxF,
+            &worldBounds[i], &verts[i].clip, &verts[i].w);
+        if(verts[i].w <= 0.0f) return -1.0f;
+        ClipToScreenSpace(play, &verts[i].clip, verts[i].w, &verts[i].scrn);
+        verts[i].isScreenEdge = 0;
+        indices[i] = i;
+    }
+    indices[4] = -1;
+    s8 *idxFinalStart, *idxFinalEnd;
+    float minRun = 1e9f;
+    if(!ClipPolygon(play, verts, indices, &idxFinalStart, &idxFinalEnd)) return minRun;
+    ClipVertex* vtxA;
+    ClipVertex* vtxB = &verts[*(idxFinalEnd-1)];
+    for(s8* idx=idxFinalStart; idx<idxFinalEnd; ++idx){
+        vtxA = vtxB;
+        vtxB = &verts[*idx];
+        if(vtxA->isScreenEdge) continue;
+        float dx = fabsf(vtxB->scrn.x - vtxA->scrn.x);
+        float dy = fabsf(vtxB->scrn.y - vtxA->scrn.y);
+        if(dy < 8.0f * dx) minRun = MIN(minRun, dx);
+        if(dx < 8.0f * dy) minRun = MIN(minRun, dy);
+    }
+    return minRun;
+}
+
+int main(int argc, char** argv){
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    s32 iterations = argc > 2 ? atoi(argv[2]) : 200000;
+    static const char* const kClassNames[3] = {"Covered", "Ill-conditioned", "Tiny"};
+    s32 bothOff = 0, onOffMismatch[3] = {0};
+    s32 exact[3] = {0}, oneLsb[3] = {0}, worse[3] = {0}; // [covered, ill-conditioned, tiny]
+    for(s32 it=0; it<iterations; ++it){
+        PlayState play = {0};
+        SetupCamera(&play);
+        bool tiny = (it % 8) == 0;
+        Vec3s boundsS[4];
+        Vec3f boundsF[4];
+        MakeQuad(&play, tiny, boundsS);
+        for(s32 k=0; k<4; ++k){
+            boundsF[k].x = boundsS[k].x;
+            boundsF[k].y = boundsS[k].y;
+            boundsF[k].z = boundsS[k].z;
+        }
+        s32 cls = tiny ? 2 : (MinCandidateRun(&play, boundsF) >= OCC_FUZZ_MIN_RUN) ? 0 : 1;
+        OcclusionPlaneFixMtx fix;
+        OcclusionPlaneMtxFToFixed(&play.viewProjectionMtxF, &fix);
+        OcclusionPlane* a = ComputeOcclusionPlane(&play, boundsF);
+        OcclusionPlane* b = ComputeOcclusionPlaneFixed(&play, &fix, boundsS);
+        bool offA = (a == &sNoOcclusionPlane), offB = (b == &sNoOcclusionPlane);
+        if(offA && offB){
+            ++bothOff;
+            continue;
+        }
+        if(offA != offB){
+            if(++onOffMismatch[cls] <= 5 && cls != 2){
+                printf("Iteration %d (%s): float is %s, fixed is %s\n", it, kClassNames[cls],
+                    offA ? "off" : "on", offB ? "off" : "on");
+            }
+            continue;
+        }
+        s32 maxDiff = 0;
+        for(s32 k=0; k<12; ++k){
+            s32 diff = ABS(a->c[k] - b->c[k]);
+            maxDiff = MAX(maxDiff, diff);
+        }
+        if(maxDiff == 0){
+            ++exact[cls];
+        }else if(maxDiff == 1){
+            ++oneLsb[cls];
+        }else{
+            if(++worse[cls] <= 5 && cls == 0){
+                printf("Iteration %d: coefficients differ by %d\n", it, maxDiff);
+            }
+        }
+    }
+    printf("%d iterations: both off %d\n", iterations, bothOff);
+    for(s32 c=0; c<3; ++c){
+        s32 on = exact[c] + oneLsb[c] + worse[c];
+        printf("%s quads: on/off mismatch %d, both on %d: exact %d, 1 LSB %d, worse %d (%.3f%%)\n",
+            kClassNames[c], onOffMismatch[c], on, exact[c], oneLsb[c], worse[c],
+            on == 0 ? 0.0 : 100.0 * worse[c] / on);
+    }
+    // Tiny quads may disagree on whether the plane is degenerate, as the float
+    // and fixed-point lengths round differently right at the threshold.
+    bool ok = onOffMismatch[0] == 0 && onOffMismatch[1] == 0 && worse[0] == 0;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
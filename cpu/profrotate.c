@@ -0,0 +1,136 @@
+/*
+Getting every F3DEX3 performance counter while the game is running, by rotating
+between the profiling microcode versions every frame.
+
+Each of the default, CFG_PROFILING_A, _B, and _C versions reports a different
+set of four counters (see docs/Code/Counters.md). One version which reports all
+of them does not fit, even on the NOC base with G_LIGHTTORDP and flat shading
+removed as in the profiling versions. Built that way with no counters at all, it
+has 188 bytes (47 instructions) of IMEM free, and the same 28 bytes of DMEM as
+every build (see "Free IMEM and DMEM" in docs/Documentation/Performance.md). The
+counting code, measured by building each version against that, is:
+- default: 8 instructions (vertex, tri and rect counts, FIFO stall time)
+- A: 21 instructions
+- B: 11 instructions (4 of them in the overlays)
+- C: 23 instructions
+That is 63 instructions; sharing the DL command count and the start of command
+timing between A and C saves at most 4. And that is with every counter in a
+register, but the union is 13 words (after packing and removing the duplicate
+vertex count, DL command count and FIFO stall time), and there are only 6
+scalar registers to hold them: perfCounterA-D and the unused $17 and $18. The
+other 7 words would be in DMEM, each increment of them needing a load and a
+store more, and the 28 free bytes of DMEM hold 7 words with nothing left for
+the larger yield footer. The rest of the optional features are in the overlays,
+which share one region sized by the largest, so removing them does not free
+this IMEM.
+
+Instead, run each version for one frame in turn, and keep the last results of
+each. Every counter is then at most four frames old, and the sets are from
+different frames. This is not the same as capturing them all in one frame:
+when the scene changes (an explosion, a camera cut, or just the camera moving),
+counters from different sets do not describe the same work, and metrics which
+combine them (see counters.c) are only approximate. For comparing exact totals,
+replay the same recorded input once per version instead.
+
+The profiling versions do not support G_LIGHTTORDP or flat shading, so if the
+game uses those, every fourth frame will look different. Use the _NOC or BrW
+variants of all four versions together if the game uses those; all four must
+be the same except for the profiling option.
+
+All four microcodes need to be linked into the game (or loaded from the cart
+into a common buffer as needed; each is only used for one frame at a time).
+*/
+
+typedef enum {
+    PROF_SET_DEFAULT,
+    PROF_SET_A,
+    PROF_SET_B,
+    PROF_SET_C,
+    PROF_SET_COUNT
+} ProfSet;
+
+typedef struct {
+    F3DEX3ProfilingDefault def;
+    F3DEX3ProfilingA a;
+    F3DEX3ProfilingB b;
+    F3DEX3ProfilingC c;
+    u32 frame[PROF_SET_COUNT]; // Frame each set was captured in
+    u32 captured;              // Bit per set which has been captured
+} F3DEX3ProfilingAll;
+
+typedef struct {
+    u64* text;
+    u64* data;
+} ProfUcode;
+
+static const ProfUcode sProfUcodes[PROF_SET_COUNT] = {
+    { gspF3DEX3_BrZTextStart,    gspF3DEX3_BrZDataStart    },
+    { gspF3DEX3_BrZ_PATextStart, gspF3DEX3_BrZ_PADataStart },
+    { gspF3DEX3_BrZ_PBTextStart, gspF3DEX3_BrZ_PBDataStart },
+    { gspF3DEX3_BrZ_PCTextStart, gspF3DEX3_BrZ_PCDataStart },
+};
+
+static ProfSet sProfRunningSet;
+static u32 sProfRunningFrame;
+
+/*
+Call when setting up the graphics task for frame (any counter which goes up by
+one every frame), in place of setting ucode and ucode_data. The RDP clock still
+has to be cleared just before the task starts, as in Counters.md.
+*/
+void ProfRotateSetupTask(OSTask_t* task, u32 frame){
+    ProfSet set = frame % PROF_SET_COUNT;
+    task->ucode = sProfUcodes[set].text;
+    task->ucode_data = sProfUcodes[set].data;
+    sProfRunningSet = set;
+    sProfRunningFrame = frame;
+}
+
+/*
+Call when the graphics task is complete, with the footer read from the yield
+data as in Counters.md.
+*/
+void ProfRotateTaskDone(F3DEX3ProfilingAll* all, const F3DEX3YieldDataFooter* footer){
+    switch(sProfRunningSet){
+    case PROF_SET_DEFAULT: all->def = footer->def; break;
+    case PROF_SET_A: all->a = footer->a; break;
+    case PROF_SET_B: all->b = footer->b; break;
+    case PROF_SET_C: all->c = footer->c; break;
+    }
+    all->frame[sProfRunningSet] = sProfRunningFrame;
+    all->captured |= 1 << sProfRunningSet;
+}
+
+/*
+The set of the task which is running or just finished, e.g. for decoding the
+counters with counters.c.
+*/
+ProfSet ProfRotateRunningSet(void){
+    return sProfRunningSet;
+}
+
+/*
+True once every set has been captured at least once.
+*/
+bool ProfRotateComplete(const F3DEX3ProfilingAll* all){
+    return all->captured == (1 << PROF_SET_COUNT) - 1;
+}
+
+/* In graph.c, Graph_TaskSet00: */
+void someGraphTaskSetupFunction(GraphicsContext* gfxCtx) {
+    ...
+    task->type = M_GFXTASK;
+    task->flags = OS_SC_DRAM_DLIST;
+    task->ucode_boot = SysUcode_GetUCodeBoot();
+    task->ucode_boot_size = SysUcode_GetUCodeBootSize();
+#ifdef ENABLE_SPEEDMETER
+    ProfRotateSetupTask(task, gfxCtx->gfxPoolIdx);
+#else
+    task->ucode = SysUcode_GetUCode();
+    task->ucode_data = SysUcode_GetUCodeData();
+#endif
+    ...
+}
+
+/* In Sched_TaskComplete, in place of the bcopy in Counters.md: */
+    ProfRotateTaskDone(&gRSPProfilingAll, footer);
@@ -0,0 +1,71 @@
+/*
+Unpacking the 8 byte VtxPacked format (gbi.h) to Vtx on the CPU.
+
+F3DEX3 only loads the 16 byte Vtx (see "Packed vertex format" in Design
+Tradeoffs.md for why), so packed meshes are unpacked once, e.g. when the object
+is loaded, into a Vtx buffer which the display list then uses as usual. This
+halves the ROM and RAM space of the stored mesh, not the vertex DMA. vtxpack.py
+converts existing Vtx arrays and reports the error the quantization introduces.
+
+The positions are exact when the batch's range fits in 1024 model units
+(posShift 0), and the texture coords when its ST range fits in 256 / 32 = 8
+texels (stShift 0). Colors keep 5 bits per channel and 1 bit of alpha, and
+normals 5 or 6 bits per axis.
+*/
+
+static s32 VtxPackedSignExtend(u32 x, s32 bits){
+    return (s32)(x << (32 - bits)) >> (32 - bits);
+}
+
+static u8 VtxPackedExpand5(u32 c){
+    c &= 0x1F;
+    return (c << 3) | (c >> 2);
+}
+
+/*
+Unpacks every vertex of the batch into out[hdr->start] to
+out[hdr->start + hdr->count - 1].
+*/
+void VtxPackedUnpack(Vtx* out, const VtxPackedHeader* hdr, const VtxPacked* packed){
+    for(s32 i=hdr->start; i<hdr->start + hdr->count; ++i){
+        const VtxPacked_t* p = &packed[i].v;
+        Vtx_t* v = &out[i].v;
+        v->ob[0] = hdr->origin[0] + (s32)(((p->pos >> 22) & 0x3FF) << hdr->posShift);
+        v->ob[1] = hdr->origin[1] + (s32)(((p->pos >> 12) & 0x3FF) << hdr->posShift);
+        v->ob[2] = hdr->origin[2] + (s32)(((p->pos >>  2) & 0x3FF) << hdr->posShift);
+        v->flag = 0;
+        v->tc[0] = hdr->stOrigin[0] + (p->st[0] << hdr->stShift);
+        v->tc[1] = hdr->stOrigin[1] + (p->st[1] << hdr->stShift);
+        if(hdr->flags & VTXP_FLAG_NORMALS){
+            Vtx_tn* n = &out[i].n;
+            n->n[0] = VtxPackedSignExtend(p->cn >> 11, 5) << 3;
+            n->n[1] = VtxPackedSignExtend(p->cn >>  5, 6) << 2;
+            n->n[2] = VtxPackedSignExtend(p->cn,       5) << 3;
+            n->a = 0xFF;
+        }else{
+            v->cn[0] = VtxPackedExpand5(p->cn >> 11);
+            v->cn[1] = VtxPackedExpand5(p->cn >>  6);
+            v->cn[2] = VtxPackedExpand5(p->cn >>  1);
+            v->cn[3] = (p->cn & 1) ? 0xFF : 0;
+        }
+    }
+}
+
+/*
+Unpacks a whole mesh, e.g. the _hdr and _vtx arrays written by vtxpack.py.
+*/
+void VtxPackedUnpackAll(Vtx* out, const VtxPackedHeader* hdrs, s32 numBatches,
+        const VtxPacked* packed){
+    for(s32 b=0; b<numBatches; ++b){
+        VtxPackedUnpack(out, &hdrs[b], packed);
+    }
+}
+
+void someObjectInitFunction(Actor* thisx, PlayState* play) {
+    ...
+    // Once when the object is loaded; the display list uses segment 0x08 for
+    // its vertices.
+    this->vtx = ZeldaArena_Malloc(TREE_NUM_VTX * sizeof(Vtx));
+    VtxPackedUnpackAll(this->vtx, tree_vtx_hdr, ARRAY_COUNT(tree_vtx_hdr), tree_vtx_packed);
+    ...
+}
@@ -0,0 +1,460 @@
+#!python3
+
+"""
+Static display list analyzer for F3DEX3.
+
+Walks a display list tree in a memory image (e.g. an RDRAM dump from an
+emulator, or a segment file), starting from a root display list, following
+calls, branches, and returns, and resolving segmented addresses with the
+segments set by gsSPSegment (both the F3DEX2 style G_MW_SEGMENT and the F3DEX3
+style relative G_RELSEGMENT). For every display list reached, it totals the
+commands, vertices, tris, texture loads, matrix loads, and overlay loads, and
+estimates the RSP cycles from the tables in docs/Documentation/Performance.md.
+The report ranks the display lists by the cost of their whole subtree.
+
+This is a static estimate, so:
+- All tris are counted as drawn. Which tris are culled or clipped, and so which
+  clipping overlay loads happen, depends on the camera; use the performance
+  counters (see docs/Code/Counters.md) for those.
+- gsSPCullDisplayList never culls. gsSPBranchLessZ is followed unless
+  --branch-z not, as the branch is usually to the higher detail model.
+- The RDP time is not estimated, but the tris, other RDP commands, and bytes of
+  texture loaded are reported, which are what most of it depends on.
+
+Texture loads skipped by auto-batched rendering (see SPDontSkipTexLoadsAcross in
+gbi.h) are counted separately from the loads which are run. Of the loads which
+are run, the ones which load the same image to the same place in TMEM where it
+still is from an earlier load, with other materials in between, are counted as
+"already in TMEM". These would be skipped if the materials were drawn in a
+different order (see cpu/drawsort.c), or merged so the texture is only loaded
+once. The report lists the images with the most of these loads.
+
+To get the cost per object or material instead of per display list, put
+gsDPNoOpTag(tag) commands in the display lists (or gDPNoOpTag in the dynamic
+display lists, e.g. with the actor ID before drawing each actor). Everything
+after a tag, until the next tag, is attributed to it in a second report. Like
+everything else here, these are estimates from the tables, not measured cycles;
+the _NOC_PT microcodes measure the same thing on hardware (see
+gSPProfilingBuffer in gbi.h), so this is for when those can't be used, e.g. to
+see the occlusion plane, or without a frame to run. dlprofile.py gives the
+cycles of the same display lists on the simulated RSP. Except in _NOC_PT, the
+tags are sent to the RDP as no-ops and cost only a few cycles each.
+
+The image is loaded at physical address --base (0 for an RDRAM dump). The root
+and the --segment bases can be physical, KSEG0 (0x80xxxxxx), or segmented.
+
+Usage:
+python3 dlanalyze.py ram.bin 0x801A2B40 --segment 6=0x80250000
+python3 dlanalyze.py object.bin 0x06000A30 --base 0x100000 --segment 6=0x100000 --noc
+python3 dlanalyze.py ram.bin 0x801A2B40 --segment 6=0x80250000 --names actors.txt
+"""
+
+import argparse
+import struct
+import sys
+
+import costs
+import gbi
+
+G_SETCIMG   = 0xFF
+G_SETZIMG   = 0xFE
+G_SETTIMG   = 0xFD
+G_SETTILE   = 0xF5
+G_RDPHALF_2 = 0xF1
+G_LOADBLOCK = 0xF3
+G_LOADTILE  = 0xF4
+G_LOADTLUT  = 0xF0
+G_RELSEGMENT = 0x0B
+G_MEMSET    = 0xD5
+G_DMA_IO    = 0xD6
+G_LIGHTTORDP = 0x0A
+G_MWO_LAST_MAT_DL_ADDR = 0x16
+
+DL_STACK_SIZE = 18
+MAX_COMMANDS = 10000000
+
+OVL_LTBASIC = 2
+OVL_CLIPMISC = 3
+OVL_LTADV = 4
+
+
+class Stats:
+    FIELDS = ["cycles", "cmds", "vtx", "vtxLoads", "tris", "rdpCmds", "texLoads",
+        "texBytes", "texLoadsSkipped", "texLoadsResident", "mtx", "ovlLoads"]
+
+    def __init__(self):
+        for f in Stats.FIELDS:
+            setattr(self, f, 0)
+
+    def add(self, other):
+        for f in Stats.FIELDS:
+            setattr(self, f, getattr(self, f) + getattr(other, f))
+
+
+class DisplayListInfo:
+    def __init__(self, addr):
+        self.addr = addr
+        self.calls = 0
+        self.total = Stats()  # Including everything it calls / branches to
+        self.own = Stats()    # Only its own commands
+
+
+class Analyzer:
+    def __init__(self, image, base, segments, noc, followBranchZ):
+        self.image = image
+        self.base = base
+        self.segments = [0] * 16
+        for s, a in segments.items():
+            self.segments[s] = self.resolve(a)
+        self.col = 0 if noc else 1
+        self.followBranchZ = followBranchZ
+        self.dls = {}
+        self.geometryMode = 0
+        self.numLights = 0
+        self.pointLights = False
+        self.mvpValid = False
+        self.lightsXfrmValid = False
+        self.overlay = None
+        self.texImg = (0, 0)  # SETTIMG physical address and w0
+        self.tileTmem = [0] * 8
+        self.tmem = []  # Loaded regions as (start, end, load key)
+        self.lastMat = None
+        self.matCullMode = 0  # As materialCullMode in the microcode
+        self.residentLoads = {}  # Image address: loads already in TMEM
+        self.rdpHalf1 = 0
+        self.tag = None
+        self.tags = {}  # Tag: Stats of everything after it
+        self.warnings = []
+        self.onCommand = None  # Called with (addr, active, stack) for each command
+
+    def resolve(self, addr):
+        """Segmented to physical, like segmented_to_physical in the microcode."""
+        return ((addr & 0x00FFFFFF) + self.segments[(addr >> 24) & 0xF]) & 0x1FFFFFFF
+
+    def readCmd(self, addr):
+        ofs = addr - self.base
+        if ofs < 0 or ofs + 8 > len(self.image):
+            raise RuntimeError(f"Display list address {addr:08X} is outside the image")
+        return struct.unpack(">II", self.image[ofs:ofs + 8])
+
+    def useOverlay(self, s, ovl):
+        if self.overlay != ovl:
+            self.overlay = ovl
+            s.ovlLoads += 1
+            s.cycles += costs.OVERLAY_LOAD_CYCLES
+
+    def vertexCost(self, s, n):
+        gm = self.geometryMode
+        s.vtx += n
+        s.vtxLoads += 1
+        s.cycles += costs.LOAD_OVERHEAD_CYCLES
+        if not self.mvpValid:
+            s.cycles += costs.MVP_RECOMPUTE_CYCLES
+            self.mvpValid = True
+        if not (gm & gbi.G_LIGHTING):
+            s.cycles += (n + 1) // 2 * costs.pairCycles("none", 0, self.col == 0)
+            return
+        specFresnel = gm & (gbi.G_LIGHTING_SPECULAR | gbi.G_FRESNEL_COLOR | gbi.G_FRESNEL_ALPHA)
+        adv = self.pointLights or specFresnel != 0
+        self.useOverlay(s, OVL_LTADV if adv else OVL_LTBASIC)
+        if not self.lightsXfrmValid:
+            s.cycles += costs.LIGHT_XFRM_CYCLES[self.numLights]
+            self.lightsXfrmValid = True
+        perPair = costs.pairCycles("point" if self.pointLights else "dir",
+            self.numLights, self.col == 0)
+        a = 1 if adv else 0
+        for flag, extra in [(gbi.G_PACKED_NORMALS, costs.PACKED_NORMALS_CYCLES),
+                (gbi.G_LIGHTTOALPHA, costs.LIGHTTOALPHA_CYCLES), (gbi.G_AMBOCCLUSION, costs.AMBOCCLUSION_CYCLES)]:
+            if gm & flag:
+                perPair += extra[a]
+        if specFresnel:
+            perPair += costs.SPECULAR_OR_FRESNEL_CYCLES
+            if gm & (gbi.G_FRESNEL_COLOR | gbi.G_FRESNEL_ALPHA):
+                perPair += costs.FRESNEL_CYCLES
+            if gm & gbi.G_LIGHTING_SPECULAR:
+                perPair += costs.SPECULAR_PER_LIGHT_CYCLES * self.numLights
+        s.cycles += (n + 1) // 2 * perPair
+
+    def triCost(self, s, n):
+        s.tris += n
+        s.rdpCmds += n
+        for i in range(n):
+            s.cycles += (costs.TRI_FIRST_CYCLES if i % 2 == 0 else costs.TRI_SECOND_CYCLES)[self.col]
+
+    def snakeTris(self, addr, w0, w1):
+        """Returns (tris, address after the snake's data)."""
+        data = bytes([(w0 >> 8) & 0xFF, w0 & 0xFF]) + struct.pack(">I", w1)
+        tris = 0
+        # Index bytes after the first two; G_SNAKE_LAST is the top bit
+        for b in data[1:]:
+            tris += 1
+            if b & (gbi.G_SNAKE_LAST << 1):
+                return tris, addr + 8
+        addr += 8
+        while True:
+            for b in struct.pack(">II", *self.readCmd(addr)):
+                tris += 1
+                if b & (gbi.G_SNAKE_LAST << 1):
+                    return tris, addr + 8
+            addr += 8
+
+    def setImage(self, addr, cmd, w0, w1):
+        if cmd == G_SETTIMG:
+            self.texImg = (self.resolve(w1), w0)
+        if self.matCullMode != 0:
+            return
+        if addr == self.lastMat:
+            self.matCullMode = -1
+        else:
+            self.lastMat = addr
+            self.matCullMode = 1
+
+    def texLoad(self, s, cmd, w0, w1):
+        if self.matCullMode < 0:
+            s.texLoadsSkipped += 1
+            return
+        s.texLoads += 1
+        s.rdpCmds += 1
+        siz = (self.texImg[1] >> 19) & 3
+        if cmd == G_LOADBLOCK:
+            texels = ((w1 >> 12) & 0xFFF) + 1
+            size = (texels << siz) >> 1
+        elif cmd == G_LOADTILE:
+            width = (((w1 >> 12) & 0xFFF) - ((w0 >> 12) & 0xFFF)) // 4 + 1
+            height = ((w1 & 0xFFF) - (w0 & 0xFFF)) // 4 + 1
+            size = (width * height << siz) >> 1
+        else:
+            size = (((w1 >> 14) & 0x3FF) + 1) * 2
+        s.texBytes += size
+        # Same image, same load parameters, same place in TMEM, and nothing
+        # loaded over it since: the data in TMEM is already the same.
+        start = self.tileTmem[(w1 >> 24) & 7] * 8
+        region = (start, start + size, self.texImg, cmd, w0, w1 & 0x00FFFFFF)
+        if region in self.tmem:
+            s.texLoadsResident += 1
+            img = self.texImg[0]
+            self.residentLoads[img] = self.residentLoads.get(img, 0) + 1
+            return
+        self.tmem = [r for r in self.tmem if r[1] <= region[0] or r[0] >= region[1]]
+        self.tmem.append(region)
+
+    def run(self, root):
+        root = self.resolve(root)
+        # Each DL stack level: [return address, display lists active at this level]
+        stack = []
+        active = [root]
+        addr = root
+        self.enter(root)
+        executed = 0
+        while True:
+            executed += 1
+            if executed > MAX_COMMANDS:
+                raise RuntimeError("Too many commands, the display list may loop forever")
+            w0, w1 = self.readCmd(addr)
+            cmd = w0 >> 24
+            s = Stats()
+            s.cmds = 1
+            s.cycles = costs.DISPATCH_CYCLES
+            nextAddr = addr + 8
+            target = None
+            end = False
+            if cmd in [gbi.G_VTX, gbi.G_TRI1, gbi.G_TRI2, gbi.G_QUAD, gbi.G_TRISNAKE,
+                    gbi.G_DL, gbi.G_ENDDL, G_RDPHALF_2]:
+                self.matCullMode = 0  # Ends the material
+            if cmd == gbi.G_VTX:
+                self.vertexCost(s, (w0 >> 12) & 0xFF)
+            elif cmd in [gbi.G_TRI1, gbi.G_TRI2, gbi.G_QUAD]:
+                self.triCost(s, 1 if cmd == gbi.G_TRI1 else 2)
+            elif cmd == gbi.G_TRISNAKE:
+                tris, nextAddr = self.snakeTris(addr, w0, w1)
+                self.triCost(s, tris)
+                s.cycles += int(tris * costs.SNAKE_EXTRA_CYCLES)
+            elif cmd == gbi.G_CULLDL:
+                s.cycles += costs.CULLDL_CYCLES
+            elif cmd == gbi.G_BRANCH_Z:
+                if self.followBranchZ:
+                    target = (self.resolve(self.rdpHalf1), False)
+                    self.matCullMode = 0
+            elif cmd == gbi.G_DL:
+                target = (self.resolve(w1), ((w0 >> 16) & 0xFF) == gbi.G_DL_PUSH)
+            elif cmd == gbi.G_ENDDL:
+                end = True
+            elif cmd == gbi.G_LOAD_UCODE:
+                self.warnings.append(f"{addr:08X}: SPLoadUcode, stopped here")
+                end = True
+                stack = []
+            elif cmd == gbi.G_RDPHALF_1:
+                self.rdpHalf1 = w1
+            elif cmd == G_RELSEGMENT:
+                self.segments[((w0 & 0xFFF) >> 2) & 0xF] = self.resolve(w1)
+            elif cmd == gbi.G_MOVEWORD:
+                index = (w0 >> 16) & 0xFF
+                if index == gbi.G_MW_SEGMENT:
+                    self.segments[((w0 & 0xFFF) >> 2) & 0xF] = w1 & 0x1FFFFFFF
+                elif index == gbi.G_MW_NUMLIGHT:
+                    self.numLights = min((w1 >> 4) & 0xF, gbi.G_MAX_LIGHTS)
+                    self.pointLights = (w1 & (gbi.ENABLE_POINT_LIGHTS << 4)) != 0
+                    self.lightsXfrmValid = False
+                elif index == gbi.G_MW_FX and (w0 & 0xFFFF) == G_MWO_LAST_MAT_DL_ADDR:
+                    self.lastMat = w1
+                    # May be because the image at the same address changed
+                    self.tmem = []
+            elif cmd == gbi.G_MOVEMEM:
+                if (w0 & 0xFF) == gbi.G_MV_LIGHT:
+                    self.lightsXfrmValid = False
+                elif (w0 & 0xFF) in [gbi.G_MV_MMTX, gbi.G_MV_VPMTX]:
+                    self.mvpValid = False
+                    self.lightsXfrmValid = False
+            elif cmd == gbi.G_MTX:
+                s.mtx = 1
+                s.cycles += costs.MTX_CYCLES - costs.DISPATCH_CYCLES
+                # Model matrix push (the push bit is inverted in the command)
+                if (w0 & (gbi.G_MTX_VIEWPROJECTION | gbi.G_MTX_PUSH)) == 0:
+                    self.useOverlay(s, OVL_LTBASIC)
+                self.mvpValid = False
+                self.lightsXfrmValid = False
+            elif cmd in [gbi.G_POPMTX, G_DMA_IO]:
+                self.useOverlay(s, OVL_LTBASIC)
+                self.mvpValid = False
+                self.lightsXfrmValid = False
+            elif cmd == G_MEMSET:
+                self.useOverlay(s, OVL_CLIPMISC)
+            elif cmd == gbi.G_GEOMETRYMODE:
+                self.geometryMode = (self.geometryMode & (w0 | 0xFF000000)) | w1
+            elif cmd in [G_LOADBLOCK, G_LOADTILE, G_LOADTLUT]:
+                self.texLoad(s, cmd, w0, w1)
+                if s.texLoads > 0:
+                    s.cycles += costs.SMALL_RDP_CYCLES
+            elif cmd == gbi.G_NOOP:
+                s.cycles += costs.SMALL_RDP_CYCLES
+                s.rdpCmds += 1
+                if (w0 & 0x00FFFFFF) == 0:  # Not gDPNoOpHere etc.
+                    self.tag = w1
+            elif cmd == G_LIGHTTORDP or cmd >= gbi.G_SETOTHERMODE_L:
+                s.cycles += costs.SMALL_RDP_CYCLES
+                s.rdpCmds += 1
+                if cmd in [G_SETCIMG, G_SETZIMG, G_SETTIMG]:
+                    self.setImage(addr, cmd, w0, w1)
+                elif cmd == G_SETTILE:
+                    self.tileTmem[(w1 >> 24) & 7] = w0 & 0x1FF
+            self.attribute(s, active, stack)
+            if self.onCommand is not None:
+                self.onCommand(addr, active, stack)
+            if target is not None:
+                dl, push = target
+                if push:
+                    if len(stack) >= DL_STACK_SIZE:
+                        raise RuntimeError(f"{addr:08X}: display list stack overflow")
+                    stack.append((nextAddr, active))
+                    active = [dl]
+                elif dl not in active:
+                    active = active + [dl]
+                self.enter(dl)
+                addr = dl
+            elif end:
+                if len(stack) == 0:
+                    return
+                addr, active = stack.pop()
+            else:
+                addr = nextAddr
+
+    def enter(self, dl):
+        if dl not in self.dls:
+            self.dls[dl] = DisplayListInfo(dl)
+        self.dls[dl].calls += 1
+
+    def attribute(self, s, active, stack):
+        self.dls[active[-1]].own.add(s)
+        if self.tag is not None:
+            if self.tag not in self.tags:
+                self.tags[self.tag] = Stats()
+            self.tags[self.tag].add(s)
+        done = set()
+        for level in [a for _, a in stack] + [active]:
+            for dl in level:
+                if dl not in done:
+                    done.add(dl)
+                    self.dls[dl].total.add(s)
+
+
+def parseSegment(text):
+    seg, addr = text.split("=")
+    seg = int(seg, 0)
+    if not (0 < seg < 16):
+        raise RuntimeError(f"Bad segment {seg}")
+    return seg, int(addr, 0)
+
+
+def readNames(path):
+    names = {}
+    with open(path, "r") as f:
+        for l in f:
+            toks = l.split("#")[0].split()
+            if len(toks) == 2:
+                names[int(toks[1], 0) & 0x1FFFFFFF] = toks[0]
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Estimate the RSP cost of an F3DEX3 display list tree")
+    parser.add_argument("image", help="Memory image, e.g. RDRAM dump")
+    parser.add_argument("root", type=lambda x: int(x, 0), help="Root display list address")
+    parser.add_argument("--base", type=lambda x: int(x, 0), default=0,
+        help="Physical address of the start of the image (default 0)")
+    parser.add_argument("--segment", action="append", default=[], type=parseSegment,
+        help="Initial segment, as N=address (repeatable)")
+    parser.add_argument("--noc", action="store_true", help="Estimate for F3DEX3_NOC")
+    parser.add_argument("--branch-z", choices=["taken", "not"], default="taken",
+        help="Whether gsSPBranchLessZ branches (default taken)")
+    parser.add_argument("--names", help="Text file with name and address or tag per line, for the report")
+    parser.add_argument("--top", type=int, default=20, help="Number of display lists to list")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    an = Analyzer(image, args.base, dict(args.segment), args.noc, args.branch_z == "taken")
+    an.run(args.root)
+    names = readNames(args.names) if args.names is not None else {}
+
+    root = an.dls[an.resolve(args.root)]
+    t = root.total
+    print(f"Total: ~{t.cycles} RSP cycles ({t.cycles / 62500:.2f} ms), {t.cmds} commands, "
+        + f"{t.vtx} vertices in {t.vtxLoads} loads, {t.tris} tris, {t.rdpCmds} RDP commands, "
+        + f"{t.texLoads} texture loads ({t.texBytes} bytes), {t.mtx} matrices, "
+        + f"{t.ovlLoads} overlay loads")
+    print(f"Texture loads: {t.texLoadsSkipped} skipped by auto-batching, {t.texLoadsResident} "
+        + "of those run were already in TMEM")
+    print("")
+    print(f"| Display list         | Calls | Est. cyc | Own (est.) | Vtx   | Tris  | Tex bytes | Mtx  | Ovl  |")
+    print(f"|----------------------|-------|----------|------------|-------|-------|-----------|------|------|")
+    ranked = sorted(an.dls.values(), key=lambda d: (-d.total.cycles, d.addr))
+    for d in ranked[:args.top]:
+        name = names.get(d.addr, f"{d.addr:08X}")
+        t = d.total
+        print(f"| {name:<20} | {d.calls:>5} | {t.cycles:>8} | {d.own.cycles:>10} | {t.vtx:>5} "
+            + f"| {t.tris:>5} | {t.texBytes:>9} | {t.mtx:>4} | {t.ovlLoads:>4} |")
+    if len(an.tags) > 0:
+        print("")
+        print(f"| Tag                  | Est. cyc | Vtx   | Tris  | Tex loads | Tex bytes | Mtx  | Ovl  |")
+        print(f"|----------------------|----------|-------|-------|-----------|-----------|------|------|")
+        ranked = sorted(an.tags.items(), key=lambda i: (-i[1].cycles, i[0]))
+        for tag, t in ranked[:args.top]:
+            name = names.get(tag & 0x1FFFFFFF, f"{tag:08X}")
+            print(f"| {name:<20} | {t.cycles:>8} | {t.vtx:>5} | {t.tris:>5} | {t.texLoads:>9} "
+                + f"| {t.texBytes:>9} | {t.mtx:>4} | {t.ovlLoads:>4} |")
+    if len(an.residentLoads) > 0:
+        print("")
+        print(f"| Image already in TMEM | Loads |")
+        print(f"|-----------------------|-------|")
+        ranked = sorted(an.residentLoads.items(), key=lambda i: (-i[1], i[0]))
+        for img, loads in ranked[:args.top]:
+            name = names.get(img, f"{img:08X}")
+            print(f"| {name:<21} | {loads:>5} |")
+    for w in an.warnings:
+        print("Warning: " + w, file=sys.stderr)
+    print(f"{len(an.dls)} display lists. Static estimate: all tris counted as drawn, no clipping, "
+        + "SPCullDisplayList never culls", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,357 @@
+#!python3
+
+"""
+Display list hint annotator for F3DEX3.
+
+F3DEX3 fetches display list commands in chunks of up to 21 commands. At each
+call, branch, or return, the hint in the command tells the microcode how many
+commands will actually be used from the target before the next call, branch, or
+return, so it only fetches those. See gSPDisplayListHint in gbi.h.
+
+This tool rewrites the gsSPDisplayList, gsSPBranchList, and gsSPEndDisplayList
+commands in a C file to the Hint variants with the correct counts (or updates
+the counts of existing Hint commands), for every target display list which is
+defined in the same file:
+- A call or branch gets the number of commands from the start of the target up
+  to and including its first call, branch, or return.
+- A return gets the number of commands after the call site in the caller, up to
+  and including its next call, branch, or return. This is only known if the
+  display list is static, is only referenced by calls and branches in the same
+  file, and all the call sites agree; otherwise the return is left as is. A
+  display list which is not static may be drawn from game code, returning to a
+  dynamic display list, and a branch passes on the caller's return site, so
+  these make the return site unknown too.
+
+Macros can expand to several commands (e.g. gsDPLoadTextureBlock), so the
+commands are counted by running the C preprocessor on the file with gbi.h. Pass
+the include directories of your project with -I, the same as for the compiler.
+
+Usage:
+python3 dlhints.py object.c -I include -I src > object_hinted.c
+python3 dlhints.py object.c -I include --in-place
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+import gbi
+
+CALLS = {"gsSPDisplayList", "gsSPDisplayListHint"}
+BRANCHES = {"gsSPBranchList", "gsSPBranchListHint"}
+ENDS = {"gsSPEndDisplayList", "gsSPEndDisplayListHint"}
+
+GFX_ARRAY_RE = re.compile(r"\bGfx\s+(\w+)\s*\[[^\]]*\]\s*=\s*\{")
+PROBE_NAME = "dlhints_probe_"
+
+# Return sites which can't be determined from this file
+UNKNOWN = None
+
+
+class Element:
+    """One top-level element (macro) in a Gfx array initializer."""
+    def __init__(self, start, end, text):
+        self.start = start  # Offsets in the file
+        self.end = end
+        self.text = text    # With comments masked out
+        self.count = None   # Number of commands it expands to
+        self.kind = None    # "call", "branch", "end", or None
+        self.target = None  # Name of the target DL, for call and branch
+        self.hint = None    # New hint count, if known
+
+    def isControl(self):
+        return self.kind is not None
+
+
+class DisplayList:
+    def __init__(self, name):
+        self.name = name
+        self.elements = []
+        self.isStatic = False
+        self.otherRefs = False  # Referenced other than by a call or branch
+
+    def run(self, first):
+        """Commands from element first up to and including the next control."""
+        count = 0
+        for e in self.elements[first:]:
+            count += e.count
+            if e.isControl():
+                break
+        return count
+
+
+def maskComments(src):
+    """Replaces comments and string / char literal contents with spaces."""
+    out = list(src)
+    i = 0
+    n = len(src)
+    while i < n:
+        c = src[i]
+        if src.startswith("//", i):
+            while i < n and src[i] != "\n":
+                out[i] = " "
+                i += 1
+        elif src.startswith("/*", i):
+            j = src.find("*/", i + 2)
+            j = n if j < 0 else j + 2
+            for k in range(i, j):
+                if src[k] != "\n":
+                    out[k] = " "
+            i = j
+        elif c == '"' or c == "'":
+            i += 1
+            while i < n and src[i] != c:
+                if src[i] == "\\":
+                    out[i] = " "
+                    i += 1
+                if i < n:
+                    out[i] = " "
+                    i += 1
+            i += 1
+        else:
+            i += 1
+    return "".join(out)
+
+
+def matchClose(text, i):
+    """text[i] is an opening bracket; returns the index of its match."""
+    depth = 0
+    for j in range(i, len(text)):
+        if text[j] in "({[":
+            depth += 1
+        elif text[j] in ")}]":
+            depth -= 1
+            if depth == 0:
+                return j
+    raise RuntimeError(f"Unmatched {text[i]} at offset {i}")
+
+
+def splitTopLevel(text, start, end):
+    """Splits text[start:end] at commas not inside brackets, as (start, end)."""
+    ret = []
+    depth = 0
+    s = start
+    for j in range(start, end):
+        c = text[j]
+        if c in "({[":
+            depth += 1
+        elif c in ")}]":
+            depth -= 1
+        elif c == "," and depth == 0:
+            ret.append((s, j))
+            s = j + 1
+    ret.append((s, end))
+    return [(a, b) for a, b in ret if len(text[a:b].strip()) > 0]
+
+
+def parseDisplayLists(masked):
+    dls = {}
+    for m in GFX_ARRAY_RE.finditer(masked):
+        lb = m.end() - 1
+        close = matchClose(masked, lb)
+        dl = DisplayList(m.group(1))
+        declStart = max(masked.rfind(c, 0, m.start()) for c in ";{}") + 1
+        dl.isStatic = re.search(r"\bstatic\b", masked[declStart:m.start()]) is not None
+        for a, b in splitTopLevel(masked, lb + 1, close):
+            if masked[a:b].lstrip().startswith("#"):
+                raise RuntimeError(f"{dl.name}: preprocessor directives inside display lists are not supported")
+            dl.elements.append(Element(a, b, masked[a:b]))
+        dls[dl.name] = dl
+    return dls
+
+
+def macroCall(text):
+    """Returns (macro name, [args]) for an element like name(args), else None."""
+    m = re.match(r"\s*(\w+)\s*\(", text)
+    if m is None:
+        return None
+    lb = m.end() - 1
+    close = matchClose(text, lb)
+    args = [text[a:b].strip() for a, b in splitTopLevel(text, lb + 1, close)]
+    return m.group(1), args
+
+
+def targetName(arg, dls):
+    """The DL name if arg refers to the start of a DL in this file."""
+    m = re.fullmatch(r"\(?\s*&?\s*(\w+)\s*(\[\s*0\s*\])?\s*\)?", arg)
+    if m is None or m.group(1) not in dls:
+        return None
+    if m.group(2) is None and arg.lstrip("( ").startswith("&"):
+        return None  # &name is fine C, but is a pointer to the whole array
+    return m.group(1)
+
+
+def classify(dls):
+    for dl in dls.values():
+        for e in dl.elements:
+            call = macroCall(e.text)
+            if call is None:
+                continue
+            name, args = call
+            if name in CALLS or name in BRANCHES:
+                e.kind = "call" if name in CALLS else "branch"
+                e.target = targetName(args[0], dls) if len(args) > 0 else None
+            elif name in ENDS:
+                e.kind = "end"
+
+
+def findOtherRefs(masked, dls):
+    """Marks DLs whose name appears anywhere but their definition or a target."""
+    targets = {}
+    for dl in dls.values():
+        for e in dl.elements:
+            if e.target is not None:
+                targets.setdefault(e.target, []).append((e.start, e.end))
+    defs = {m.group(1): m.start(1) for m in GFX_ARRAY_RE.finditer(masked)}
+    for dl in dls.values():
+        for m in re.finditer(r"\b" + re.escape(dl.name) + r"\b", masked):
+            if m.start() == defs[dl.name]:
+                continue
+            if any(a <= m.start() < b for a, b in targets.get(dl.name, [])):
+                continue
+            dl.otherRefs = True
+            break
+
+
+def countCommands(src, path, cpp, includes):
+    """
+    Preprocesses src with a probe array appended for every element, and returns
+    the number of commands each element expands to, as a list in file order.
+    """
+    masked = maskComments(src)
+    dls = parseDisplayLists(masked)
+    probes = ""
+    k = 0
+    for dl in dls.values():
+        for e in dl.elements:
+            probes += f"\nGfx {PROBE_NAME}{k}[] = {{ {e.text} }};"
+            k += 1
+    includes = [os.path.dirname(os.path.abspath(path))] + includes
+    cmd = cpp.split() + ["-P"] + [f"-I{i}" for i in includes] + ["-"]
+    res = subprocess.run(cmd, input=src + "\n" + probes + "\n", capture_output=True, text=True)
+    if res.returncode != 0:
+        raise RuntimeError(f"Preprocessing {path} failed (pass include dirs with -I):\n{res.stderr}")
+    out = res.stdout
+    counts = [None] * k
+    for m in re.finditer(PROBE_NAME + r"(\d+)\s*\[\s*\]\s*=\s*\{", out):
+        lb = m.end() - 1
+        close = matchClose(out, lb)
+        counts[int(m.group(1))] = len(splitTopLevel(out, lb + 1, close))
+    if None in counts:
+        raise RuntimeError("Internal error: missing preprocessed probe")
+    return counts
+
+
+def returnSites(dls, name, visiting):
+    """
+    Set of (caller DL, element index) which name returns to, or UNKNOWN if it
+    may also return somewhere outside this file.
+    """
+    if not dls[name].isStatic or dls[name].otherRefs:
+        return UNKNOWN
+    if name in visiting:
+        return set()
+    visiting = visiting | {name}
+    ret = set()
+    referenced = False
+    for dl in dls.values():
+        for i, e in enumerate(dl.elements):
+            if e.target != name:
+                continue
+            referenced = True
+            if e.kind == "call":
+                ret.add((dl.name, i + 1))
+            else:
+                sites = returnSites(dls, dl.name, visiting)
+                if sites is UNKNOWN:
+                    return UNKNOWN
+                ret |= sites
+    if not referenced:
+        return UNKNOWN
+    return ret
+
+
+def computeHints(dls):
+    for dl in dls.values():
+        for e in dl.elements:
+            if e.kind in ["call", "branch"] and e.target is not None:
+                e.hint = dls[e.target].run(0)
+            elif e.kind == "end":
+                sites = returnSites(dls, dl.name, set())
+                if sites is UNKNOWN:
+                    continue
+                runs = set(dls[d].run(i) for d, i in sites)
+                if len(runs) == 1:
+                    e.hint = runs.pop()
+
+
+def hintBytes(count):
+    return 0 if count is None else gbi._DLHINTVALUE(count)
+
+
+def rewrite(src, dls):
+    """Returns (new source, sites hinted, bytes saved per execution of each)."""
+    edits = []
+    sites = 0
+    saved = 0
+    for dl in dls.values():
+        for e in dl.elements:
+            if e.hint is None:
+                continue
+            _, args = macroCall(e.text)
+            m = re.match(r"\s*(\w+)\s*\(", e.text)
+            callStart = e.start + m.start(1)
+            callEnd = e.start + matchClose(e.text, m.end() - 1) + 1
+            if e.kind == "end":
+                new = f"gsSPEndDisplayListHint({e.hint})"
+            else:
+                macro = "gsSPDisplayListHint" if e.kind == "call" else "gsSPBranchListHint"
+                new = f"{macro}({args[0]}, {e.hint})"
+            edits.append((callStart, callEnd, new))
+            sites += 1
+            saved += hintBytes(e.hint)
+    for a, b, new in sorted(edits, reverse=True):
+        src = src[:a] + new + src[b:]
+    return src, sites, saved
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Add F3DEX3 display list hints to a C file")
+    parser.add_argument("input", help="C file with Gfx arrays")
+    parser.add_argument("-I", dest="includes", action="append", default=[],
+        help="Include directory for gbi.h and its headers (repeatable)")
+    parser.add_argument("--cpp", default="cpp", help="C preprocessor command (default cpp)")
+    parser.add_argument("--in-place", action="store_true", help="Overwrite the input file")
+    args = parser.parse_args()
+
+    with open(args.input, "r") as f:
+        src = f.read()
+    counts = countCommands(src, args.input, args.cpp, args.includes)
+    masked = maskComments(src)
+    dls = parseDisplayLists(masked)
+    k = 0
+    for dl in dls.values():
+        for e in dl.elements:
+            e.count = counts[k]
+            k += 1
+    classify(dls)
+    findOtherRefs(masked, dls)
+    computeHints(dls)
+    out, sites, saved = rewrite(src, dls)
+    if args.in_place:
+        with open(args.input, "w") as f:
+            f.write(out)
+    else:
+        sys.stdout.write(out)
+
+    controls = sum(1 for dl in dls.values() for e in dl.elements if e.isControl())
+    print(f"{len(dls)} display lists, {controls} calls / branches / returns, {sites} hinted",
+        file=sys.stderr)
+    print(f"DL fetch saved vs. no hints: {saved} bytes ({saved // 8} commands) per pass "
+        + "through every hinted command", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,284 @@
+#!python3
+
+"""
+Display list profiler for F3DEX3.
+
+Runs a display list tree from a memory image (e.g. an RDRAM dump from an
+emulator, captured just before the graphics task starts) through the real
+microcode on the simulated RSP in rspsim.py, and attributes the cycles of every
+command to the display list it is in and to all the display lists which called
+or branched to that one. The report ranks the display lists by the cycles of
+their whole subtree, like dlanalyze.py, but with the cycles of the simulated run
+instead of an estimate from the tables: culling, clipping, overlay loads, and
+DMA stalls are all included. Every command is counted, so this is the exact
+version of a sampling profiler, but of the simulator's timing model (see
+rspsim.py), not of hardware. The RDP is not emulated, so FIFO stalls only
+appear with --rdpBytesPerCycle, and their lengths depend on it.
+
+The microcode is loaded, and its FIFO, yield data, and DRAM stack placed, in the
+--sim-area (by default the top 256 KiB of 8 MiB RDRAM), so that region of the
+image must not contain anything the display lists use. The RDP is not emulated,
+so the framebuffers may be there. For a display list which expects segments to
+already be set, e.g. an object display list, pass them with --segment; they are
+set by a short display list in the sim area which then calls the root. The
+image must already contain the viewport, matrices, etc. the display lists use,
+which is the case for a whole frame's display list.
+
+The simulator is slow: a whole frame of a typical game takes minutes.
+
+With --samples, nothing is simulated: this is the host side of the sampling
+profiler in the F3DEX3_*_NOC_PS microcodes (see gSPProfilingBuffer in gbi.h).
+Give it the sample buffer written by the game on hardware, and the memory image
+and root display list of the same frame. Each sample is the address of the
+command which was about to start when an interval had passed, so it is of the
+command 8 bytes before that, or for the first command of a display list, of the
+call and the fetch of it. The display list tree is walked statically, like in
+dlanalyze.py, to find which display lists and callers each sampled command is
+in; the DL stack depth in the sample picks between the places a shared display
+list is called from, and if there are still several, the sample is split
+between them. The report is then the measured time of each subtree.
+
+Usage:
+python3 dlprofile.py F3DEX3_BrZ ram.bin 0x8012F2C0 --names assets.txt
+python3 dlprofile.py F3DEX3_BrZ ram.bin 0x06000A30 --segment 6=0x80250000 --rdpBytesPerCycle 1.5
+python3 dlprofile.py F3DEX3_BrZ_NOC_PS ram.bin 0x8012F2C0 --samples samples.bin --interval 6250
+"""
+
+import argparse
+import struct
+import sys
+
+import dlanalyze
+import gbi
+import rspsim
+
+SIM_AREA_SIZE = 0x40000
+
+
+class DisplayListProfile:
+    def __init__(self, addr):
+        self.addr = addr
+        self.calls = 0
+        self.cycles = 0     # Including everything it calls / branches to
+        self.ownCycles = 0  # Only its own commands
+        self.cmds = 0
+        self.rdpTris = 0
+
+
+def placeSim(area):
+    """Moves everything rspsim puts in RDRAM into the sim area."""
+    rspsim.UCODE_CODE_ADDR = area
+    rspsim.UCODE_DATA_ADDR = area + 0x8000
+    rspsim.DRAM_STACK_ADDR = area + 0x9000
+    rspsim.YIELD_DATA_ADDR = area + 0xA000
+    rspsim.FIFO_START_ADDR = area + 0x10000
+    rspsim.FIFO_END_ADDR = area + 0x20000
+    return area + 0x30000  # Free for the prologue
+
+
+def prologue(segments, root):
+    cmds = [gbi.gsMoveWd(gbi.G_MW_SEGMENT, s * 4, a & 0x1FFFFFFF) for s, a in segments.items()]
+    return gbi.cmdsToBytes(cmds + [gbi.gsSPDisplayList(root), gbi.gsSPEndDisplayList()])
+
+
+def profile(res):
+    """Attributes the cycles of each executed command to the display lists."""
+    dls = {}
+    def enter(dl):
+        if dl not in dls:
+            dls[dl] = DisplayListProfile(dl)
+        dls[dl].calls += 1
+    cmds = res.commands
+    if len(cmds) == 0:
+        return dls
+    # Each DL stack level is the list of display lists active at that level:
+    # the one called, plus any it branched to.
+    stack = []
+    active = [cmds[0].addr]
+    enter(active[0])
+    for i, c in enumerate(cmds):
+        dls[active[-1]].ownCycles += c.cycles
+        done = set()
+        for level in stack + [active]:
+            for dl in level:
+                if dl not in done:
+                    done.add(dl)
+                    d = dls[dl]
+                    d.cycles += c.cycles
+                    d.cmds += 1
+                    d.rdpTris += c.rdpTris
+        if i + 1 >= len(cmds):
+            break
+        nextAddr = cmds[i + 1].addr
+        jumped = nextAddr != c.addr + 8
+        cmd = c.w0 >> 24
+        if cmd == gbi.G_DL:
+            if ((c.w0 >> 16) & 0xFF) == gbi.G_DL_PUSH:
+                stack.append(active)
+                active = [nextAddr]
+            elif nextAddr not in active:
+                active = active + [nextAddr]
+            enter(nextAddr)
+        elif cmd == gbi.G_BRANCH_Z and jumped:
+            if nextAddr not in active:
+                active = active + [nextAddr]
+            enter(nextAddr)
+        elif cmd == gbi.G_ENDDL or (cmd == gbi.G_CULLDL and jumped):
+            active = stack.pop() if len(stack) > 0 else [nextAddr]
+    return dls
+
+
+def readSamples(path):
+    """(address, DL stack depth) of each sample, up to the first zero one."""
+    with open(path, "rb") as f:
+        data = f.read()
+    samples = []
+    for i in range(0, len(data) - 7, 8):
+        addr, stackLen = struct.unpack(">II", data[i:i + 8])
+        if addr == 0:
+            break
+        samples.append((addr & 0x1FFFFFFF, stackLen // 4))
+    return samples
+
+
+def symbolize(an, root, samples):
+    """
+    Attributes the samples to the display lists of the tree walked by the
+    dlanalyze.Analyzer an. Returns the DisplayListProfiles, with cycles and
+    ownCycles in samples, and the number of samples which matched no command.
+    """
+    # Command address: list of (DL stack depth, own display list, all display lists)
+    visits = {}
+    def onCommand(addr, active, stack):
+        levels = [a for _, a in stack] + [active]
+        v = (len(stack), active[-1], frozenset(dl for level in levels for dl in level))
+        visits.setdefault(addr, [])
+        if v not in visits[addr]:
+            visits[addr].append(v)
+    an.onCommand = onCommand
+    an.run(root)
+    dls = {}
+    for dl, info in an.dls.items():
+        dls[dl] = DisplayListProfile(dl)
+        dls[dl].calls = info.calls
+    unknown = 0
+    for addr, depth in samples:
+        where = []
+        if addr in an.dls:
+            where = [v for v in visits.get(addr, []) if v[0] == depth]
+        if len(where) == 0:
+            where = [v for v in visits.get(addr - 8, []) if v[0] == depth]
+        if len(where) == 0:
+            unknown += 1
+            continue
+        w = 1.0 / len(where)
+        for _, own, chain in where:
+            dls[own].ownCycles += w
+            for dl in chain:
+                dls[dl].cycles += w
+    return dls, unknown
+
+
+def reportSamples(args, image, segments):
+    an = dlanalyze.Analyzer(image, args.base, segments, "_NOC" in args.ucode, args.branch_z == "taken")
+    samples = readSamples(args.samples)
+    dls, unknown = symbolize(an, args.root, samples)
+    names = dlanalyze.readNames(args.names) if args.names is not None else {}
+    total = max(len(samples), 1)
+    print(f"Total: {len(samples)} samples, ~{len(samples) * args.interval} RCP cycles "
+        + f"({len(samples) * args.interval / 62500:.2f} ms), {unknown} not in the tree")
+    print("")
+    print(f"| Display list         | Calls | Samples  | % total | Own samples | Est. cycles |")
+    print(f"|----------------------|-------|----------|---------|-------------|-------------|")
+    ranked = sorted(dls.values(), key=lambda d: (-d.cycles, d.addr))
+    for d in ranked[:args.top]:
+        name = names.get(d.addr, f"{d.addr:08X}")
+        print(f"| {name:<20} | {d.calls:>5} | {d.cycles:>8.1f} | {100.0 * d.cycles / total:>6.1f}% "
+            + f"| {d.ownCycles:>11.1f} | {int(d.cycles * args.interval):>11} |")
+    for w in an.warnings:
+        print("Warning: " + w, file=sys.stderr)
+    print(f"{len(dls)} display lists", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Profile an F3DEX3 display list tree on the simulated RSP")
+    parser.add_argument("ucode", help="Microcode name, e.g. F3DEX3_BrZ")
+    parser.add_argument("image", help="Memory image, e.g. RDRAM dump")
+    parser.add_argument("root", type=lambda x: int(x, 0), help="Root display list address")
+    parser.add_argument("--build-dir", default="build")
+    parser.add_argument("--base", type=lambda x: int(x, 0), default=0,
+        help="Physical address of the start of the image (default 0)")
+    parser.add_argument("--segment", action="append", default=[], type=dlanalyze.parseSegment,
+        help="Initial segment, as N=address (repeatable)")
+    parser.add_argument("--sim-area", type=lambda x: int(x, 0),
+        default=rspsim.RDRAM_SIZE - SIM_AREA_SIZE,
+        help="Physical address of 256 KiB the image does not use, for the microcode and FIFO")
+    parser.add_argument("--names", help="Text file with name and address per line, for the report")
+    parser.add_argument("--top", type=int, default=20, help="Number of display lists to list")
+    parser.add_argument("--timeline", help="Also write a Perfetto / Chrome trace JSON, see rspsim.py")
+    parser.add_argument("--samples", help="Sample buffer from a _PS microcode on hardware; "
+        + "attribute it instead of simulating")
+    parser.add_argument("--interval", type=int, default=6250,
+        help="RCP cycles between the samples, as set with SPProfilingSampleInterval")
+    parser.add_argument("--branch-z", choices=["taken", "not"], default="taken",
+        help="With --samples, which way gsSPBranchLessZ is walked (default taken)")
+    rspsim.makeTimingArgs(parser)
+    args = parser.parse_args()
+
+    if args.samples is not None:
+        with open(args.image, "rb") as f:
+            reportSamples(args, f.read(), dict(args.segment))
+        return
+
+    if args.sim_area % 0x1000 != 0 or args.sim_area + SIM_AREA_SIZE > rspsim.RDRAM_SIZE:
+        raise RuntimeError(f"Bad --sim-area {args.sim_area:08X}")
+    prologueAddr = placeSim(args.sim_area)
+    code, data, syms = rspsim.loadUcode(args.ucode, args.build_dir)
+    rsp = rspsim.RSP(code, data, syms, rspsim.timingFromArgs(args))
+    with open(args.image, "rb") as f:
+        image = f.read()
+    base = args.base & 0x1FFFFFFF
+    if base + len(image) > rspsim.RDRAM_SIZE:
+        raise RuntimeError("Image does not fit in the simulated RDRAM")
+    segments = dict(args.segment)
+    root = args.root
+    if (root >> 24) & 0xF != 0 and (root >> 24) & 0xF in segments:
+        root = ((root & 0x00FFFFFF) + segments[(root >> 24) & 0xF]) & 0x1FFFFFFF
+    else:
+        root &= 0x1FFFFFFF
+
+    # boot writes the microcode into the sim area, so only the DL goes in here
+    rsp.writeRdram(base, image)
+    start = root
+    if len(segments) > 0:
+        rsp.writeRdram(prologueAddr, prologue(segments, root))
+        start = prologueAddr
+    res = rsp.runTask(start)
+    dls = profile(res)
+    names = dlanalyze.readNames(args.names) if args.names is not None else {}
+    if len(segments) > 0:
+        names[prologueAddr] = "(segment setup)"
+
+    rootProf = dls[start]
+    print(f"Total: {res.cycles} RSP cycles ({res.cycles / 62500:.2f} ms), {len(res.commands)} commands, "
+        + f"{res.rdpTris} RDP tris")
+    totals = rspsim.waitTotals(res)
+    if len(totals) > 0:
+        print("Stalls: " + ", ".join(f"{k} {v} cycles" for k, v in sorted(totals.items())))
+    print("")
+    print(f"| Display list         | Calls | Cycles   | % total | Own cycles | Cmds   | RDP tris |")
+    print(f"|----------------------|-------|----------|---------|------------|--------|----------|")
+    ranked = sorted(dls.values(), key=lambda d: (-d.cycles, d.addr))
+    for d in ranked[:args.top]:
+        name = names.get(d.addr, f"{d.addr:08X}")
+        pct = 100.0 * d.cycles / max(rootProf.cycles, 1)
+        print(f"| {name:<20} | {d.calls:>5} | {d.cycles:>8} | {pct:>6.1f}% | {d.ownCycles:>10} "
+            + f"| {d.cmds:>6} | {d.rdpTris:>8} |")
+    if args.timeline is not None:
+        with open(args.timeline, "w") as f:
+            rspsim.writeTimeline(res, f)
+    print(f"{len(dls)} display lists", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -139,11 +139,43 @@ COUNTER_C_FIFO_FULL equ 1
 
 .endif
 
+// Profiling Configuration Tags
+// Keeps the default counters. Each G_NOOP with a nonzero second word (e.g.
+// gDPNoOpTag) writes a PROF_TAG_RECORD_SIZE byte record to the RDRAM buffer set
+// with SPProfilingBuffer: the tag, DPC_CLOCK, perfCounterA, and perfCounterB.
+// The differences between consecutive records are the cost of each tag. This
+// only fits in IMEM in the NOC builds.
+.if CFG_PROFILING_TAGS
+.if ENABLE_PROFILING
+.error "CFG_PROFILING_TAGS records the default counters, so can't be combined with CFG_PROFILING_A/B/C"
+.endif
+.if !CFG_NO_OCCLUSION_PLANE
+.error "CFG_PROFILING_TAGS only fits in IMEM with CFG_NO_OCCLUSION_PLANE"
+.endif
+.endif
+PROF_TAG_RECORD_SIZE equ 16
+
+// Profiling Configuration Samples
+// Keeps the default counters. Every profSampleInterval RCP cycles, the address
+// of the next display list command to run and the DL stack length are written as
+// a PROF_SAMPLE_SIZE byte sample to the RDRAM buffer set with
+// SPProfilingBuffer. This only fits in IMEM in the NOC builds.
+.if CFG_PROFILING_SAMPLES
+.if ENABLE_PROFILING || CFG_PROFILING_TAGS
+.error "CFG_PROFILING_SAMPLES can't be combined with other CFG_PROFILING_ options"
+.endif
+.if !CFG_NO_OCCLUSION_PLANE
+.error "CFG_PROFILING_SAMPLES only fits in IMEM with CFG_NO_OCCLUSION_PLANE"
+.endif
+.endif
+PROF_SAMPLE_SIZE equ 8
+PROF_SAMPLE_DEFAULT_INTERVAL equ 6250 // 0.1 ms
+
 CFG_DEBUG_NORMALS equ 0 // Can manually enable here
 
 // Only raise a warning in base modes; in profiling modes, addresses will be off
 .macro warn_if_base, warntext
-    .if !ENABLE_PROFILING
+    .if !ENABLE_PROFILING && !CFG_PROFILING_TAGS && !CFG_PROFILING_SAMPLES
         .warning warntext
     .endif
 .endmacro
@@ -560,7 +592,11 @@ miniTableEntry G_SETxIMG_handler // G_SETTIMG
 miniTableEntry G_SETxIMG_handler // G_SETZIMG
 miniTableEntry G_SETxIMG_handler // G_SETCIMG
 cmdMiniTable:
+.if CFG_PROFILING_TAGS
+miniTableEntry G_NOOP_handler
+.else
 miniTableEntry G_RDP_handler // G_NOOP
+.endif
 miniTableEntry G_VTX_handler
 miniTableEntry G_MODIFYVTX_handler
 miniTableEntry G_CULLDL_handler
@@ -573,6 +609,35 @@ miniTableEntry G_SPNOOP_handler // no command mapped to 0x09
 miniTableEntry G_LIGHTTORDP_handler
 miniTableEntry G_RELSEGMENT_handler
 
+.if CFG_PROFILING_TAGS
+.align 4
+profBufPtr: // Next record in RDRAM (physical); 0 = not recording
+    .dw 0
+.align 8
+profRecord: // Staging for the record DMA
+    .fill PROF_TAG_RECORD_SIZE
+profBufEnd: // End of the RDRAM buffer (physical)
+    .dw 0
+.if (profBufPtr - fxParams) != 0x84 || (profBufEnd - fxParams) != 0x98
+    .error "Update G_MWO_PROF_* in GBI"
+.endif
+.elseif CFG_PROFILING_SAMPLES
+.align 4
+profBufPtr: // Next sample in RDRAM (physical); 0 = not sampling
+    .dw 0
+.align 8
+profRecord: // Staging for the sample DMA
+    .fill PROF_SAMPLE_SIZE
+profNextSample: // DPC_CLOCK of the next sample
+    .dw 0
+profSampleInterval: // RCP cycles between samples
+    .dw PROF_SAMPLE_DEFAULT_INTERVAL
+profBufEnd: // End of the RDRAM buffer (physical)
+    .dw 0
+.if (profBufPtr - fxParams) != 0x84 || (profBufEnd - fxParams) != 0x98 || (profSampleInterval - fxParams) != 0x94
+    .error "Update G_MWO_PROF_* in GBI"
+.endif
+.endif
 
 // The maximum number of generated vertices in a clip polygon. In reality, this
 // is equal to MAX_CLIP_POLY_VERTS, but for testing we can change them separately.
@@ -1075,6 +1140,10 @@ continue_from_os_task:
     lw      perfCounterC, mvpMatrix + YDF_OFFSET_PERFCOUNTERC
     lw      perfCounterD, mvpMatrix + YDF_OFFSET_PERFCOUNTERD
     lw      taskDataPtr, OSTask + OSTask_data_ptr
+.if CFG_PROFILING_SAMPLES
+    mfc0    $11, DPC_CLOCK
+    sw      $11, profNextSample  // First sample at the first command
+.endif
 finish_setup:
 .if CFG_PROFILING_C
     mfc0    $11, DPC_CLOCK
@@ -1148,6 +1217,12 @@ load_overlays_0_1:
     j       load_overlay_inner
      li     dmemAddr, 0x1000
 
+.if !CFG_NO_OCCLUSION_PLANE
+displaylist_dma_from_yield: // 2; in ovl1 in NOC, here to make room for the G_CULLDL occlusion test
+    j       displaylist_dma_goto_next_ra
+     lh     nextRA, tempTriRA
+.endif
+
 G_GEOMETRYMODE_handler: // 6
     lw      $11, geometryModeLabel        // load the geometry mode value
     and     $11, $11, cmd_w0              // clears the flags in cmd_w0 (set in g*SPClearGeometryMode)
@@ -1224,6 +1299,9 @@ run_next_DL_command:
     lw      cmd_w1_dram, (inputBufferEnd + 4)(inputBufferPos) // Word 1
 .if CFG_PROFILING_C
     mfc0    $10, DPC_STATUS
+.elseif CFG_PROFILING_SAMPLES
+    mfc0    $10, DPC_CLOCK
+    lw      $11, profNextSample
 .endif
     vmadn   $v7, vOne, vTRC_VB                          // Plus address of vertex buffer
     sll     $ra, $ra, 2                                 // Convert to a number of instructions
@@ -1237,6 +1315,10 @@ run_next_DL_command:
     sw      perfCounterC, startFifoStallTime            // Save initial FIFO stall time
     addi    perfCounterB, perfCounterB, 1               // Count commands
     sw      $10, startCounterTime
+.elseif CFG_PROFILING_SAMPLES
+    sub     $10, $10, $11                               // Clock - next sample time
+    sll     $10, $10, 8                                 // DPC_CLOCK is 24 bits
+    bgez    $10, take_profiling_sample                  // Comes back here with the same command
 .endif
     vmadl   $v6, $v31, $v31[2]                          // 0; copy in v6
     jr      $ra                                         // Jump to handler
@@ -1268,6 +1350,53 @@ dma_and_wait_goto_next_ra:
     j       dma_read_write
      li     $ra, wait_goto_next_ra
 
+.if CFG_PROFILING_TAGS
+G_NOOP_handler: // 17
+    lw      $2, profBufPtr
+    lw      $3, profBufEnd
+    mfc0    $10, DPC_CLOCK
+    beqz    cmd_w1_dram, run_next_DL_command  // Tag 0 (gDPNoOp) is not recorded
+     sub    $3, $2, $3
+    bgez    $3, run_next_DL_command           // Buffer full or not set
+     addi   $3, $2, PROF_TAG_RECORD_SIZE
+    sw      cmd_w1_dram, (profRecord + 0x0)   // Tag
+    sw      $10, (profRecord + 0x4)           // RDP clock
+    sw      perfCounterA, (profRecord + 0x8)  // Vertex and RDP tri counts
+    sw      perfCounterB, (profRecord + 0xC)  // RSP tri and rect counts
+    sw      $3, profBufPtr
+    move    cmd_w1_dram, $2                   // RDRAM address of this record
+    li      dmemAddr, -0x8000 | profRecord    // negative = write
+    li      dmaLen, PROF_TAG_RECORD_SIZE - 1
+    j       dma_and_wait_goto_next_ra         // Wait so the next tag can reuse profRecord
+     li     nextRA, run_next_DL_command
+.endif
+
+.if CFG_PROFILING_SAMPLES
+// Samples are taken here, before a command is run, so each is of the time since
+// the last command started: normally the command 8 bytes before this one, or
+// for the first command of a display list, the call and the DL fetch. If more
+// than one interval has passed, this comes back with the same command and takes
+// another sample of it, so long commands get as many samples as they took.
+take_profiling_sample: // 17; $11 = time of this sample
+    lw      $2, profSampleInterval
+    lw      cmd_w1_dram, profBufPtr           // Reloaded when the command is run again
+    lw      $3, profBufEnd
+    add     $11, $11, $2
+    sw      $11, profNextSample
+    sub     $3, cmd_w1_dram, $3
+    bgez    $3, run_next_DL_command           // Buffer full or not set
+     add    $2, taskDataPtr, inputBufferPos   // DL address of the command about to run
+    lbu     $3, displayListStackLength
+    sw      $2, (profRecord + 0x0)
+    sw      $3, (profRecord + 0x4)            // DL stack length, 4 per level
+    addi    $2, cmd_w1_dram, PROF_SAMPLE_SIZE
+    sw      $2, profBufPtr
+    li      dmemAddr, -0x8000 | profRecord    // negative = write
+    li      dmaLen, PROF_SAMPLE_SIZE - 1
+    j       dma_and_wait_goto_next_ra         // Wait so the next sample can reuse profRecord
+     li     nextRA, run_next_DL_command
+.endif
+
 .if !ENABLE_PROFILING
 G_LIGHTTORDP_handler: // 9
     sw      cmd_w1_dram, 0(rdpCmdBufPtr) // Store second word as first (cmd byte, prim level)
@@ -2867,15 +2996,7 @@ ovl1_start:
 G_CULLDL_handler: // 15
     mfc2    $10, $v7[6]                     // Start vtx addr (index was byte 3)
     mfc2    $3, $v7[14]                     // End vertex addr (index was byte 7)
-    /*
-    CLIP_OCCLUDED can't be included here because: Suppose the list consists of N-1
-    verts which are behind the occlusion plane, and 1 vert which is behind the camera
-    plane and therefore randomly erroneously also set as behind the occlusion plane.
-    However, the convex hull of all the verts goes through visible area. This will be
-    incorrectly culled here. We can't afford the extra few instructions to disable
-    the occlusion plane if the vert is behind the camera, because this only matters for
-    G_CULLDL and not for tris.
-    */
+.if CFG_NO_OCCLUSION_PLANE
     li      $1, (CLIP_SCRN_NPXY | CLIP_CAMPLANE)
     lhu     $11, VTX_CLIP($10)
 culldl_loop:
@@ -2885,6 +3006,31 @@ culldl_loop:
     bne     $10, $3, culldl_loop            // loop until reaching the last vertex
      addi   $10, $10, vtxSize               // advance to the next vertex
     li      cmd_w0, 0                       // Clear count of DL cmds to skip loading
+.else
+    /*
+    Also cull if all the verts are behind the occlusion plane. A vert which is
+    behind the camera plane may be randomly erroneously set as behind the occlusion
+    plane, and the convex hull of such a vert with N-1 occluded verts may go through
+    visible area. So CLIP_OCCLUDED is removed from the common flags if any vert is
+    behind the camera plane. The occluded region in front of the camera is convex,
+    so if all the verts are in it, so is their convex hull. This check only matters
+    for G_CULLDL and not for tris, so it is not done in the vertex code.
+    Shifting the flags left 8 also moves CLIP_SCRN_NX/NY to CLIP_SCRN_PX/PY. A vert
+    can only have both of those if it is behind the camera plane, so this only loses
+    a few culls of objects which are partly behind the camera.
+    */
+    li      $1, (CLIP_SCRN_NPXY | CLIP_CAMPLANE | CLIP_OCCLUDED)
+    lhu     $11, VTX_CLIP($10)
+culldl_loop:
+    sll     cmd_w0, $11, 8                  // CLIP_CAMPLANE to CLIP_OCCLUDED; low byte 0 clears count of DL cmds to skip loading
+    and     $1, $1, $11                     // Flags common to all verts
+    or      $1, $1, cmd_w0                  // These two clear the bits of cmd_w0,
+    xor     $1, $1, cmd_w0                  // i.e. CLIP_OCCLUDED if behind camera plane
+    beqz    $1, run_next_DL_command         // Some vertex is on the screen-side of all clipping planes; have to render
+     lhu    $11, (vtxSize + VTX_CLIP)($10)  // next vertex clip flags
+    bne     $10, $3, culldl_loop            // loop until reaching the last vertex
+     addi   $10, $10, vtxSize               // advance to the next vertex
+.endif
 G_ENDDL_handler:
     lbu     $7, displayListStackLength      // Load the DL stack index; if end stack,
     beqz    $7, load_overlay_0_and_enter    // load overlay 0; $7 == -4 signals end
@@ -3019,9 +3165,11 @@ G_MODIFYVTX_handler: // 3
     j       do_moveword  // Moveword adds cmd_w0 to $10 for final addr
      lbu    cmd_w0, (inputBufferEnd - 0x07)(inputBufferPos)  // offset in vtx, bit 15 clear
 
+.if CFG_NO_OCCLUSION_PLANE
 displaylist_dma_from_yield: // 2
     j       displaylist_dma_goto_next_ra
      lh     nextRA, tempTriRA
+.endif
 
 // Converts the segmented address in cmd_w1_dram to the corresponding physical address
 segmented_to_physical: // 8
@@ -339,6 +339,9 @@ longer a multiple of 8 (DMA word). This was not used in any command anyway. */
 #define G_MWO_ATTR_OFFSET_T      0x12
 #define G_MWO_ALPHA_COMPARE_CULL 0x14
 #define G_MWO_LAST_MAT_DL_ADDR   0x16
+#define G_MWO_PROF_BUF_PTR       0x84
+#define G_MWO_PROF_SAMPLE_INTERVAL 0x94
+#define G_MWO_PROF_BUF_END       0x98
 
 /*
  * RDP command argument defines
@@ -1095,6 +1098,73 @@ typedef union {
     long long int force_structure_alignment;
 } PlainVtx;
 
+/**
+ * Packed vertex, 8 bytes. The microcode does not load these; they are a storage
+ * format, unpacked to Vtx on the CPU with VtxPackedUnpack (cpu/vtxpack.c). See
+ * "Packed vertex format" in docs/Documentation/Design Tradeoffs.md, and
+ * vtxpack.py to convert Vtx arrays.
+ *
+ * Each vertex belongs to a batch, described by a VtxPackedHeader. The position
+ * is 10 bits per axis, unsigned, in units of (1 << posShift) from the batch
+ * origin: x in bits 31-22 of pos, y in 21-12, z in 11-2. The texture coords are
+ * 8 bits each, in units of (1 << stShift) (in S10.5) from the batch ST origin.
+ * cn is a color in RGBA5551, or if the batch has VTXP_FLAG_NORMALS, a normal
+ * in the 5-6-5 encoding of packed normals (X in bits 15-11, Y in 10-5, Z in
+ * 4-0, signed); the vertex is then white with alpha 255.
+ */
+typedef struct {
+    unsigned int   pos;     /** x, y, z */
+    unsigned char  st[2];   /** texture coord */
+    unsigned short cn;      /** color or normal */
+} VtxPacked_t;
+
+typedef union {
+    VtxPacked_t v;
+    long long int force_structure_alignment;
+} VtxPacked;
+
+/**
+ * Batch of packed vertices: VtxPacked entries start to start + count - 1 are
+ * unpacked relative to this. Usually one batch per SPVertex.
+ */
+typedef struct {
+    short          origin[3];   /** model space position of pos 0, 0, 0 */
+    unsigned char  posShift;    /** 0-6 */
+    unsigned char  stShift;     /** 0-8 */
+    short          stOrigin[2]; /** texture coord of st 0, 0 */
+    unsigned short start;       /** first VtxPacked of the batch */
+    unsigned char  count;       /** number of vertices */
+    unsigned char  flags;       /** VTXP_FLAG_* */
+} VtxPackedHeader;
+
+#define VTXP_FLAG_NORMALS 0x01
+
+#define VTXP_POS(x, y, z)                           \
+    ((((unsigned int)(x) & 0x3FF) << 22) |          \
+     (((unsigned int)(y) & 0x3FF) << 12) |          \
+     (((unsigned int)(z) & 0x3FF) <<  2))
+
+/**
+ * r, g, b, a are 0-255, as in Vtx.
+ */
+#define VTXP_RGBA5551(r, g, b, a)                   \
+    ((((r) >> 3) << 11) | (((g) >> 3) << 6) |       \
+     (((b) >> 3) <<  1) | ((a) >> 7))
+
+/**
+ * x, y, z are -128 to 127, as in Vtx_tn.
+ */
+#define VTXP_NORMAL(x, y, z)                        \
+    (((((x) >> 3) & 0x1F) << 11) |                  \
+     ((((y) >> 2) & 0x3F) <<  5) |                  \
+      (((z) >> 3) & 0x1F))
+
+#define gdSPDefVtxPacked(x, y, z, s, t, cn)         \
+    { { VTXP_POS(x, y, z), { s, t }, cn } }
+
+#define gdSPDefVtxPackedHeader(ox, oy, oz, posShift, so, to, stShift, start, count, flags) \
+    { { ox, oy, oz }, posShift, stShift, { so, to }, start, count, flags }
+
 /**
  * Triangle face
  */
@@ -3248,7 +3318,11 @@ _DW({                                               \
 /**
  * Cull the display list based on screen clip flags of range of loaded verts.
  * Executes SPEndDisplayList if the convex hull formed by the specified range of
- * already-loaded vertices is offscreen.
+ * already-loaded vertices is offscreen. In configurations with the occlusion
+ * plane (not NOC), also ends the display list if all of these vertices are
+ * behind the occlusion plane and in front of the camera plane, so a whole
+ * object hidden behind a wall can be skipped after loading only its bounding
+ * box vertices.
  */
 #define gSPCullDisplayList(pkt,vstart,vend)             \
 _DW({                                                   \
@@ -3639,6 +3713,11 @@ _DW({ \
  * explain here. The reference implementation `guOcclusionPlane` is provided
  * separately.
  * 
+ * The occlusion plane is applied when vertices are loaded, so it may be changed
+ * between objects to use a different plane for each part of the scene (e.g.
+ * whichever wall hides that object). Don't change it between an SPVertex and
+ * the triangles which use those vertices. See Performance.md for the cost.
+ * 
  * o is the address of an OcclusionPlane struct
  */
 #define gSPOcclusionPlane(pkt, o) \
@@ -5589,6 +5668,52 @@ _DW({                                                   \
 #define gDPNoOpTag(pkt, tag)    gDPParam(pkt,   G_NOOP, tag)
 #define gsDPNoOpTag(tag)        gsDPParam(      G_NOOP, tag)
 
+/**
+ * Sets the RDRAM buffer for the profiling records of the F3DEX3_*_NOC_PT
+ * (CFG_PROFILING_TAGS) and F3DEX3_*_NOC_PS (CFG_PROFILING_SAMPLES) microcodes;
+ * other versions ignore it. Recording stops when the buffer is full. start and
+ * end are physical addresses, and start must be 8 byte aligned. The microcode
+ * forgets the buffer at the start of every task, so set it at the start of
+ * every frame's display list.
+ *
+ * In _PT, every gDPNoOpTag with a nonzero tag writes a 16 byte record: the tag,
+ * the RDP clock (DPC_CLOCK, 24 bits), and perfCounterA and perfCounterB (see
+ * F3DEX3YieldDataFooter), so the differences between consecutive records are
+ * the cycles, vertices, and tris of everything after each tag. Tag 0 is never
+ * recorded, so if the buffer is zeroed first, the records end at the first zero
+ * tag; see F3DEX3TagRecordsDecode in cpu/counters.c.
+ *
+ * In _PS, every gSPProfilingSampleInterval cycles, the physical address of the
+ * display list command being run and the DL stack depth * 4 are written as an
+ * 8 byte sample. dlprofile.py --samples attributes them to display lists.
+ */
+#define gSPProfilingBuffer(pkt, start, end)                             \
+_DW({                                                                   \
+    gMoveWd(pkt, G_MW_FX, G_MWO_PROF_BUF_PTR, (unsigned int)(start));   \
+    gMoveWd(pkt, G_MW_FX, G_MWO_PROF_BUF_END, (unsigned int)(end));     \
+})
+/**
+ * @copydetails gSPProfilingBuffer
+ */
+#define gsSPProfilingBuffer(start, end)                                 \
+    gsMoveWd(G_MW_FX, G_MWO_PROF_BUF_PTR, (unsigned int)(start)),       \
+    gsMoveWd(G_MW_FX, G_MWO_PROF_BUF_END, (unsigned int)(end))
+
+/**
+ * Sets the RCP cycles between samples of the F3DEX3_*_NOC_PS microcodes, see
+ * gSPProfilingBuffer; the default is 6250 (0.1 ms). Like the buffer, this is
+ * reset at the start of every task. Taking a sample costs about 90 cycles
+ * including the DMA, so use at least a few thousand. Below about 100 the
+ * microcode never catches up with the sample times and hangs.
+ */
+#define gSPProfilingSampleInterval(pkt, cycles) \
+    gMoveWd(pkt, G_MW_FX, G_MWO_PROF_SAMPLE_INTERVAL, (unsigned int)(cycles))
+/**
+ * @copydetails gSPProfilingSampleInterval
+ */
+#define gsSPProfilingSampleInterval(cycles) \
+    gsMoveWd(G_MW_FX, G_MWO_PROF_SAMPLE_INTERVAL, (unsigned int)(cycles))
+
 #define gDPNoOpHere(pkt, file, line)        gDma1p(pkt, G_NOOP, file, line, 1)
 #define gDPNoOpString(pkt, data, n)         gDma1p(pkt, G_NOOP, data, n, 2)
 #define gDPNoOpWord(pkt, data, n)           gDma1p(pkt, G_NOOP, data, n, 3)
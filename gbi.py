@@ -0,0 +1,321 @@
+#!python3
+
+"""
+Python versions of the F3DEX3 GBI macros, for host tools which build or parse
+display lists. Each gs* function returns the (w0, w1) pair which the macro of
+the same name in gbi.h produces, and the data functions return the binary
+layout of the corresponding struct (big-endian, as in RDRAM). Only the commands
+the host tools need are here; add more as needed, following gbi.h, and add a
+case for them to gbi_test.py, which checks these against the gbi.h macros.
+"""
+
+import struct
+
+G_NOOP              = 0x00
+G_VTX               = 0x01
+G_MODIFYVTX         = 0x02
+G_CULLDL            = 0x03
+G_BRANCH_Z          = 0x04
+G_TRI1              = 0x05
+G_TRI2              = 0x06
+G_QUAD              = 0x07
+G_TRISNAKE          = 0x08
+G_TEXTURE           = 0xD7
+G_POPMTX            = 0xD8
+G_GEOMETRYMODE      = 0xD9
+G_MTX               = 0xDA
+G_MOVEWORD          = 0xDB
+G_MOVEMEM           = 0xDC
+G_LOAD_UCODE        = 0xDD
+G_DL                = 0xDE
+G_ENDDL             = 0xDF
+G_SPNOOP            = 0xE0
+G_RDPHALF_1         = 0xE1
+G_SETOTHERMODE_L    = 0xE2
+G_SETOTHERMODE_H    = 0xE3
+G_RDPPIPESYNC       = 0xE7
+G_SETPRIMCOLOR      = 0xFA
+
+G_MAX_LIGHTS = 9
+G_INPUT_BUFFER_CMDS = 21
+
+G_ZBUFFER               = 0x00000001
+G_SHADE                 = 0x00000004
+G_ATTROFFSET_ST_ENABLE  = 0x00000080
+G_AMBOCCLUSION          = 0x00000100
+G_CULL_FRONT            = 0x00000200
+G_CULL_BACK             = 0x00000400
+G_CULL_BOTH             = 0x00000600
+G_PACKED_NORMALS        = 0x00000800
+G_LIGHTTOALPHA          = 0x00001000
+G_LIGHTING_SPECULAR     = 0x00002000
+G_FRESNEL_COLOR         = 0x00004000
+G_FRESNEL_ALPHA         = 0x00008000
+G_FOG                   = 0x00010000
+G_LIGHTING              = 0x00020000
+G_TEXTURE_GEN           = 0x00040000
+G_TEXTURE_GEN_LINEAR    = 0x00080000
+G_SHADING_SMOOTH        = 0x00200000
+
+G_DL_PUSH   = 0
+G_DL_NOPUSH = 1
+
+G_MTX_MODEL          = 0x00
+G_MTX_VIEWPROJECTION = 0x04
+G_MTX_MUL            = 0x00
+G_MTX_LOAD           = 0x02
+G_MTX_NOPUSH         = 0x00
+G_MTX_PUSH           = 0x01
+
+G_MV_MMTX      = 0
+G_MV_VPMTX     = 4
+G_MV_VIEWPORT  = 8
+G_MV_LIGHT     = 10
+
+G_MW_FX        = 0x00
+G_MW_NUMLIGHT  = 0x02
+G_MW_SEGMENT   = 0x06
+G_MW_FOG       = 0x08
+
+G_MWO_NUMLIGHT       = 0x00
+G_MWO_FRESNEL_SCALE  = 0x0C
+G_MWO_FRESNEL_OFFSET = 0x0E
+G_MWO_PROF_BUF_PTR   = 0x84
+G_MWO_PROF_SAMPLE_INTERVAL = 0x94
+G_MWO_PROF_BUF_END   = 0x98
+
+G_SNAKE_RIGHT = 0
+G_SNAKE_LEFT  = 1
+G_SNAKE_LAST  = 0x40
+
+ENABLE_POINT_LIGHTS = 0x8000 >> 4
+
+G_ON  = 1
+G_OFF = 0
+
+VTX_SIZE = 0x10
+MTX_SIZE = 0x40
+VP_SIZE = 0x10
+LIGHT_SIZE = 0x10
+AMBIENT_SIZE = 0x8
+LOOKAT_SIZE = 0x8
+PLAINVTX_SIZE = 0x8
+OCCLUSIONPLANE_SIZE = 0x18
+
+
+def _SHIFTL(v, s, w):
+    return (int(v) & ((1 << w) - 1)) << s
+
+
+def NUML(n):
+    return n * 0x10
+
+
+def _DLHINTVALUE(count):
+    if count > 0 and (count % G_INPUT_BUFFER_CMDS) > 0:
+        return (G_INPUT_BUFFER_CMDS - (count % G_INPUT_BUFFER_CMDS)) << 3
+    return 0
+
+
+# ---------------------------------------------------------------- Commands
+
+def gsDma1p(c, s, l, p):
+    return (_SHIFTL(c, 24, 8) | _SHIFTL(p, 16, 8) | _SHIFTL(l, 0, 16), s & 0xFFFFFFFF)
+
+def gsDma2p(c, adrs, length, idx, ofs):
+    return (_SHIFTL(c, 24, 8) | _SHIFTL((length - 1) // 8, 19, 5)
+        | _SHIFTL(ofs // 8, 8, 8) | _SHIFTL(idx, 0, 8), adrs & 0xFFFFFFFF)
+
+def gs1Word(c, l):
+    return (_SHIFTL(c, 24, 8) | _SHIFTL(l, 0, 24), 0)
+
+def gsSPNoOp():
+    return gs1Word(G_SPNOOP, 0)
+
+def gsMoveWd(index, offset, data):
+    return gsDma1p(G_MOVEWORD, data, offset & 0xFFF, index)
+
+def gsSPMatrix(m, p):
+    return gsDma2p(G_MTX, m, MTX_SIZE, p ^ G_MTX_PUSH ^ G_MTX_LOAD, 0)
+
+def gsSPVertex(v, n, v0):
+    return (_SHIFTL(G_VTX, 24, 8) | _SHIFTL(n, 12, 8) | _SHIFTL(v0 + n, 1, 7), v)
+
+def gsSPViewport(v):
+    return gsDma2p(G_MOVEMEM, v, VP_SIZE, G_MV_VIEWPORT, 0)
+
+def gsSPDisplayListHint(dl, count):
+    return gsDma1p(G_DL, dl, _DLHINTVALUE(count), G_DL_PUSH)
+
+def gsSPBranchListHint(dl, count):
+    return gsDma1p(G_DL, dl, _DLHINTVALUE(count), G_DL_NOPUSH)
+
+def gsSPEndDisplayListHint(count):
+    return gs1Word(G_ENDDL, _DLHINTVALUE(count))
+
+def gsSPDisplayList(dl):
+    return gsDma1p(G_DL, dl, 0, G_DL_PUSH)
+
+def gsSPBranchList(dl):
+    return gsDma1p(G_DL, dl, 0, G_DL_NOPUSH)
+
+def gsSPEndDisplayList():
+    return gs1Word(G_ENDDL, 0)
+
+def __gsSP1Triangle_w1(v0, v1, v2):
+    return _SHIFTL(v0 * 2, 16, 8) | _SHIFTL(v1 * 2, 8, 8) | _SHIFTL(v2 * 2, 0, 8)
+
+def __gsSP1Triangle_w1f(v0, v1, v2, flag):
+    if flag == 0:
+        return __gsSP1Triangle_w1(v0, v1, v2)
+    elif flag == 1:
+        return __gsSP1Triangle_w1(v1, v2, v0)
+    return __gsSP1Triangle_w1(v2, v0, v1)
+
+def gsSP1Triangle(v0, v1, v2, flag=0):
+    return gs1Word(G_TRI1, __gsSP1Triangle_w1f(v0, v1, v2, flag))
+
+def gsSP2Triangles(v00, v01, v02, flag0, v10, v11, v12, flag1):
+    return (_SHIFTL(G_TRI2, 24, 8) | __gsSP1Triangle_w1f(v00, v01, v02, flag0),
+        __gsSP1Triangle_w1f(v10, v11, v12, flag1))
+
+def _gSPTriSnakeW0(i1, i2, i3):
+    return (_SHIFTL(G_TRISNAKE, 24, 8) | _SHIFTL(i2 * 2, 16, 8)
+        | _SHIFTL(i1 * 2, 8, 8) | _SHIFTL(i3 * 2 | G_SNAKE_LEFT, 0, 8))
+
+def _gSPTriSnakeW1(i4, i4d, i5, i5d, i6, i6d, i7, i7d):
+    return (_SHIFTL(i4 * 2 | i4d, 24, 8) | _SHIFTL(i5 * 2 | i5d, 16, 8)
+        | _SHIFTL(i6 * 2 | i6d, 8, 8) | _SHIFTL(i7 * 2 | i7d, 0, 8))
+
+def gsSPTriSnake(i1, i2, i3, i4, i4d, i5, i5d, i6, i6d, i7, i7d):
+    return (_gSPTriSnakeW0(i1, i2, i3), _gSPTriSnakeW1(i4, i4d, i5, i5d, i6, i6d, i7, i7d))
+
+def gsSPContinueSnake(i0, i0d, i1, i1d, i2, i2d, i3, i3d, i4, i4d, i5, i5d, i6, i6d, i7, i7d):
+    return (_gSPTriSnakeW1(i0, i0d, i1, i1d, i2, i2d, i3, i3d),
+        _gSPTriSnakeW1(i4, i4d, i5, i5d, i6, i6d, i7, i7d))
+
+def triSnake(first, rest):
+    """
+    Encodes a whole snake as a list of commands: gsSPTriSnake followed by as
+    many gsSPContinueSnake as needed. first is (i1, i2, i3); rest is a list of
+    (index, direction). G_SNAKE_LAST is added to the last index.
+    """
+    idx = [i * 2 for i in first]
+    b = [idx[1] & 0xFF, idx[0] & 0xFF, (idx[2] | G_SNAKE_LEFT) & 0xFF]
+    for n, (i, d) in enumerate(rest):
+        if n == len(rest) - 1:
+            i |= G_SNAKE_LAST
+        b.append((i * 2 | d) & 0xFF)
+    if len(rest) == 0:
+        b[2] |= G_SNAKE_LAST * 2
+    # First command holds 7 index bytes after the command byte, the rest 8 each
+    b += [0] * ((7 - len(b)) % 8)
+    cmds = [((G_TRISNAKE << 24) | (b[0] << 16) | (b[1] << 8) | b[2],
+        struct.unpack(">I", bytes(b[3:7]))[0])]
+    for i in range(7, len(b), 8):
+        cmds.append(struct.unpack(">II", bytes(b[i:i + 8])))
+    return cmds
+
+def gsSPCullDisplayList(vstart, vend):
+    return (_SHIFTL(G_CULLDL, 24, 8) | _SHIFTL(vstart * 2, 0, 16), _SHIFTL(vend * 2, 0, 16))
+
+def gsSPNumLights(n):
+    return gsMoveWd(G_MW_NUMLIGHT, G_MWO_NUMLIGHT, NUML(n))
+
+def gsSPSetLights(n, name):
+    """Returns two commands, like the macro."""
+    return [gsSPNumLights(n),
+        gsDma2p(G_MOVEMEM, name, (n & 0xF) * 0x10 + 8, G_MV_LIGHT, 0x10)]
+
+def gsSPCameraWorld(cam):
+    return gsDma2p(G_MOVEMEM, cam, PLAINVTX_SIZE, G_MV_LIGHT, 0)
+
+def gsSPLookAt(la):
+    return gsDma2p(G_MOVEMEM, la, LOOKAT_SIZE, G_MV_LIGHT, 8)
+
+def gsSPOcclusionPlane(o):
+    return gsDma2p(G_MOVEMEM, o, OCCLUSIONPLANE_SIZE, G_MV_LIGHT,
+        (G_MAX_LIGHTS * 0x10) + 0x18)
+
+def gsSPFresnel(scale, offset):
+    return gsMoveWd(G_MW_FX, G_MWO_FRESNEL_SCALE,
+        ((scale & 0xFFFF) << 16) | (offset & 0xFFFF))
+
+def gsSPTexture(s, t, level, tile, on):
+    return (_SHIFTL(G_TEXTURE, 24, 8) | _SHIFTL(level, 11, 3) | _SHIFTL(tile, 8, 3)
+        | _SHIFTL(on, 1, 7), _SHIFTL(s, 16, 16) | _SHIFTL(t, 0, 16))
+
+def gsSPGeometryMode(c, s):
+    return (_SHIFTL(G_GEOMETRYMODE, 24, 8) | _SHIFTL(~c, 0, 24), s & 0xFFFFFFFF)
+
+def gsSPSetGeometryMode(word):
+    return gsSPGeometryMode(0, word)
+
+def gsSPClearGeometryMode(word):
+    return gsSPGeometryMode(word, 0)
+
+def gsSPLoadGeometryMode(word):
+    return gsSPGeometryMode(-1, word)
+
+def gsDPSetPrimColor(m, l, r, g, b, a):
+    return (_SHIFTL(G_SETPRIMCOLOR, 24, 8) | _SHIFTL(m, 8, 8) | _SHIFTL(l, 0, 8),
+        _SHIFTL(r, 24, 8) | _SHIFTL(g, 16, 8) | _SHIFTL(b, 8, 8) | _SHIFTL(a, 0, 8))
+
+def gsDPPipeSync():
+    return gs1Word(G_RDPPIPESYNC, 0)
+
+def gsDPNoOpTag(tag):
+    return (_SHIFTL(G_NOOP, 24, 8), tag & 0xFFFFFFFF)
+
+def gsSPProfilingBuffer(start, end):
+    """Returns two commands, like the macro."""
+    return [gsMoveWd(G_MW_FX, G_MWO_PROF_BUF_PTR, start),
+        gsMoveWd(G_MW_FX, G_MWO_PROF_BUF_END, end)]
+
+def gsSPProfilingSampleInterval(cycles):
+    return gsMoveWd(G_MW_FX, G_MWO_PROF_SAMPLE_INTERVAL, cycles)
+
+
+# ---------------------------------------------------------------- Data
+
+def Vtx(x, y, z, s=0, t=0, r=0xFF, g=0xFF, b=0xFF, a=0xFF, flag=0):
+    """Vtx_t; for lit vertices, r g b are the normal (signed) and a is alpha."""
+    return struct.pack(">hhhHhhBBBB", x, y, z, flag, s, t,
+        r & 0xFF, g & 0xFF, b & 0xFF, a & 0xFF)
+
+def Mtx(mf):
+    """Mtx from a 4x4 float matrix (row-major, like guMtxF2L)."""
+    ints = []
+    fracs = []
+    for i in range(4):
+        for j in range(4):
+            e = int(round(mf[i][j] * 65536.0)) & 0xFFFFFFFF
+            ints.append(e >> 16)
+            fracs.append(e & 0xFFFF)
+    return struct.pack(">16H16H", *ints, *fracs)
+
+def Vp(vscale, vtrans):
+    return struct.pack(">4h4h", *vscale, *vtrans)
+
+def Light(col, dir, size=0):
+    """Directional light."""
+    return struct.pack(">BBBBBBBBbbbbBBBB", *col, 0, *col, 0, *dir, 0, 0, 0, 0, size)
+
+def PointLight(col, pos, kc=8, kl=0, kq=0, size=0):
+    return struct.pack(">BBBBBBBBhhhBB", *col, kc, *col, kl, *pos, kq, size)
+
+def Ambient(col):
+    return struct.pack(">BBBBBBBB", *col, 0, *col, 0)
+
+def PlainVtx(x, y, z):
+    return struct.pack(">hhhh", x, y, z, 0)
+
+def OcclusionPlane(c):
+    """c is the 12 coefficients c0-c7, kx, ky, kz, kc; see cpu/occlusionplane.c."""
+    return struct.pack(">12H", *[x & 0xFFFF for x in c])
+
+def cmdsToBytes(cmds):
+    return b"".join(struct.pack(">II", w0 & 0xFFFFFFFF, w1 & 0xFFFFFFFF) for w0, w1 in cmds)
+
+def bytesToCmds(data):
+    return [struct.unpack(">II", data[i:i + 8]) for i in range(0, len(data) - 7, 8)]
@@ -0,0 +1,187 @@
+#!python3
+
+"""
+Checks the command encoders in gbi.py against the macros in gbi.h.
+
+Each case below is expanded with the gbi.h macro of the same name in a small C
+program, which is compiled and run on the host (gcc or $CC), and its words are
+compared with what the gbi.py function returns for the same arguments. Every
+gs* function in gbi.py must have at least one case here, so a new encoder can't
+be added without being checked.
+
+Usage:
+python3 gbi_test.py
+make test
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+import gbi
+
+# Addresses are plain integers, so that the macros' (unsigned int) casts give
+# the same value on a 64-bit host.
+SEG_ADDR = 0x06001230
+K0_ADDR = 0x80123450
+
+CASES = [
+    ("gs1Word", [gbi.G_ENDDL, 0x123456]),
+    ("gsDma1p", [gbi.G_DL, SEG_ADDR, 0x80, gbi.G_DL_NOPUSH]),
+    ("gsDma2p", [gbi.G_MOVEMEM, K0_ADDR, 0x18, gbi.G_MV_LIGHT, 0xA8]),
+    ("gsSPNoOp", []),
+    ("gsMoveWd", [gbi.G_MW_SEGMENT, 0x18, K0_ADDR]),
+    ("gsSPMatrix", [K0_ADDR, gbi.G_MTX_MODEL | gbi.G_MTX_LOAD | gbi.G_MTX_NOPUSH]),
+    ("gsSPMatrix", [K0_ADDR, gbi.G_MTX_VIEWPROJECTION | gbi.G_MTX_MUL | gbi.G_MTX_PUSH]),
+    ("gsSPVertex", [SEG_ADDR, 32, 0]),
+    ("gsSPVertex", [SEG_ADDR, 7, 49]),
+    ("gsSPViewport", [K0_ADDR]),
+    ("gsSPDisplayListHint", [SEG_ADDR, 5]),
+    ("gsSPDisplayListHint", [SEG_ADDR, 21]),
+    ("gsSPBranchListHint", [SEG_ADDR, 22]),
+    ("gsSPEndDisplayListHint", [5]),
+    ("gsSPEndDisplayListHint", [42]),
+    ("gsSPDisplayList", [SEG_ADDR]),
+    ("gsSPBranchList", [SEG_ADDR]),
+    ("gsSPEndDisplayList", []),
+    ("gsSP1Triangle", [0, 1, 2, 0]),
+    ("gsSP1Triangle", [3, 55, 17, 1]),
+    ("gsSP1Triangle", [3, 55, 17, 2]),
+    ("gsSP2Triangles", [0, 1, 2, 0, 2, 1, 3, 0]),
+    ("gsSP2Triangles", [10, 11, 12, 2, 53, 54, 55, 1]),
+    ("gsSPTriSnake", [0, 1, 2, 3, gbi.G_SNAKE_RIGHT, 4, gbi.G_SNAKE_LEFT,
+        5, gbi.G_SNAKE_RIGHT, 6 | gbi.G_SNAKE_LAST, gbi.G_SNAKE_LEFT]),
+    ("gsSPContinueSnake", [7, 0, 8, 1, 9, 0, 10, 1, 11, 0, 12, 1, 13, 0,
+        14 | gbi.G_SNAKE_LAST, 1]),
+    ("gsSPCullDisplayList", [0, 7]),
+    ("gsSPCullDisplayList", [12, 55]),
+    ("gsSPNumLights", [3]),
+    ("gsSPSetLights", [2, K0_ADDR]),
+    ("gsSPCameraWorld", [K0_ADDR]),
+    ("gsSPLookAt", [K0_ADDR]),
+    ("gsSPOcclusionPlane", [K0_ADDR]),
+    ("gsSPFresnel", [0x1234, -0x567]),
+    ("gsSPTexture", [0xFFFF, 0x8000, 0, 3, gbi.G_ON]),
+    ("gsSPGeometryMode", [gbi.G_FOG | gbi.G_LIGHTING, gbi.G_ZBUFFER | gbi.G_SHADE]),
+    ("gsSPSetGeometryMode", [gbi.G_CULL_BACK | gbi.G_SHADING_SMOOTH]),
+    ("gsSPClearGeometryMode", [gbi.G_TEXTURE_GEN | gbi.G_PACKED_NORMALS]),
+    ("gsSPLoadGeometryMode", [gbi.G_ZBUFFER | gbi.G_SHADE | gbi.G_LIGHTING]),
+    ("gsDPSetPrimColor", [0, 0x80, 0x12, 0x34, 0x56, 0x78]),
+    ("gsDPPipeSync", []),
+    ("gsDPNoOpTag", [0x12345678]),
+    ("gsSPProfilingBuffer", [0x00380000, 0x00390000]),
+    ("gsSPProfilingSampleInterval", [6250]),
+]
+
+# Macros which take a struct by name rather than its address.
+BY_NAME = {"gsSPSetLights": 1}
+
+C_PRELUDE = """
+#include <stdint.h>
+#include <stdio.h>
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef float f32;
+#include "gbi.h"
+
+_Static_assert(sizeof(Mtx) == 0x40, "Mtx");
+
+int main(void){
+    Gfx cmds[] = {
+"""
+
+C_POSTLUDE = """
+    };
+    for(unsigned i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i){
+        printf("%08x %08x\\n", cmds[i].words.w0, cmds[i].words.w1);
+    }
+    return 0;
+}
+"""
+
+# gbi.h includes these libultra headers; only _SHIFTL / _SHIFTR and the yield
+# data size check are needed.
+STUB_MBI = """
+#define _SHIFTL(v, s, w) ((unsigned int)(((unsigned int)(v) & ((0x01 << (w)) - 1)) << (s)))
+#define _SHIFTR(v, s, w) ((unsigned int)(((unsigned int)(v) >> (s)) & ((0x01 << (w)) - 1)))
+"""
+STUB_SPTASK = "#define OS_YIELD_DATA_SIZE 0xC00\n"
+
+# gbi.h is written for the N64's ILP32 ABI. On an LP64 host, long is 8 bytes,
+# which would make e.g. sizeof(Mtx) 0x80, so the copy compiled here uses int.
+RE_LONG = re.compile(r"(?<!long )\blong\b( int\b)?(?! long)")
+
+
+def pyCmds(name, args):
+    r = getattr(gbi, name)(*args)
+    return r if isinstance(r, list) else [r]
+
+def cArgs(name, args):
+    s = []
+    for i, a in enumerate(args):
+        if BY_NAME.get(name) == i:
+            s.append(f"*(Gfx*)0x{a:08X}")
+        else:
+            s.append(str(a))
+    return ", ".join(s)
+
+def cCmds(cases):
+    """Returns the (w0, w1) words of all the cases' macros, in order."""
+    repo = os.path.dirname(os.path.abspath(__file__))
+    cc = os.environ.get("CC", "gcc")
+    with tempfile.TemporaryDirectory() as tmp:
+        os.mkdir(os.path.join(tmp, "ultra64"))
+        with open(os.path.join(tmp, "ultra64", "mbi.h"), "w") as f:
+            f.write(STUB_MBI)
+        with open(os.path.join(tmp, "ultra64", "sptask.h"), "w") as f:
+            f.write(STUB_SPTASK)
+        src = os.path.join(tmp, "gbi_test.c")
+        exe = os.path.join(tmp, "gbi_test")
+        with open(src, "w") as f:
+            f.write(C_PRELUDE)
+            for name, args in cases:
+                f.write(f"        {name}({cArgs(name, args)}),\n")
+            f.write(C_POSTLUDE)
+        with open(os.path.join(repo, "gbi.h")) as f:
+            gbih = RE_LONG.sub("int", f.read())
+        with open(os.path.join(tmp, "gbi.h"), "w") as f:
+            f.write(gbih)
+        subprocess.run([cc, "-w", "-I" + tmp, "-o", exe, src], check=True)
+        out = subprocess.run([exe], check=True, capture_output=True, text=True).stdout
+    return [tuple(int(w, 16) for w in l.split()) for l in out.splitlines()]
+
+def main():
+    covered = {name for name, _ in CASES}
+    missing = sorted(n for n in dir(gbi) if n.startswith("gs")
+        and callable(getattr(gbi, n)) and n not in covered)
+    expected = cCmds(CASES)
+    fails = 0
+    i = 0
+    for name, args in CASES:
+        got = [(w0 & 0xFFFFFFFF, w1 & 0xFFFFFFFF) for w0, w1 in pyCmds(name, args)]
+        exp = expected[i:i + len(got)]
+        i += len(got)
+        if got != exp:
+            fails += 1
+            print(f"FAIL {name}({', '.join(str(a) for a in args)}):")
+            print("    gbi.h:  " + " ".join(f"({w0:08X}, {w1:08X})" for w0, w1 in exp))
+            print("    gbi.py: " + " ".join(f"({w0:08X}, {w1:08X})" for w0, w1 in got))
+    if i != len(expected):
+        print(f"FAIL: gbi.h produced {len(expected)} commands, gbi.py {i}")
+        fails += 1
+    for n in missing:
+        print(f"FAIL: no case for gbi.{n}")
+        fails += 1
+    print(f"{len(CASES)} cases, {fails} failures")
+    return 1 if fails else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,641 @@
+#!python3
+
+"""
+Performance regression suite for F3DEX3.
+
+Runs a set of canonical display lists through each built microcode on the
+simulated RSP (rspsim.py), measures the same codepaths as the cycle count table
+in docs/Documentation/Performance.md, and prints the table in the same format.
+The results are compared against a checked-in baseline (perf_baseline.json); if
+any path got slower in any microcode, the differences are listed and the exit
+code is nonzero.
+
+Usage:
+python3 perf_suite.py                    # All microcodes found in build/
+python3 perf_suite.py F3DEX3_BrZ F3DEX3_BrZ_NOC
+python3 perf_suite.py --update-baseline  # After an intended change
+make perf                                # Build everything, then run this
+
+Each measurement runs its own task, so that the state (lights, overlay loaded,
+etc.) is the same every time. Command costs are taken between successive
+arrivals at run_next_DL_command; the dispatch cost (measured with SPNOOP) is
+subtracted so the numbers are for the handler like in the hand-counted table.
+Vertex pair costs are the slope between two batch sizes, so they exclude the
+vertex DMA and the per-command setup; the DMA wait is measured separately, as the
+difference to the same load with an instant DMA. If a scene doesn't reach the
+codepath it is for, the suite stops with an error rather than recording the row
+as unmeasurable; only features a microcode doesn't have (occlusion plane in NOC)
+are left out of the table and the baseline.
+
+Before measuring, each microcode also runs a BVH from bvh.py over random
+objects, and the object display lists it executes are checked against a walk
+of the same tree on the host. The CFG_PROFILING_TAGS microcodes also run a few
+tags, and their records in RDRAM are checked against the simulated run, and
+the CFG_PROFILING_SAMPLES microcodes check their samples the same way.
+"""
+
+import argparse
+import copy
+import json
+import os
+import random
+import sys
+
+import bvh
+import gbi
+import rspsim
+
+DATA_ADDR = 0x00100000
+DL_ADDR = 0x00180000
+
+BASELINE_FILE = "perf_baseline.json"
+
+# Tri geometry, in model space. The VP matrix scales by 1/256, so the screen
+# clip boundary is at +/-256 and the scaled clip boundary (clip ratio 2) is at
+# +/-512.
+TRI_NORMAL = [(-50, -50, 0), (50, -50, 0), (0, 50, 0)]
+TRI_OFFSCREEN = [(400, -50, 0), (500, -50, 0), (450, 50, 0)]
+TRI_CLIP = [(-50, -50, 0), (700, -50, 0), (0, 50, 0)]
+# Collinear but distinct vertices may not be exactly collinear after the
+# viewport transform, so the degenerate tri repeats a vertex.
+TRI_DEGENERATE = [(-50, -50, 0), (50, 50, 0), (50, 50, 0)]
+
+TRI_KINDS = ["offscreen", "clip", "backface", "degenerate", "occluded", "draw"]
+
+VTX_SMALL = 4
+VTX_LARGE = 16
+VTX_DMA_WAIT_COUNTS = [16, 32, 56]
+
+OCCLUDE_EVERYTHING = [0, 0, 0, 0, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0, 0, 0, 0]
+
+# BVH check: objects placed so that some are offscreen. Coordinates are odd, so
+# that no corner is exactly on a screen edge (+/-256).
+BVH_OBJECTS = 60
+BVH_EXTENT = 700
+BVH_SEED = 1
+
+# Tag records check, for the CFG_PROFILING_TAGS microcodes
+PROF_TAG_RECORD_SIZE = 16
+PROF_TAGS_RECORDED = 3
+
+# Samples check, for the CFG_PROFILING_SAMPLES microcodes
+PROF_SAMPLE_SIZE = 8
+PROF_SAMPLE_INTERVAL = 300
+PROF_SAMPLE_DEFAULT_INTERVAL = 6250
+PROF_SAMPLES_CALLS = 8
+PROF_SAMPLES_MAX = 200
+PROF_SAMPLES_FULL = 4
+
+
+class Scene:
+    """A display list plus the data it references, placed in RDRAM."""
+    def __init__(self):
+        self.data = bytearray()
+        self.cmds = []
+
+    def add(self, b):
+        while len(self.data) % 16 != 0:
+            self.data.append(0)
+        addr = DATA_ADDR + len(self.data)
+        self.data += b
+        return addr
+
+    def cmd(self, c):
+        """Appends one or more commands; returns the address of the first."""
+        addr = DL_ADDR + 8 * len(self.cmds)
+        if isinstance(c, list):
+            self.cmds += c
+        else:
+            self.cmds.append(c)
+        return addr
+
+    def load(self, rsp):
+        rsp.writeRdram(DATA_ADDR, bytes(self.data))
+        rsp.writeRdram(DL_ADDR, gbi.cmdsToBytes(self.cmds + [gbi.gsSPEndDisplayList()]))
+
+
+def identity(scale=1.0):
+    return [[scale if i == j else 0.0 for j in range(4)] for i in range(4)]
+
+
+def baseScene(geometryMode, texture=True):
+    s = Scene()
+    vp = s.add(gbi.Vp((320 * 2, 240 * 2, 0x1FF, 0), (320 * 2, 240 * 2, 0x1FF, 0)))
+    vpMtx = identity(1.0 / 256.0)
+    vpMtx[3][3] = 1.0
+    s.cmd(gbi.gsSPViewport(vp))
+    s.cmd(gbi.gsSPMatrix(s.add(gbi.Mtx(vpMtx)),
+        gbi.G_MTX_VIEWPROJECTION | gbi.G_MTX_LOAD | gbi.G_MTX_NOPUSH))
+    s.cmd(gbi.gsSPMatrix(s.add(gbi.Mtx(identity())),
+        gbi.G_MTX_MODEL | gbi.G_MTX_LOAD | gbi.G_MTX_NOPUSH))
+    s.cmd(gbi.gsSPTexture(0x8000, 0x8000, 0, 0, gbi.G_ON if texture else gbi.G_OFF))
+    s.cmd(gbi.gsSPLoadGeometryMode(geometryMode))
+    return s
+
+
+class Runner:
+    """Runs scenes on one microcode and extracts measurements."""
+    def __init__(self, name, buildDir, timing):
+        code, data, syms = rspsim.loadUcode(name, buildDir)
+        self.name = name
+        self.rsp = rspsim.RSP(code, data, syms, timing)
+        # The occlusion plane DMEM exists in NOC builds too, it's just unused
+        self.hasOcclusionPlane = "_NOC" not in name
+        self.dispatch = None
+
+    def run(self, scene, watch=None):
+        scene.load(self.rsp)
+        return self.rsp.runTask(DL_ADDR, watch=watch)
+
+    @staticmethod
+    def command(res, addr):
+        for c in res.commands:
+            if c.addr == addr:
+                return c
+        raise RuntimeError(f"Command at {addr:08X} was not executed")
+
+    @staticmethod
+    def firstHit(res, label, c):
+        for t in res.labelHits[label]:
+            if t >= c.start and t < c.start + c.cycles:
+                return t
+        return None
+
+    def cmdCost(self, scene, addr):
+        res = self.run(scene)
+        return self.command(res, addr).cycles - self.dispatch
+
+    # ------------------------------------------------------------ Commands
+    def measureDispatch(self):
+        s = baseScene(0)
+        s.cmd(gbi.gsSPNoOp())
+        addr = s.cmd(gbi.gsSPNoOp())
+        s.cmd(gbi.gsSPNoOp())
+        res = self.run(s)
+        self.dispatch = self.command(res, addr).cycles
+        return self.dispatch
+
+    def measureSmallRdp(self):
+        s = baseScene(0)
+        addr = s.cmd(gbi.gsDPSetPrimColor(0, 0, 0x80, 0x80, 0x80, 0xFF))
+        return self.cmdCost(s, addr)
+
+    def measureOcclusionPlaneSwitch(self):
+        if not self.hasOcclusionPlane:
+            return None
+        s = baseScene(0)
+        addr = s.cmd(gbi.gsSPOcclusionPlane(s.add(gbi.OcclusionPlane(OCCLUDE_EVERYTHING))))
+        s.cmd(gbi.gsSPNoOp())
+        return self.cmdCost(s, addr)
+
+    def measureDlCall(self, hint):
+        """
+        SPDisplayList to a 2 command display list, including the wait for the
+        fetch of its commands: 21 commands (the whole input buffer) without a
+        hint, 2 with.
+        """
+        s = baseScene(0)
+        target = s.add(gbi.cmdsToBytes([gbi.gsSPNoOp(), gbi.gsSPEndDisplayList()]))
+        if hint:
+            addr = s.cmd(gbi.gsSPDisplayListHint(target, 2))
+        else:
+            addr = s.cmd(gbi.gsSPDisplayList(target))
+        return self.cmdCost(s, addr)
+
+    # ------------------------------------------------------------ BVH
+    def checkBvh(self):
+        """
+        Runs a BVH built by bvh.py and checks that exactly the objects whose
+        nodes are not offscreen are drawn, in order. Raises if not.
+        """
+        rng = random.Random(BVH_SEED)
+        objects = []
+        for n in range(BVH_OBJECTS):
+            bmin = [rng.randrange(-BVH_EXTENT, BVH_EXTENT) | 1 for a in range(3)]
+            bmax = [x + (rng.randrange(10, 200) | 1) - 1 for x in bmin]
+            objects.append(bvh.Object(f"obj{n}", bmin, bmax))
+        root = bvh.buildBvh(objects)
+        s = baseScene(0, texture=False)
+        objectAddrs = {o.name: s.add(gbi.cmdsToBytes([gbi.gsSPNoOp(), gbi.gsSPEndDisplayList()]))
+            for o in objects}
+        base = DATA_ADDR + ((len(s.data) + 15) & ~15)
+        data, rootAddr = bvh.encodeBvh(root, base, objectAddrs)
+        if s.add(data) != base:
+            raise RuntimeError("BVH not placed at its base address")
+        s.cmd(gbi.gsSPDisplayList(rootAddr))
+        res = self.run(s)
+        names = {a: name for name, a in objectAddrs.items()}
+        got = [names[c.addr] for c in res.commands if c.addr in names]
+
+        def offscreen(node):
+            # Identity model matrix, VP scales by 1/256 with w = 1
+            for a in range(2):
+                if all(c[a] < -256 for c in node.corners()) or all(c[a] > 256 for c in node.corners()):
+                    return True
+            return False
+        def walk(node):
+            if offscreen(node):
+                return []
+            ret = []
+            for c in node.calls():
+                ret += walk(c) if isinstance(c, bvh.Node) else [c.name]
+            return ret
+        expected = walk(root)
+        if got != expected:
+            raise RuntimeError(f"BVH drew {got}, expected {expected}")
+        if len(expected) == 0 or len(expected) == len(objects):
+            raise RuntimeError("BVH check culled nothing or everything")
+
+    # ------------------------------------------------------------ Tag records
+    def checkProfTags(self):
+        """
+        For a CFG_PROFILING_TAGS microcode, runs tags around vertex and tri
+        commands and checks the records written to the profiling buffer against
+        the simulated run: one per nonzero tag until the buffer is full, with
+        the clock and the counters at each tag. Raises if not.
+        """
+        if "G_NOOP_handler" not in self.rsp.syms:
+            return
+        geom = gbi.G_ZBUFFER | gbi.G_SHADE | gbi.G_SHADING_SMOOTH
+        s = baseScene(geom)
+        buf = s.add(bytes((PROF_TAGS_RECORDED + 1) * PROF_TAG_RECORD_SIZE))
+        s.cmd(gbi.gsSPProfilingBuffer(buf, buf + PROF_TAGS_RECORDED * PROF_TAG_RECORD_SIZE))
+        verts = b"".join(gbi.Vtx(x, y, z) for x, y, z in TRI_NORMAL + TRI_OFFSCREEN)
+        tagAddrs = [s.cmd(gbi.gsDPNoOpTag(1))]
+        s.cmd(gbi.gsSPVertex(s.add(verts), 6, 0))
+        s.cmd(gbi.gsSP2Triangles(0, 1, 2, 0, 3, 4, 5, 0))
+        s.cmd(gbi.gsDPNoOpTag(0))
+        tagAddrs.append(s.cmd(gbi.gsDPNoOpTag(2)))
+        s.cmd(gbi.gsSPVertex(s.add(verts), 3, 0))
+        s.cmd(gbi.gsSP1Triangle(0, 1, 2, 0))
+        tagAddrs.append(s.cmd(gbi.gsDPNoOpTag(3)))
+        s.cmd(gbi.gsDPNoOpTag(4))  # Buffer full
+        res = self.run(s)
+        recs = [[self.rsp.readRdram32(buf + PROF_TAG_RECORD_SIZE * r + 4 * i) for i in range(4)]
+            for r in range(PROF_TAGS_RECORDED + 1)]
+        if [r[0] for r in recs] != [1, 2, 3, 0]:
+            raise RuntimeError(f"Tag records have tags {[r[0] for r in recs]}, expected [1, 2, 3, 0]")
+        cmds = [self.command(res, a) for a in tagAddrs]
+        # The offscreen tri is culled, so one tri is drawn after each tag
+        for i, (vtx, rdpTris, rspTris) in enumerate([(6, 1, 2), (3, 1, 1)]):
+            a, b = recs[i], recs[i + 1]
+            got = ((b[1] - a[1]) & 0xFFFFFF, (b[2] >> 16) - (a[2] >> 16),
+                (b[2] & 0xFFFF) - (a[2] & 0xFFFF), (b[3] >> 14) - (a[3] >> 14))
+            expected = (cmds[i + 1].start - cmds[i].start, vtx, rdpTris, rspTris)
+            if got != expected:
+                raise RuntimeError(f"Tag {a[0]} record differences (cycles, vtx, RDP tris, "
+                    + f"RSP tris) {got}, expected {expected}")
+
+    def checkProfSamples(self):
+        """
+        For a CFG_PROFILING_SAMPLES microcode, runs a display list which calls
+        another with the profiling buffer set, and checks that every sample is
+        of a command which was run, with the DL stack depth it was run at, that
+        there is one per interval, and that recording stops when the buffer is
+        full. Raises if not.
+        """
+        if "profSampleInterval" not in self.rsp.syms:
+            return
+        geom = gbi.G_ZBUFFER | gbi.G_SHADE | gbi.G_SHADING_SMOOTH
+        verts = b"".join(gbi.Vtx(x, y, z) for x, y, z in TRI_NORMAL + TRI_CLIP)
+        for capacity in [PROF_SAMPLES_MAX, PROF_SAMPLES_FULL]:
+            s = baseScene(geom)
+            vtxAddr = s.add(verts)
+            obj = s.add(gbi.cmdsToBytes([gbi.gsSPVertex(vtxAddr, 6, 0),
+                gbi.gsSP2Triangles(0, 1, 2, 0, 3, 4, 5, 0), gbi.gsSPEndDisplayList()]))
+            buf = s.add(bytes((capacity + 1) * PROF_SAMPLE_SIZE))
+            s.cmd(gbi.gsSPProfilingBuffer(buf, buf + capacity * PROF_SAMPLE_SIZE))
+            s.cmd(gbi.gsSPProfilingSampleInterval(PROF_SAMPLE_INTERVAL))
+            for n in range(PROF_SAMPLES_CALLS):
+                s.cmd(gbi.gsSPDisplayList(obj))
+                s.cmd(gbi.gsSPVertex(vtxAddr, 3, 0))
+                s.cmd(gbi.gsSP1Triangle(0, 1, 2, 0))
+            res = self.run(s)
+            samples = []
+            for i in range(capacity + 1):
+                addr = self.rsp.readRdram32(buf + PROF_SAMPLE_SIZE * i)
+                if addr == 0:
+                    break
+                samples.append((addr, self.rsp.readRdram32(buf + PROF_SAMPLE_SIZE * i + 4)))
+            run = set(c.addr for c in res.commands)
+            for addr, depth in samples:
+                expected = 4 if addr >= obj and addr < obj + 24 else 0
+                if addr not in run or depth != expected:
+                    raise RuntimeError(f"Sample of {addr:08X} at depth {depth}, "
+                        + f"which was not run at that depth")
+            if capacity == PROF_SAMPLES_FULL:
+                if len(samples) != capacity:
+                    raise RuntimeError(f"{len(samples)} samples in a buffer of {capacity}")
+            else:
+                # The sample at the first command is before the buffer is set,
+                # and the next is one default interval later; the last chance
+                # to take one is when the last command starts
+                first = res.commands[0].start + PROF_SAMPLE_DEFAULT_INTERVAL
+                expected = (res.commands[-1].start - first) // PROF_SAMPLE_INTERVAL + 1
+                if abs(len(samples) - expected) > 1:
+                    raise RuntimeError(f"{len(samples)} samples, expected {expected}")
+
+    # ------------------------------------------------------------ Tris
+    def triScene(self, kind):
+        if kind == "occluded" and not self.hasOcclusionPlane:
+            return None
+        geom = gbi.G_ZBUFFER | gbi.G_SHADE | gbi.G_SHADING_SMOOTH
+        if kind == "backface":
+            geom |= gbi.G_CULL_BOTH
+        s = baseScene(geom)
+        if kind == "occluded":
+            s.cmd(gbi.gsSPOcclusionPlane(s.add(gbi.OcclusionPlane(OCCLUDE_EVERYTHING))))
+        pos = {"offscreen": TRI_OFFSCREEN, "clip": TRI_CLIP,
+            "degenerate": TRI_DEGENERATE}.get(kind, TRI_NORMAL)
+        verts = b""
+        for k in range(2):
+            for n, (x, y, z) in enumerate(pos):
+                verts += gbi.Vtx(x + 4 * k, y, z, n * 0x200, k * 0x200, 0xFF, 0x80 * k, 0x40 * n, 0xFF)
+        s.cmd(gbi.gsSPVertex(s.add(verts), 6, 0))
+        s.cmd(gbi.gsSPNoOp())
+        return s
+
+    def measureTri(self, kind, first):
+        s = self.triScene(kind)
+        if s is None:
+            return None
+        if first:
+            addr = s.cmd(gbi.gsSP2Triangles(0, 1, 2, 0, 3, 4, 5, 0))
+        else:
+            addr = s.cmd(gbi.gsSP1Triangle(0, 1, 2, 0))
+        if kind == "clip":
+            res = self.run(s, ["ovl234_clipmisc_entrypoint"])
+            c = self.command(res, addr)
+            t = self.firstHit(res, "ovl234_clipmisc_entrypoint", c)
+            if t is None:
+                raise RuntimeError("Tri did not reach the clipping code")
+            return t - c.start - self.dispatch
+        if first:
+            # The first tri of a tri2 returns to G_TRI1_handler for the second
+            res = self.run(s, ["G_TRI1_handler"])
+            c = self.command(res, addr)
+            hits = [t for t in res.labelHits["G_TRI1_handler"]
+                if t >= c.start and t < c.start + c.cycles]
+            if len(hits) < 2:
+                raise RuntimeError("Tri2 did not reach its second tri")
+            return hits[1] - c.start - self.dispatch
+        res = self.run(s)
+        return self.command(res, addr).cycles - self.dispatch
+
+    def measureSnake(self, numTris):
+        s = baseScene(gbi.G_ZBUFFER | gbi.G_SHADE | gbi.G_SHADING_SMOOTH)
+        verts = b""
+        for n in range(numTris + 2):
+            verts += gbi.Vtx(400 + 10 * (n // 2), 50 * (n % 2), 0)
+        s.cmd(gbi.gsSPVertex(s.add(verts), numTris + 2, 0))
+        s.cmd(gbi.gsSPNoOp())
+        addr = s.cmd(gbi.triSnake((0, 1, 2),
+            [(n, gbi.G_SNAKE_LEFT if n % 2 else gbi.G_SNAKE_RIGHT) for n in range(3, numTris + 2)]))
+        return self.command(self.run(s), addr).cycles
+
+    # ------------------------------------------------------------ Vertices
+    def vtxScene(self, count, geom, numLights=0, pointLights=False):
+        s = baseScene(geom, texture=False)
+        if geom & gbi.G_LIGHTING:
+            lights = b""
+            for n in range(numLights):
+                if pointLights:
+                    lights += gbi.PointLight((0x80, 0x60, 0x40), (100 * n - 400, 300, 200),
+                        kc=8, kl=0x20, kq=0x10, size=2)
+                else:
+                    d = [(0x49, 0x49, 0x49), (-0x49, 0x49, 0x49), (0, 0, 0x7F)][n % 3]
+                    lights += gbi.Light((0x80, 0x60, 0x40), d, size=2)
+            lights += gbi.Ambient((0x20, 0x20, 0x20))
+            n = numLights | (gbi.ENABLE_POINT_LIGHTS if pointLights else 0)
+            s.cmd(gbi.gsSPCameraWorld(s.add(gbi.PlainVtx(0, 0, 1000))))
+            s.cmd(gbi.gsSPSetLights(n, s.add(lights)))
+            s.cmd(gbi.gsSPFresnel(0x4000, 0x1000))
+        verts = b""
+        for n in range(count):
+            x = 10 * (n % 8) - 40
+            y = 10 * (n // 8) - 40
+            if geom & gbi.G_LIGHTING:
+                verts += gbi.Vtx(x, y, 0, 0, 0, 0x10, -0x20, 0x78, 0xC0)
+            else:
+                verts += gbi.Vtx(x, y, 0, 0, 0, 0x80, 0x80, 0x80, 0xFF)
+        vtx = s.add(verts)
+        addr = s.cmd(gbi.gsSPVertex(vtx, count, 0))
+        return s, addr, vtx
+
+    def vtxLoopCycles(self, count, geom, numLights, pointLights):
+        s, addr, _ = self.vtxScene(count, geom, numLights, pointLights)
+        res = self.run(s, ["vtx_after_dma", "vtx_epilogue"])
+        c = self.command(res, addr)
+        start = self.firstHit(res, "vtx_after_dma", c)
+        end = self.firstHit(res, "vtx_epilogue", c)
+        if start is None or end is None:
+            raise RuntimeError("Vertex command did not reach the expected labels")
+        return end - start
+
+    def measureVtxPair(self, geom, numLights=0, pointLights=False):
+        a = self.vtxLoopCycles(VTX_SMALL, geom, numLights, pointLights)
+        b = self.vtxLoopCycles(VTX_LARGE, geom, numLights, pointLights)
+        return tidy((b - a) / ((VTX_LARGE - VTX_SMALL) / 2))
+
+    def measureVtxBeforeDma(self):
+        """Up to the call of the DMA routine, like the hand count."""
+        s, addr, _ = self.vtxScene(8, 0)
+        res = self.run(s, ["dma_read_write"])
+        c = self.command(res, addr)
+        t = self.firstHit(res, "dma_read_write", c)
+        if t is None:
+            raise RuntimeError("Vertex DMA not found")
+        return t - c.start - self.dispatch
+
+    def measureVtxDmaWait(self, count):
+        """
+        Cycles the vertex command waits for its DMA, i.e. how much a load of
+        this many vertices would gain if the DMA were overlapped with the
+        vertex loop: the difference to the same load with an instant DMA.
+        """
+        s, addr, _ = self.vtxScene(count, gbi.G_SHADE)
+        normal = self.command(self.run(s), addr).cycles
+        timing = self.rsp.timing
+        self.rsp.timing = copy.copy(timing)
+        self.rsp.timing.dmaSetup = 0
+        self.rsp.timing.dmaBytesPerCycle = 1e9
+        try:
+            instant = self.command(self.run(s), addr).cycles
+        finally:
+            self.rsp.timing = timing
+        return normal - instant
+
+    def measureLightXfrm(self, numLights):
+        s, addr, _ = self.vtxScene(2, gbi.G_LIGHTING | gbi.G_SHADE, numLights)
+        res = self.run(s, ["xfrm_dir_lights", "ltbasic_setup_after_xfrm"])
+        c = self.command(res, addr)
+        start = self.firstHit(res, "xfrm_dir_lights", c)
+        end = self.firstHit(res, "ltbasic_setup_after_xfrm", c)
+        if start is None or end is None:
+            raise RuntimeError("Vertex command did not transform the lights")
+        return end - start
+
+
+def tidy(x):
+    return int(x) if x == int(x) else round(x, 1)
+
+
+def lts(n, kind):
+    return f"{n} {kind} lt" + ("" if n == 1 else "s")
+
+
+def measureAll(r):
+    """
+    Returns a list of (row name, value), in table order. The value is None only
+    if the microcode does not support the feature; a measurement which fails
+    raises instead.
+    """
+    rows = []
+    rows.append(("Command dispatch", r.measureDispatch()))
+    rows.append(("Small RDP command", r.measureSmallRdp()))
+    rows.append(("Occlusion plane switch", r.measureOcclusionPlaneSwitch()))
+    rows.append(("DL call, no hint", r.measureDlCall(False)))
+    rows.append(("DL call, hint", r.measureDlCall(True)))
+    second = {}
+    first = {}
+    for kind in TRI_KINDS:
+        second[kind] = r.measureTri(kind, False)
+        first[kind] = r.measureTri(kind, True)
+        rows.append((f"Only/2nd tri to {kind}", second[kind]))
+        rows.append((f"1st tri to {kind}", first[kind]))
+    perTri = tidy((r.measureSnake(12) - r.measureSnake(4)) / 8)
+    rows.append(("Tri snake vs 1st tri", tidy(perTri - first["offscreen"])))
+    rows.append(("Tri snake vs 2nd tri", tidy(perTri - second["offscreen"])))
+    rows.append(("Vtx before DMA start", r.measureVtxBeforeDma()))
+    for n in VTX_DMA_WAIT_COUNTS:
+        rows.append((f"Vtx DMA wait, {n} vtx", r.measureVtxDmaWait(n)))
+    L = gbi.G_LIGHTING | gbi.G_SHADE
+    rows.append(("Vtx pair, no lighting", r.measureVtxPair(gbi.G_SHADE)))
+    for n in range(gbi.G_MAX_LIGHTS + 1):
+        rows.append((f"Vtx pair, {lts(n, 'dir')}", r.measureVtxPair(L, n)))
+    for n in range(gbi.G_MAX_LIGHTS + 1):
+        rows.append((f"Vtx pair, {lts(n, 'point')}", r.measureVtxPair(L, n, True)))
+    basic = r.measureVtxPair(L, 1)
+    adv = r.measureVtxPair(L, 1, True)
+    for name, flag in [("Packed normals", gbi.G_PACKED_NORMALS),
+            ("Light-to-alpha", gbi.G_LIGHTTOALPHA), ("Ambient occlusion", gbi.G_AMBOCCLUSION)]:
+        rows.append((f"{name}, ltbasic", tidy(r.measureVtxPair(L | flag, 1) - basic)))
+        rows.append((f"{name}, ltadv", tidy(r.measureVtxPair(L | flag, 1, True) - adv)))
+    # Specular and Fresnel both need the ltadv codepath, so they are relative
+    # to it; the per light costs are on top of ltadv's own cost per light,
+    # which is measured with Fresnel alone.
+    S = L | gbi.G_LIGHTING_SPECULAR
+    F = L | gbi.G_FRESNEL_COLOR
+    adv0 = r.measureVtxPair(L, 0, True)
+    spec0 = r.measureVtxPair(S, 0, True)
+    fres0 = r.measureVtxPair(F, 0, True)
+    rows.append(("Specular or fresnel", tidy(spec0 - adv0)))
+    rows.append(("+ Fresnel", tidy(r.measureVtxPair(S | F, 0, True) - spec0)))
+    rows.append(("+ Specular per dir lt", tidy((r.measureVtxPair(S, 1) - spec0)
+        - (r.measureVtxPair(F, 1) - fres0))))
+    rows.append(("+ Specular per point lt", tidy((r.measureVtxPair(S, 1, True) - spec0)
+        - (r.measureVtxPair(F, 1, True) - fres0))))
+    for n in range(gbi.G_MAX_LIGHTS + 1):
+        rows.append((f"Light dir xfrm, {lts(n, 'dir')}", r.measureLightXfrm(n)))
+    return rows
+
+
+def findUcodes(buildDir):
+    names = []
+    if os.path.isdir(buildDir):
+        for d in sorted(os.listdir(buildDir)):
+            if os.path.isfile(f"{buildDir}/{d}/{d}.code") and os.path.isfile(f"{buildDir}/{d}/{d}.sym"):
+                names.append(d)
+    return names
+
+
+def formatTable(names, results):
+    rowNames = [k for k, _ in results[names[0]]]
+    cols = [[""] + rowNames]
+    for name in names:
+        vals = dict(results[name])
+        cols.append([name] + ["Can't" if vals[k] is None else str(vals[k]) for k in rowNames])
+    widths = [max(len(x) for x in col) + 1 for col in cols]
+    lines = []
+    for i in range(len(rowNames) + 1):
+        lines.append("|" + "|".join(" " + col[i].ljust(w) for col, w in zip(cols, widths)) + "|")
+        if i == 0:
+            lines.append("|" + "|".join("-" * (w + 1) for w in widths) + "|")
+    return "\n".join(lines)
+
+
+def compare(names, results, baseline, tolerance):
+    """Returns a list of regression messages."""
+    msgs = []
+    for name in names:
+        if name not in baseline:
+            print(f"Note: {name} is not in the baseline", file=sys.stderr)
+            continue
+        vals = dict(results[name])
+        for row, old in baseline[name].items():
+            new = vals.get(row)
+            if new is None:
+                msgs.append(f"{name}: {row}: no longer measurable (was {old})")
+            elif new > old + tolerance:
+                msgs.append(f"{name}: {row}: {old} -> {new} (+{tidy(new - old)})")
+            elif new < old:
+                print(f"Improved: {name}: {row}: {old} -> {new}", file=sys.stderr)
+    return msgs
+
+
+def main():
+    parser = argparse.ArgumentParser(description="F3DEX3 cycle count regression suite")
+    parser.add_argument("ucodes", nargs="*", help="Microcodes to test (default: all in the build dir)")
+    parser.add_argument("--build-dir", default="build")
+    parser.add_argument("--baseline", default=BASELINE_FILE)
+    parser.add_argument("--update-baseline", action="store_true",
+        help="Write the results as the new baseline instead of comparing")
+    parser.add_argument("--tolerance", type=float, default=0,
+        help="Cycles a path may get slower before it is a regression")
+    rspsim.makeTimingArgs(parser)
+    args = parser.parse_args()
+
+    names = args.ucodes if len(args.ucodes) > 0 else findUcodes(args.build_dir)
+    if len(names) == 0:
+        print(f"No microcodes found in {args.build_dir}; build them first", file=sys.stderr)
+        sys.exit(2)
+    timing = rspsim.timingFromArgs(args)
+    results = {}
+    for name in names:
+        print(f"Measuring {name}...", file=sys.stderr)
+        r = Runner(name, args.build_dir, timing)
+        r.checkBvh()
+        r.checkProfTags()
+        r.checkProfSamples()
+        results[name] = measureAll(r)
+    print(formatTable(names, results))
+
+    baseline = {}
+    if os.path.isfile(args.baseline):
+        with open(args.baseline, "r") as f:
+            baseline = json.load(f)
+    if args.update_baseline:
+        # Rows for unsupported features are left out, rather than stored as
+        # null, so a baseline row which stops being measurable is an error.
+        for name in names:
+            baseline[name] = {k: v for k, v in results[name] if v is not None}
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"Wrote {args.baseline}", file=sys.stderr)
+        return
+    if len(baseline) == 0:
+        print(f"No baseline in {args.baseline}; run with --update-baseline to create it",
+            file=sys.stderr)
+        sys.exit(2)
+    msgs = compare(names, results, baseline, args.tolerance)
+    if len(msgs) > 0:
+        print("Performance regressions:", file=sys.stderr)
+        for m in msgs:
+            print("  " + m, file=sys.stderr)
+        sys.exit(1)
+    print("No regressions", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1459 @@
+#!python3
+
+"""
+Host-side RSP simulator for F3DEX3.
+
+Loads a microcode built by the Makefile (build/<NAME>/<NAME>.code, .data, .sym),
+boots it as a graphics task on a simulated RSP, runs a display list through the
+real microcode, and reports the number of RCP cycles spent on each display list
+command. This replaces hand-counting cycles when measuring codepaths.
+
+The functional model covers every SU and VU instruction used by F3DEX3, SP DMA,
+and the DPC registers. The RDP itself is not emulated; it just consumes the
+FIFO, either instantly (default) or at a fixed number of bytes per cycle, and
+the triangles it receives are counted.
+
+The timing model is of the RSP pipeline as the hand-counted tables in
+docs/Documentation/Performance.md count it:
+- One SU and one VU instruction can issue in the same cycle if they are
+  adjacent, the second does not read a result of the first, and the second is
+  not a branch target. Vector loads/stores and mfc2/mtc2/cfc2/ctc2 are SU.
+- A branch delay slot instruction does not pair with the instruction after it.
+- A branch target at an odd instruction address issues alone (IMEM is fetched
+  as aligned instruction pairs).
+- Taken branches cost one extra cycle.
+- Results become available a fixed number of cycles after issue (see Timing);
+  reading a result earlier stalls. VU accumulator chains do not stall, and the
+  VCO / VCC / VCE flags are ready for the next VU instruction.
+- No instructions issue while an IMEM DMA is in progress.
+- DMAs take a fixed setup latency plus a per-byte cost.
+The parameters are in the Timing class and can be overridden on the command
+line. With the defaults, most rows of the cycle count table come out exactly as
+hand-counted; Performance.md lists the ones which don't. Neither has been
+checked against hardware, so the numbers are for comparing codepaths and builds
+with each other, not for predicting hardware timings exactly.
+
+Usage example:
+python3 rspsim.py F3DEX3_BrZ --load scene.bin@0x100000 --dl 0x100000
+
+A display list and everything it references (vertices, matrices, textures) is
+placed in the simulated RDRAM with --load. Segment 0 is the identity mapping,
+so use physical addresses in the display list. Other scripts can import this
+module and use RSP / runTask directly.
+
+The time the RSP spends stalled is recorded by what it is waiting for: any wait
+loop polling the DMA status (vertex, matrix, and display list loads, and RDP
+buffer copies), polling the RDP FIFO pointers (FIFO full), and instruction
+issue blocked by an IMEM DMA (overlay loads). --timeline writes the commands and
+these stalls as a trace JSON which can be opened in Perfetto (ui.perfetto.dev)
+or chrome://tracing. Use --rdpBytesPerCycle to see RDP FIFO stalls. The trace
+is of the simulated timing, not of hardware: the stall lengths come from the
+timing model above.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+RDRAM_SIZE = 0x800000
+UCODE_CODE_ADDR = 0x00010000
+UCODE_DATA_ADDR = 0x00018000
+DRAM_STACK_ADDR = 0x00019000
+YIELD_DATA_ADDR = 0x0001A000
+FIFO_START_ADDR = 0x00020000
+FIFO_END_ADDR = 0x00030000
+
+OS_YIELD_DATA_SIZE = 0xC00
+YIELD_DATA_FOOTER_SIZE = 0x18
+M_GFXTASK = 1
+
+# COP0 registers
+SP_MEM_ADDR = 0
+SP_DRAM_ADDR = 1
+SP_RD_LEN = 2
+SP_WR_LEN = 3
+SP_STATUS = 4
+SP_DMA_FULL = 5
+SP_DMA_BUSY = 6
+SP_SEMAPHORE = 7
+DPC_START = 8
+DPC_END = 9
+DPC_CURRENT = 10
+DPC_STATUS = 11
+DPC_CLOCK = 12
+
+SP_STATUS_HALT = 0x0001
+SP_STATUS_BROKE = 0x0002
+SP_STATUS_DMA_BUSY = 0x0004
+SP_STATUS_DMA_FULL = 0x0008
+
+DPC_STATUS_XBUS_DMA = 0x0001
+DPC_STATUS_GCLK_ALIVE = 0x0008
+DPC_STATUS_END_VALID = 0x0200
+DPC_STATUS_START_VALID = 0x0400
+
+# Pseudo register numbers for dependency tracking
+VREG = 32
+FLAG_VCO = 64
+FLAG_VCC = 65
+FLAG_VCE = 66
+
+UNIT_SU = 0
+UNIT_VU = 1
+
+BRANCH_OPS = frozenset(["j", "jal", "jr", "jalr", "beq", "bne", "blez", "bgtz",
+    "bltz", "bgez", "bltzal", "bgezal"])
+
+# Two reads of a polled register from the same instruction, at most this many
+# cycles apart, are a wait loop.
+POLL_LOOP_CYCLES = 12
+POLL_KINDS = {
+    SP_DMA_BUSY: "DMA wait",
+    SP_DMA_FULL: "DMA wait",
+    DPC_STATUS: "RDP FIFO wait",
+    DPC_CURRENT: "RDP FIFO wait",
+}
+IMEM_DMA_WAIT = "Overlay load"
+
+RCP_CYCLES_PER_US = 62.5
+
+CMD_NAMES = {
+    0x00: "G_NOOP", 0x01: "G_VTX", 0x02: "G_MODIFYVTX", 0x03: "G_CULLDL",
+    0x04: "G_BRANCH_WZ", 0x05: "G_TRI1", 0x06: "G_TRI2", 0x07: "G_QUAD",
+    0x08: "G_TRISNAKE", 0x0A: "G_LIGHTTORDP", 0x0B: "G_RELSEGMENT",
+    0xD4: "G_FLUSH", 0xD5: "G_MEMSET", 0xD6: "G_DMA_IO", 0xD7: "G_TEXTURE",
+    0xD8: "G_POPMTX", 0xD9: "G_GEOMETRYMODE", 0xDA: "G_MTX", 0xDB: "G_MOVEWORD",
+    0xDC: "G_MOVEMEM", 0xDD: "G_LOAD_UCODE", 0xDE: "G_DL", 0xDF: "G_ENDDL",
+    0xE0: "G_SPNOOP", 0xE1: "G_RDPHALF_1", 0xE2: "G_SETOTHERMODE_L",
+    0xE3: "G_SETOTHERMODE_H", 0xE4: "G_TEXRECT", 0xE5: "G_TEXRECTFLIP",
+    0xE6: "G_RDPLOADSYNC", 0xE7: "G_RDPPIPESYNC", 0xE8: "G_RDPTILESYNC",
+    0xE9: "G_RDPFULLSYNC", 0xEA: "G_SETKEYGB", 0xEB: "G_SETKEYR",
+    0xEC: "G_SETCONVERT", 0xED: "G_SETSCISSOR", 0xEE: "G_SETPRIMDEPTH",
+    0xEF: "G_RDPSETOTHERMODE", 0xF0: "G_LOADTLUT", 0xF1: "G_RDPHALF_2",
+    0xF2: "G_SETTILESIZE", 0xF3: "G_LOADBLOCK", 0xF4: "G_LOADTILE",
+    0xF5: "G_SETTILE", 0xF6: "G_FILLRECT", 0xF7: "G_SETFILLCOLOR",
+    0xF8: "G_SETFOGCOLOR", 0xF9: "G_SETBLENDCOLOR", 0xFA: "G_SETPRIMCOLOR",
+    0xFB: "G_SETENVCOLOR", 0xFC: "G_SETCOMBINE", 0xFD: "G_SETTIMG",
+    0xFE: "G_SETZIMG", 0xFF: "G_SETCIMG",
+}
+
+
+class Timing:
+    """Pipeline and memory timing parameters, in RCP cycles."""
+    def __init__(self):
+        self.suLatency = 1         # ALU result to next instruction
+        self.loadLatency = 2       # lw etc. result (1 stall if used next)
+        self.cop0Latency = 3       # mfc0 result (2 stalls if used next)
+        self.cop2MoveLatency = 2   # mfc2 / cfc2 result
+        self.vuLatency = 4         # VU result (3 stalls if used next)
+        self.vecLoadLatency = 3    # lqv etc. result
+        self.vuFlagLatency = 1     # VCO / VCC / VCE from a VU op to the next
+        self.takenBranchPenalty = 1
+        self.dmaSetup = 30         # Cycles from DMA start to first data
+        self.dmaBytesPerCycle = 4.0
+        self.rdpBytesPerCycle = 0.0  # 0 = RDP consumes FIFO instantly
+
+
+class CommandRecord:
+    def __init__(self, index, addr, w0, w1, start):
+        self.index = index
+        self.addr = addr
+        self.w0 = w0
+        self.w1 = w1
+        self.start = start
+        self.cycles = 0
+        self.rdpTris = 0
+        self.rdpCmds = 0
+
+
+class TaskResult:
+    def __init__(self):
+        self.cycles = 0
+        self.commands = []
+        self.perfCounters = [0, 0, 0, 0]
+        self.rdpTris = 0
+        self.rdpCmds = 0
+        self.instructions = 0
+        self.labelHits = {}
+        self.dmas = []
+        self.waits = []
+
+
+def loadSyms(path):
+    syms = {}
+    with open(path, "r") as f:
+        for l in f:
+            toks = l.strip().split(" ")
+            if len(toks) != 2:
+                continue
+            try:
+                addr = int(toks[0], 16)
+            except ValueError:
+                continue
+            syms[toks[1]] = addr
+    return syms
+
+
+def loadUcode(name, buildDir="build"):
+    base = buildDir + "/" + name + "/" + name
+    with open(base + ".code", "rb") as f:
+        code = f.read()
+    with open(base + ".data", "rb") as f:
+        data = f.read()
+    syms = loadSyms(base + ".sym")
+    return code, data, syms
+
+
+def s16(x):
+    x &= 0xFFFF
+    return x - 0x10000 if x & 0x8000 else x
+
+
+def s32(x):
+    x &= 0xFFFFFFFF
+    return x - 0x100000000 if x & 0x80000000 else x
+
+
+def s48(x):
+    x &= 0xFFFFFFFFFFFF
+    return x - 0x1000000000000 if x & 0x800000000000 else x
+
+
+def clampS16(x):
+    if x > 0x7FFF:
+        return 0x7FFF
+    if x < -0x8000:
+        return 0x8000
+    return x & 0xFFFF
+
+
+def clz32(x):
+    x &= 0xFFFFFFFF
+    n = 0
+    while n < 32 and not (x & (0x80000000 >> n)):
+        n += 1
+    return n
+
+
+def makeRcpTable():
+    t = []
+    for i in range(512):
+        b = (1 << 34) // (i + 512)
+        t.append(((b + 1) >> 8) & 0xFFFF)
+    return t
+
+
+def makeRsqTable():
+    t = []
+    for i in range(512):
+        a = (i + 512) >> (1 if (i & 1) else 0)
+        b = 1 << 17
+        while a * (b + 1) * (b + 1) < (1 << 44):
+            b += 1
+        t.append((b >> 1) & 0xFFFF)
+    return t
+
+
+RCP_TABLE = makeRcpTable()
+RSQ_TABLE = makeRsqTable()
+
+
+def elemLane(e, i):
+    """Source lane of vt for destination lane i with element specifier e."""
+    if e < 2:
+        return i
+    if e < 4:
+        return (i & ~1) | (e & 1)
+    if e < 8:
+        return (i & ~3) | (e & 3)
+    return e & 7
+
+
+ELEM_MAP = [[elemLane(e, i) for i in range(8)] for e in range(16)]
+
+# RDP command lengths in bytes, by command byte
+RDP_CMD_LEN = [8] * 0x40
+for _c in range(0x08, 0x10):
+    RDP_CMD_LEN[_c] = 32 + (64 if _c & 4 else 0) + (64 if _c & 2 else 0) + (16 if _c & 1 else 0)
+RDP_CMD_LEN[0x24] = 16
+RDP_CMD_LEN[0x25] = 16
+
+
+class Instr:
+    """Decoded instruction plus the information needed by the timing model."""
+    __slots__ = ("word", "op", "unit", "reads", "writes",
+        "rs", "rt", "rd", "sa", "imm", "uimm", "target", "e", "vd", "vs", "vt",
+        "funct", "sub", "off", "isBranch")
+
+
+def decode(word):
+    i = Instr()
+    i.word = word
+    op = word >> 26
+    i.rs = (word >> 21) & 31
+    i.rt = (word >> 16) & 31
+    i.rd = (word >> 11) & 31
+    i.sa = (word >> 6) & 31
+    i.uimm = word & 0xFFFF
+    i.imm = s16(word)
+    i.target = (word << 2) & 0xFFC
+    i.unit = UNIT_SU
+    i.reads = ()
+    i.writes = ()
+    i.isBranch = False
+    i.op = None
+
+    def alu(name, reads, dst):
+        i.op = name
+        i.reads = tuple(r for r in reads if r != 0)
+        i.writes = (dst,) if dst != 0 else ()
+
+    if op == 0:
+        f = word & 63
+        names = {0: "sll", 2: "srl", 3: "sra", 4: "sllv", 6: "srlv", 7: "srav",
+            8: "jr", 9: "jalr", 13: "break", 32: "add", 33: "add", 34: "sub",
+            35: "sub", 36: "and", 37: "or", 38: "xor", 39: "nor", 42: "slt",
+            43: "sltu"}
+        if f not in names:
+            i.op = "invalid"
+            return i
+        n = names[f]
+        if n in ("sll", "srl", "sra"):
+            alu(n, (i.rt,), i.rd)
+        elif n == "jr":
+            alu(n, (i.rs,), 0)
+            i.isBranch = True
+        elif n == "jalr":
+            alu(n, (i.rs,), i.rd)
+            i.isBranch = True
+        elif n == "break":
+            i.op = n
+        else:
+            alu(n, (i.rs, i.rt), i.rd)
+    elif op == 1:
+        names = {0: "bltz", 1: "bgez", 16: "bltzal", 17: "bgezal"}
+        if i.rt not in names:
+            i.op = "invalid"
+            return i
+        alu(names[i.rt], (i.rs,), 31 if i.rt >= 16 else 0)
+        i.isBranch = True
+    elif op == 2:
+        i.op = "j"
+        i.isBranch = True
+    elif op == 3:
+        i.op = "jal"
+        i.writes = (31,)
+        i.isBranch = True
+    elif op in (4, 5):
+        alu("beq" if op == 4 else "bne", (i.rs, i.rt), 0)
+        i.isBranch = True
+    elif op in (6, 7):
+        alu("blez" if op == 6 else "bgtz", (i.rs,), 0)
+        i.isBranch = True
+    elif 8 <= op <= 15:
+        names = {8: "addi", 9: "addi", 10: "slti", 11: "sltiu", 12: "andi",
+            13: "ori", 14: "xori", 15: "lui"}
+        alu(names[op], (i.rs,) if op != 15 else (), i.rt)
+    elif op == 16:
+        if i.rs == 0:
+            i.op = "mfc0"
+            i.writes = (i.rt,) if i.rt != 0 else ()
+        elif i.rs == 4:
+            i.op = "mtc0"
+            i.reads = (i.rt,) if i.rt != 0 else ()
+        else:
+            i.op = "invalid"
+    elif op == 18:
+        i.e = (word >> 21) & 15 if word & (1 << 25) else (word >> 7) & 15
+        i.vt = i.rt
+        i.vs = i.rd
+        i.vd = i.sa
+        if word & (1 << 25):
+            i.funct = word & 63
+            i.unit = UNIT_VU
+            i.op = "vu"
+            f = i.funct
+            vt = VREG + i.vt
+            vs = VREG + i.vs
+            vd = VREG + i.vd
+            if f == 0x37:  # vnop
+                i.reads = ()
+                i.writes = ()
+            elif f in (0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36):  # single lane
+                i.reads = (vt,)
+                i.writes = (vd,)
+            elif f == 0x1D:  # vsar
+                i.reads = ()
+                i.writes = (vd,)
+            elif f in (0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26):  # compares/clip
+                i.reads = (vs, vt, FLAG_VCO, FLAG_VCC, FLAG_VCE)
+                i.writes = (vd, FLAG_VCO, FLAG_VCC, FLAG_VCE)
+            elif f == 0x27:  # vmrg
+                i.reads = (vs, vt, FLAG_VCC)
+                i.writes = (vd, FLAG_VCO)
+            elif f in (0x10, 0x11, 0x14, 0x15):  # add/sub with carry
+                i.reads = (vs, vt, FLAG_VCO)
+                i.writes = (vd, FLAG_VCO)
+            else:
+                i.reads = (vs, vt)
+                i.writes = (vd,)
+        elif i.rs in (0, 2):
+            i.op = "mfc2" if i.rs == 0 else "cfc2"
+            i.reads = (VREG + i.vs,) if i.rs == 0 else (FLAG_VCO + (i.rd & 3),)
+            i.writes = (i.rt,) if i.rt != 0 else ()
+        elif i.rs in (4, 6):
+            i.op = "mtc2" if i.rs == 4 else "ctc2"
+            i.reads = (i.rt,) if i.rt != 0 else ()
+            i.writes = (VREG + i.vs,) if i.rs == 4 else (FLAG_VCO + (i.rd & 3),)
+        else:
+            i.op = "invalid"
+    elif op in (32, 33, 35, 36, 37):
+        names = {32: "lb", 33: "lh", 35: "lw", 36: "lbu", 37: "lhu"}
+        alu(names[op], (i.rs,), i.rt)
+    elif op in (40, 41, 43):
+        names = {40: "sb", 41: "sh", 43: "sw"}
+        alu(names[op], (i.rs, i.rt), 0)
+    elif op in (50, 58):
+        i.sub = (word >> 11) & 31
+        i.e = (word >> 7) & 15
+        off = word & 0x7F
+        if off & 0x40:
+            off -= 0x80
+        i.off = off
+        i.vt = i.rt
+        if op == 50:
+            i.op = "lwc2"
+            if i.sub == 11:  # ltv writes 8 registers
+                base = i.vt & ~7
+                i.writes = tuple(VREG + base + n for n in range(8))
+            else:
+                i.writes = (VREG + i.vt,)
+            i.reads = (i.rs,) if i.rs != 0 else ()
+        else:
+            i.op = "swc2"
+            if i.sub == 11:
+                base = i.vt & ~7
+                i.reads = tuple(VREG + base + n for n in range(8))
+            else:
+                i.reads = (VREG + i.vt,)
+            if i.rs != 0:
+                i.reads = i.reads + (i.rs,)
+    else:
+        i.op = "invalid"
+    return i
+
+
+LWC2_SIZES = [1, 2, 4, 8, 16, 16, 8, 8, 16, 16, 16, 16]
+
+
+class RSP:
+    def __init__(self, code, data, syms, timing=None):
+        self.timing = timing if timing is not None else Timing()
+        self.code = code
+        self.data = data
+        self.syms = syms
+        self.rdram = bytearray(RDRAM_SIZE)
+        self.imem = bytearray(0x1000)
+        self.dmem = bytearray(0x1000)
+        self.decodeCache = {}
+        self.reset()
+
+    def reset(self):
+        self.r = [0] * 32
+        self.v = [[0] * 8 for _ in range(32)]
+        self.acc = [0] * 8
+        self.vcoC = 0
+        self.vcoNE = 0
+        self.vccLo = 0
+        self.vccHi = 0
+        self.vce = 0
+        self.divIn = 0
+        self.divOut = 0
+        self.divDP = False
+        self.pc = 0
+        self.npc = 4
+        self.halted = False
+        self.status = SP_STATUS_HALT
+        self.cop0 = [0] * 16
+        # Timing state
+        self.t = -1
+        self.lastUnit = None
+        self.lastPaired = True
+        self.lastWrites = ()
+        self.lastSolo = False
+        self.lastWasBranch = False
+        self.lastWasCop0Read = False
+        self.afterTaken = False
+        self.takenPending = False
+        self.ready = [0] * 67
+        self.instructions = 0
+        # DMA: list of [endCycle, isImem]
+        self.dmaQueue = []
+        # Every DMA started: (cycle, memAddr, dramAddr, length, toRdram)
+        self.dmaLog = []
+        self.imemDmaEnd = -1
+        # Stalls: [kind, startCycle, endCycle]
+        self.waits = []
+        self.lastPollAddr = None
+        self.lastPollT = 0
+        self.pollWait = None
+        # DPC
+        self.dpcStart = 0
+        self.dpcEnd = 0
+        self.dpcCurrent = 0
+        self.dpcPendingStart = None
+        self.dpcXbus = False
+        self.rdpLastUpdate = 0
+        self.rdpTris = 0
+        self.rdpCmds = 0
+        self.rdpPartial = 0.0
+
+    # ---------------------------------------------------------------- Memory
+    def dmemRead(self, addr, n):
+        addr &= 0xFFF
+        if addr + n <= 0x1000:
+            return self.dmem[addr:addr + n]
+        return bytes(self.dmem[(addr + k) & 0xFFF] for k in range(n))
+
+    def dmemWrite(self, addr, b):
+        addr &= 0xFFF
+        for k in range(len(b)):
+            self.dmem[(addr + k) & 0xFFF] = b[k]
+
+    def read8(self, addr):
+        return self.dmem[addr & 0xFFF]
+
+    def write8(self, addr, val):
+        self.dmem[addr & 0xFFF] = val & 0xFF
+
+    def writeRdram(self, addr, data):
+        addr &= RDRAM_SIZE - 1
+        self.rdram[addr:addr + len(data)] = data
+
+    def readRdram32(self, addr):
+        addr &= RDRAM_SIZE - 1
+        return struct.unpack(">I", self.rdram[addr:addr + 4])[0]
+
+    # ---------------------------------------------------------------- Vector helpers
+    def vByte(self, reg, b):
+        lane = self.v[reg][(b >> 1) & 7]
+        return (lane >> 8) & 0xFF if not (b & 1) else lane & 0xFF
+
+    def vSetByte(self, reg, b, val):
+        b &= 15
+        lane = self.v[reg][b >> 1]
+        if b & 1:
+            lane = (lane & 0xFF00) | (val & 0xFF)
+        else:
+            lane = (lane & 0x00FF) | ((val & 0xFF) << 8)
+        self.v[reg][b >> 1] = lane
+
+    # ---------------------------------------------------------------- DMA
+    def dmaUpdate(self):
+        now = self.t
+        self.dmaQueue = [d for d in self.dmaQueue if d[0] > now]
+
+    def dmaBusy(self):
+        self.dmaUpdate()
+        return 1 if len(self.dmaQueue) > 0 else 0
+
+    def dmaFull(self):
+        self.dmaUpdate()
+        return 1 if len(self.dmaQueue) > 1 else 0
+
+    def startDma(self, toRdram, lenReg):
+        length = ((lenReg & 0xFFF) | 7) + 1
+        count = ((lenReg >> 12) & 0xFF) + 1
+        skip = (lenReg >> 20) & 0xFFF
+        memAddr = self.cop0[SP_MEM_ADDR] & 0x1FF8
+        dramAddr = self.cop0[SP_DRAM_ADDR] & 0xFFFFF8
+        isImem = (memAddr & 0x1000) != 0
+        mem = self.imem if isImem else self.dmem
+        maddr = memAddr & 0xFF8
+        for _ in range(count):
+            for k in range(length):
+                da = (dramAddr + k) & (RDRAM_SIZE - 1)
+                ma = (maddr + k) & 0xFFF
+                if toRdram:
+                    self.rdram[da] = mem[ma]
+                else:
+                    mem[ma] = self.rdram[da]
+            dramAddr += length + skip
+            maddr += length
+        if isImem and not toRdram:
+            self.decodeCache = {}
+        tm = self.timing
+        total = length * count
+        self.dmaLog.append((self.t, memAddr, self.cop0[SP_DRAM_ADDR] & 0xFFFFF8, total, toRdram))
+        startT = self.dmaQueue[-1][0] if len(self.dmaQueue) > 0 else self.t
+        end = startT + tm.dmaSetup + int(total / tm.dmaBytesPerCycle + 0.999)
+        self.dmaQueue.append([end, isImem])
+        if isImem:
+            self.imemDmaEnd = max(self.imemDmaEnd, end)
+
+    # ---------------------------------------------------------------- RDP
+    def rdpUpdate(self):
+        now = self.t
+        rate = self.timing.rdpBytesPerCycle
+        if rate <= 0.0:
+            budget = None
+        else:
+            self.rdpPartial += (now - self.rdpLastUpdate) * rate
+            budget = self.rdpPartial
+        self.rdpLastUpdate = now
+        while self.dpcCurrent < self.dpcEnd:
+            cmd = self.rdram[self.dpcCurrent & (RDRAM_SIZE - 1)] & 0x3F
+            n = RDP_CMD_LEN[cmd]
+            if budget is not None:
+                if budget < n:
+                    break
+                budget -= n
+                self.rdpPartial -= n
+            if 0x08 <= cmd <= 0x0F:
+                self.rdpTris += 1
+            self.rdpCmds += 1
+            self.dpcCurrent += n
+        if budget is not None and self.dpcCurrent >= self.dpcEnd:
+            self.rdpPartial = 0.0
+
+    def rdpStatus(self):
+        self.rdpUpdate()
+        s = 0
+        if self.dpcXbus:
+            s |= DPC_STATUS_XBUS_DMA
+        if self.dpcCurrent < self.dpcEnd:
+            s |= DPC_STATUS_GCLK_ALIVE
+        if self.dpcPendingStart is not None:
+            s |= DPC_STATUS_START_VALID
+        return s
+
+    def notePoll(self, reg, addr):
+        kind = POLL_KINDS.get(reg)
+        if kind is None:
+            return
+        if addr == self.lastPollAddr and self.t - self.lastPollT <= POLL_LOOP_CYCLES:
+            if self.pollWait is None:
+                self.pollWait = [kind, self.lastPollT, self.t]
+                self.waits.append(self.pollWait)
+            else:
+                self.pollWait[2] = self.t
+        else:
+            self.pollWait = None
+        self.lastPollAddr = addr
+        self.lastPollT = self.t
+
+    # ---------------------------------------------------------------- COP0
+    def mfc0(self, reg):
+        if reg == SP_DMA_BUSY:
+            return self.dmaBusy()
+        if reg == SP_DMA_FULL:
+            return self.dmaFull()
+        if reg == SP_STATUS:
+            s = self.status
+            if self.dmaBusy():
+                s |= SP_STATUS_DMA_BUSY
+            if self.dmaFull():
+                s |= SP_STATUS_DMA_FULL
+            return s
+        if reg == SP_SEMAPHORE:
+            return 0
+        if reg == DPC_START:
+            return self.dpcStart
+        if reg == DPC_END:
+            return self.dpcEnd
+        if reg == DPC_CURRENT:
+            self.rdpUpdate()
+            return self.dpcCurrent
+        if reg == DPC_STATUS:
+            return self.rdpStatus()
+        if reg == DPC_CLOCK:
+            return self.t & 0xFFFFFF
+        return self.cop0[reg]
+
+    def mtc0(self, reg, val):
+        val &= 0xFFFFFFFF
+        if reg in (SP_MEM_ADDR, SP_DRAM_ADDR):
+            self.cop0[reg] = val
+        elif reg == SP_RD_LEN:
+            self.startDma(False, val)
+        elif reg == SP_WR_LEN:
+            self.startDma(True, val)
+        elif reg == SP_STATUS:
+            # Only the signal bits matter here; halt is handled by break.
+            for b in range(8):
+                if val & (0x200 << (2 * b)):
+                    self.status &= ~(0x80 << b)
+                if val & (0x400 << (2 * b)):
+                    self.status |= (0x80 << b)
+            if val & 0x2:
+                self.status |= SP_STATUS_HALT
+        elif reg == DPC_START:
+            self.rdpUpdate()
+            self.dpcPendingStart = val & 0xFFFFF8
+            self.dpcStart = val & 0xFFFFF8
+        elif reg == DPC_END:
+            self.rdpUpdate()
+            if self.dpcPendingStart is not None:
+                self.dpcCurrent = self.dpcPendingStart
+                self.dpcPendingStart = None
+            self.dpcEnd = val & 0xFFFFF8
+            self.rdpUpdate()
+        elif reg == DPC_STATUS:
+            if val & 1:
+                self.dpcXbus = False
+            if val & 2:
+                self.dpcXbus = True
+        else:
+            self.cop0[reg] = val
+
+    # ---------------------------------------------------------------- VU
+    def vuExec(self, i):
+        f = i.funct
+        e = i.e
+        vs = self.v[i.vs]
+        vtr = self.v[i.vt]
+        m = ELEM_MAP[e]
+        vt = [vtr[m[n]] for n in range(8)]
+        acc = self.acc
+        out = [0] * 8
+        if f <= 0x0F:
+            accumulate = f >= 0x08
+            base = f & 7
+            for n in range(8):
+                a = vs[n]
+                b = vt[n]
+                if base in (0, 1):  # vmulf/vmulu, vmacf/vmacu
+                    p = s16(a) * s16(b) * 2
+                    if not accumulate:
+                        p += 0x8000
+                elif base == 4:  # vmudl
+                    p = (a * b) >> 16
+                elif base == 5:  # vmudm
+                    p = s16(a) * b
+                elif base == 6:  # vmudn
+                    p = a * s16(b)
+                elif base == 7:  # vmudh
+                    p = (s16(a) * s16(b)) << 16
+                else:
+                    raise RuntimeError(f"Unsupported VU instruction {i.word:08X}")
+                x = s48((acc[n] if accumulate else 0) + p)
+                acc[n] = x
+                if base == 1:
+                    hi = x >> 16
+                    out[n] = 0 if x < 0 else (0xFFFF if hi > 0x7FFF else hi & 0xFFFF)
+                elif base in (4, 6):
+                    hi = x >> 16
+                    if hi < -0x8000:
+                        out[n] = 0
+                    elif hi > 0x7FFF:
+                        out[n] = 0xFFFF
+                    else:
+                        out[n] = x & 0xFFFF
+                else:
+                    out[n] = clampS16(x >> 16)
+        elif f in (0x10, 0x11):  # vadd, vsub
+            for n in range(8):
+                c = (self.vcoC >> n) & 1
+                if f == 0x10:
+                    r = s16(vs[n]) + s16(vt[n]) + c
+                else:
+                    r = s16(vs[n]) - s16(vt[n]) - c
+                self.setAccLow(n, r)
+                out[n] = clampS16(r)
+            self.vcoC = 0
+            self.vcoNE = 0
+        elif f == 0x13:  # vabs
+            for n in range(8):
+                a = s16(vs[n])
+                b = s16(vt[n])
+                if a < 0:
+                    r = -b
+                    self.setAccLow(n, r)
+                    out[n] = clampS16(r)
+                elif a == 0:
+                    self.setAccLow(n, 0)
+                    out[n] = 0
+                else:
+                    self.setAccLow(n, b)
+                    out[n] = b & 0xFFFF
+        elif f == 0x14:  # vaddc
+            c = 0
+            for n in range(8):
+                r = vs[n] + vt[n]
+                out[n] = r & 0xFFFF
+                self.setAccLow(n, r)
+                if r > 0xFFFF:
+                    c |= 1 << n
+            self.vcoC = c
+            self.vcoNE = 0
+        elif f == 0x15:  # vsubc
+            c = 0
+            ne = 0
+            for n in range(8):
+                r = vs[n] - vt[n]
+                out[n] = r & 0xFFFF
+                self.setAccLow(n, r)
+                if r < 0:
+                    c |= 1 << n
+                if r != 0:
+                    ne |= 1 << n
+            self.vcoC = c
+            self.vcoNE = ne
+        elif f == 0x1D:  # vsar
+            sh = {8: 32, 9: 16, 10: 0}.get(e)
+            for n in range(8):
+                out[n] = (acc[n] >> sh) & 0xFFFF if sh is not None else 0
+        elif f in (0x20, 0x21, 0x22, 0x23):  # vlt, veq, vne, vge
+            lo = 0
+            for n in range(8):
+                a = s16(vs[n])
+                b = s16(vt[n])
+                ne = (self.vcoNE >> n) & 1
+                c = (self.vcoC >> n) & 1
+                if f == 0x20:
+                    cond = a < b or (a == b and ne and c)
+                elif f == 0x21:
+                    cond = a == b and not ne
+                elif f == 0x22:
+                    cond = a != b or ne
+                else:
+                    cond = a > b or (a == b and not (ne and c))
+                if cond:
+                    lo |= 1 << n
+                out[n] = vs[n] if cond else vt[n]
+                self.setAccLow(n, out[n])
+            self.vccLo = lo
+            self.vccHi = 0
+            self.vcoC = 0
+            self.vcoNE = 0
+        elif f == 0x24:  # vcl
+            for n in range(8):
+                a = vs[n]
+                b = vt[n]
+                bit = 1 << n
+                if self.vcoC & bit:
+                    if self.vcoNE & bit:
+                        le = (self.vccLo & bit) != 0
+                    else:
+                        total = a + b
+                        carry = total > 0xFFFF
+                        z = (total & 0xFFFF) == 0
+                        if self.vce & bit:
+                            le = z or not carry
+                        else:
+                            le = z and not carry
+                    self.vccLo = (self.vccLo & ~bit) | (bit if le else 0)
+                    out[n] = (-b) & 0xFFFF if le else a
+                else:
+                    if self.vcoNE & bit:
+                        ge = (self.vccHi & bit) != 0
+                    else:
+                        ge = a >= b
+                    self.vccHi = (self.vccHi & ~bit) | (bit if ge else 0)
+                    out[n] = b if ge else a
+                self.setAccLow(n, out[n])
+            self.vcoC = 0
+            self.vcoNE = 0
+            self.vce = 0
+        elif f in (0x25, 0x26):  # vch, vcr
+            lo = hi = c = ne = ce = 0
+            for n in range(8):
+                a = s16(vs[n])
+                b = s16(vt[n])
+                bit = 1 << n
+                if (a ^ b) < 0:
+                    ge = b < 0
+                    if f == 0x25:
+                        total = a + b
+                        le = total <= 0
+                        r = -b if le else a
+                        if total == -1:
+                            ce |= bit
+                        if total != 0 and total != -1:
+                            ne |= bit
+                        c |= bit
+                    else:
+                        le = a + b + 1 <= 0
+                        r = ~b if le else a
+                else:
+                    le = b < 0
+                    diff = a - b
+                    ge = diff >= 0
+                    r = b if ge else a
+                    if f == 0x25 and diff != 0:
+                        ne |= bit
+                if le:
+                    lo |= bit
+                if ge:
+                    hi |= bit
+                out[n] = r & 0xFFFF
+                self.setAccLow(n, out[n])
+            self.vccLo = lo
+            self.vccHi = hi
+            self.vcoC = c
+            self.vcoNE = ne
+            self.vce = ce
+        elif f == 0x27:  # vmrg
+            for n in range(8):
+                out[n] = vs[n] if (self.vccLo >> n) & 1 else vt[n]
+                self.setAccLow(n, out[n])
+            self.vcoC = 0
+            self.vcoNE = 0
+        elif 0x28 <= f <= 0x2D:  # logical
+            for n in range(8):
+                a = vs[n]
+                b = vt[n]
+                if f == 0x28:
+                    r = a & b
+                elif f == 0x29:
+                    r = ~(a & b)
+                elif f == 0x2A:
+                    r = a | b
+                elif f == 0x2B:
+                    r = ~(a | b)
+                elif f == 0x2C:
+                    r = a ^ b
+                else:
+                    r = ~(a ^ b)
+                out[n] = r & 0xFFFF
+                self.setAccLow(n, out[n])
+        elif 0x30 <= f <= 0x36:  # vrcp family, vmov
+            de = i.vs & 7
+            for n in range(8):
+                self.setAccLow(n, vt[n])
+            out = list(self.v[i.vd])
+            src = vtr[e & 7]
+            if f == 0x33:  # vmov
+                out[de] = vt[de]
+            elif f in (0x32, 0x36):  # vrcph, vrsqh
+                self.divIn = src
+                self.divDP = True
+                out[de] = self.divOut & 0xFFFF
+            else:
+                isL = f in (0x31, 0x35)
+                if isL and self.divDP:
+                    inp = s32((self.divIn << 16) | src)
+                else:
+                    inp = s16(src)
+                res = self.divide(inp, f >= 0x34)
+                self.divDP = False
+                self.divOut = (res >> 16) & 0xFFFF
+                out[de] = res & 0xFFFF
+        elif f == 0x37:  # vnop
+            return
+        else:
+            raise RuntimeError(f"Unsupported VU instruction {i.word:08X}")
+        self.v[i.vd] = out
+
+    def setAccLow(self, n, val):
+        self.acc[n] = s48((self.acc[n] & ~0xFFFF) | (val & 0xFFFF))
+
+    def divide(self, inp, rsq):
+        mask = -1 if inp < 0 else 0
+        data = (inp ^ mask) & 0xFFFFFFFF
+        if inp > -32768:
+            data = (data - mask) & 0xFFFFFFFF
+        if data == 0:
+            return 0x7FFFFFFF
+        if inp == -32768:
+            return 0xFFFF0000
+        shift = clz32(data)
+        index = ((data << shift) & 0x7FC00000) >> 22
+        if rsq:
+            index = (index & 0x1FE) | (shift & 1)
+            res = (0x10000 | RSQ_TABLE[index]) << 14
+            res = res >> ((31 - shift) >> 1)
+        else:
+            res = (0x10000 | RCP_TABLE[index]) << 14
+            res = res >> (31 - shift)
+        return (res ^ mask) & 0xFFFFFFFF
+
+    # ---------------------------------------------------------------- Vector memory
+    def lwc2(self, i):
+        sub = i.sub
+        e = i.e
+        vt = i.vt
+        addr = (self.r[i.rs] + i.off * LWC2_SIZES[sub]) & 0xFFF
+        if sub <= 3:  # lbv, lsv, llv, ldv
+            for k in range(LWC2_SIZES[sub]):
+                if e + k > 15:
+                    break
+                self.vSetByte(vt, e + k, self.read8(addr + k))
+        elif sub == 4:  # lqv
+            end = (addr & ~15) + 16
+            for k in range(end - addr):
+                if e + k > 15:
+                    break
+                self.vSetByte(vt, e + k, self.read8(addr + k))
+        elif sub == 5:  # lrv
+            start = addr & ~15
+            b = e + 16 - (addr & 15)
+            for a in range(start, addr):
+                if b <= 15:
+                    self.vSetByte(vt, b, self.read8(a))
+                b += 1
+        elif sub in (6, 7, 8):  # lpv, luv, lhv
+            index = (addr & 7) - e
+            base = addr & ~7
+            for n in range(8):
+                if sub == 8:
+                    val = self.read8(base + ((index + n * 2) & 15)) << 7
+                else:
+                    val = self.read8(base + ((index + n) & 15)) << (8 if sub == 6 else 7)
+                self.v[vt][n] = val & 0xFFFF
+        elif sub == 11:  # ltv
+            start = vt & ~7
+            element = 16 - (e & ~1)
+            offset = (addr & 7) - (e & ~1)
+            base = addr & ~7
+            for reg in range(start, start + 8):
+                for _ in range(2):
+                    self.vSetByte(reg, element & 15, self.read8(base + (offset & 15)))
+                    element += 1
+                    offset += 1
+        else:
+            raise RuntimeError(f"Unsupported vector load {i.word:08X}")
+
+    def swc2(self, i):
+        sub = i.sub
+        e = i.e
+        vt = i.vt
+        addr = (self.r[i.rs] + i.off * LWC2_SIZES[sub]) & 0xFFF
+        if sub <= 3:  # sbv, ssv, slv, sdv
+            for k in range(LWC2_SIZES[sub]):
+                self.write8(addr + k, self.vByte(vt, (e + k) & 15))
+        elif sub == 4:  # sqv
+            end = (addr & ~15) + 16
+            for k in range(end - addr):
+                self.write8(addr + k, self.vByte(vt, (e + k) & 15))
+        elif sub == 5:  # srv
+            start = addr & ~15
+            b = e + 16 - (addr & 15)
+            for a in range(start, addr):
+                self.write8(a, self.vByte(vt, b & 15))
+                b += 1
+        elif sub in (6, 7):  # spv, suv
+            for k in range(8):
+                off = e + k
+                hiHalf = (off & 15) < 8
+                if (sub == 6) == hiHalf:
+                    val = self.vByte(vt, (off & 7) << 1)
+                else:
+                    val = self.v[vt][off & 7] >> 7
+                self.write8(addr + k, val)
+        elif sub == 10:  # swv
+            offset = addr & 7
+            base = addr & ~7
+            for n in range(e, e + 16):
+                self.write8(base + (offset & 15), self.vByte(vt, n & 15))
+                offset += 1
+        elif sub == 11:  # stv
+            start = vt & ~7
+            element = 16 - (e & ~1)
+            offset = addr & 7
+            base = addr & ~7
+            for reg in range(start, start + 8):
+                for _ in range(2):
+                    self.write8(base + (offset & 15), self.vByte(reg, element & 15))
+                    element += 1
+                    offset += 1
+        else:
+            raise RuntimeError(f"Unsupported vector store {i.word:08X}")
+
+    # ---------------------------------------------------------------- Timing
+    def latencyOf(self, i):
+        tm = self.timing
+        op = i.op
+        if i.unit == UNIT_VU:
+            return tm.vuLatency
+        if op == "mfc0":
+            return tm.cop0Latency
+        if op in ("mfc2", "cfc2"):
+            return tm.cop2MoveLatency
+        if op in ("lwc2", "mtc2", "ctc2"):
+            return tm.vecLoadLatency
+        if op in ("lb", "lh", "lw", "lbu", "lhu"):
+            return tm.loadLatency
+        return tm.suLatency
+
+    def issue(self, i, addr):
+        ready = 0
+        for r in i.reads:
+            if self.ready[r] > ready:
+                ready = self.ready[r]
+        if self.afterTaken:
+            candidate = self.t + 1 + self.timing.takenBranchPenalty
+            pairOk = False
+        else:
+            pairOk = (not self.lastPaired and not self.lastSolo
+                and i.unit != self.lastUnit
+                and not any(r in self.lastWrites for r in i.reads))
+            candidate = self.t if pairOk else self.t + 1
+        if self.lastWasCop0Read and i.op in ("lb", "lh", "lw", "lbu", "lhu", "lwc2"):
+            candidate = max(candidate, self.t + 2)
+        t = max(candidate, ready, self.imemDmaEnd if self.imemDmaEnd > self.t else 0)
+        if self.imemDmaEnd > candidate and t == self.imemDmaEnd:
+            self.waits.append([IMEM_DMA_WAIT, candidate, t])
+        if t > candidate and pairOk:
+            t = max(self.t + 1, t)
+        paired = pairOk and t == self.t
+        self.lastSolo = (self.afterTaken and (addr & 4) != 0) or self.lastWasBranch
+        self.lastWasBranch = i.op in BRANCH_OPS
+        self.afterTaken = False
+        self.t = t
+        self.lastPaired = paired
+        self.lastUnit = i.unit
+        self.lastWrites = i.writes
+        self.lastWasCop0Read = i.op == "mfc0"
+        lat = self.latencyOf(i)
+        for w in i.writes:
+            self.ready[w] = t + (self.timing.vuFlagLatency
+                if w >= FLAG_VCO and i.unit == UNIT_VU else lat)
+
+    # ---------------------------------------------------------------- Execution
+    def branch(self, cond, target):
+        if cond:
+            self.npc = target & 0xFFC
+            self.takenPending = True
+
+    def step(self):
+        addr = self.pc
+        word = struct.unpack(">I", self.imem[addr:addr + 4])[0]
+        i = self.decodeCache.get(word)
+        if i is None:
+            i = decode(word)
+            self.decodeCache[word] = i
+        delaySlotOfTaken = self.takenPending
+        self.takenPending = False
+        self.pc = self.npc
+        self.npc = (self.npc + 4) & 0xFFC
+        self.issue(i, addr)
+        self.instructions += 1
+        self.execute(i, addr)
+        if delaySlotOfTaken:
+            self.afterTaken = True
+        self.r[0] = 0
+
+    def execute(self, i, addr):
+        r = self.r
+        op = i.op
+        if op == "vu":
+            self.vuExec(i)
+        elif op == "addi":
+            r[i.rt] = (r[i.rs] + i.imm) & 0xFFFFFFFF
+        elif op == "lw" or op == "lh" or op == "lhu" or op == "lb" or op == "lbu":
+            a = (r[i.rs] + i.imm) & 0xFFF
+            if op == "lw":
+                r[i.rt] = struct.unpack(">I", self.dmemRead(a, 4))[0]
+            elif op == "lh":
+                r[i.rt] = s16(struct.unpack(">H", self.dmemRead(a, 2))[0]) & 0xFFFFFFFF
+            elif op == "lhu":
+                r[i.rt] = struct.unpack(">H", self.dmemRead(a, 2))[0]
+            elif op == "lb":
+                b = self.read8(a)
+                r[i.rt] = (b - 0x100 if b & 0x80 else b) & 0xFFFFFFFF
+            else:
+                r[i.rt] = self.read8(a)
+        elif op == "sw":
+            self.dmemWrite(r[i.rs] + i.imm, struct.pack(">I", r[i.rt]))
+        elif op == "sh":
+            self.dmemWrite(r[i.rs] + i.imm, struct.pack(">H", r[i.rt] & 0xFFFF))
+        elif op == "sb":
+            self.write8(r[i.rs] + i.imm, r[i.rt])
+        elif op == "lwc2":
+            self.lwc2(i)
+        elif op == "swc2":
+            self.swc2(i)
+        elif op == "andi":
+            r[i.rt] = r[i.rs] & i.uimm
+        elif op == "ori":
+            r[i.rt] = r[i.rs] | i.uimm
+        elif op == "xori":
+            r[i.rt] = r[i.rs] ^ i.uimm
+        elif op == "lui":
+            r[i.rt] = (i.uimm << 16) & 0xFFFFFFFF
+        elif op == "slti":
+            r[i.rt] = 1 if s32(r[i.rs]) < i.imm else 0
+        elif op == "sltiu":
+            r[i.rt] = 1 if r[i.rs] < (i.imm & 0xFFFFFFFF) else 0
+        elif op == "sll":
+            r[i.rd] = (r[i.rt] << i.sa) & 0xFFFFFFFF
+        elif op == "srl":
+            r[i.rd] = r[i.rt] >> i.sa
+        elif op == "sra":
+            r[i.rd] = (s32(r[i.rt]) >> i.sa) & 0xFFFFFFFF
+        elif op == "sllv":
+            r[i.rd] = (r[i.rt] << (r[i.rs] & 31)) & 0xFFFFFFFF
+        elif op == "srlv":
+            r[i.rd] = r[i.rt] >> (r[i.rs] & 31)
+        elif op == "srav":
+            r[i.rd] = (s32(r[i.rt]) >> (r[i.rs] & 31)) & 0xFFFFFFFF
+        elif op == "add":
+            r[i.rd] = (r[i.rs] + r[i.rt]) & 0xFFFFFFFF
+        elif op == "sub":
+            r[i.rd] = (r[i.rs] - r[i.rt]) & 0xFFFFFFFF
+        elif op == "and":
+            r[i.rd] = r[i.rs] & r[i.rt]
+        elif op == "or":
+            r[i.rd] = r[i.rs] | r[i.rt]
+        elif op == "xor":
+            r[i.rd] = r[i.rs] ^ r[i.rt]
+        elif op == "nor":
+            r[i.rd] = ~(r[i.rs] | r[i.rt]) & 0xFFFFFFFF
+        elif op == "slt":
+            r[i.rd] = 1 if s32(r[i.rs]) < s32(r[i.rt]) else 0
+        elif op == "sltu":
+            r[i.rd] = 1 if r[i.rs] < r[i.rt] else 0
+        elif op == "beq":
+            self.branch(r[i.rs] == r[i.rt], addr + 4 + (i.imm << 2))
+        elif op == "bne":
+            self.branch(r[i.rs] != r[i.rt], addr + 4 + (i.imm << 2))
+        elif op == "blez":
+            self.branch(s32(r[i.rs]) <= 0, addr + 4 + (i.imm << 2))
+        elif op == "bgtz":
+            self.branch(s32(r[i.rs]) > 0, addr + 4 + (i.imm << 2))
+        elif op in ("bltz", "bgez", "bltzal", "bgezal"):
+            val = s32(r[i.rs])
+            cond = val < 0 if op in ("bltz", "bltzal") else val >= 0
+            if op.endswith("al"):
+                r[31] = (addr + 8) & 0xFFC
+            self.branch(cond, addr + 4 + (i.imm << 2))
+        elif op == "j":
+            self.branch(True, i.target)
+        elif op == "jal":
+            r[31] = (addr + 8) & 0xFFC
+            self.branch(True, i.target)
+        elif op == "jr":
+            self.branch(True, r[i.rs])
+        elif op == "jalr":
+            target = r[i.rs]
+            r[i.rd] = (addr + 8) & 0xFFC
+            self.branch(True, target)
+        elif op == "mfc0":
+            r[i.rt] = self.mfc0(i.rd & 15) & 0xFFFFFFFF
+            self.notePoll(i.rd & 15, addr)
+        elif op == "mtc0":
+            self.mtc0(i.rd & 15, r[i.rt])
+        elif op == "mfc2":
+            hi = self.vByte(i.vs, i.e)
+            lo = self.vByte(i.vs, (i.e + 1) & 15)
+            r[i.rt] = s16((hi << 8) | lo) & 0xFFFFFFFF
+        elif op == "mtc2":
+            val = r[i.rt]
+            self.vSetByte(i.vs, i.e, val >> 8)
+            if i.e < 15:
+                self.vSetByte(i.vs, i.e + 1, val)
+        elif op == "cfc2":
+            c = i.rd & 3
+            if c == 0:
+                val = (self.vcoNE << 8) | self.vcoC
+            elif c == 1:
+                val = (self.vccHi << 8) | self.vccLo
+            else:
+                val = self.vce
+            r[i.rt] = s16(val) & 0xFFFFFFFF
+        elif op == "ctc2":
+            c = i.rd & 3
+            val = r[i.rt]
+            if c == 0:
+                self.vcoC = val & 0xFF
+                self.vcoNE = (val >> 8) & 0xFF
+            elif c == 1:
+                self.vccLo = val & 0xFF
+                self.vccHi = (val >> 8) & 0xFF
+            else:
+                self.vce = val & 0xFF
+        elif op == "break":
+            self.status |= SP_STATUS_HALT | SP_STATUS_BROKE
+            self.halted = True
+        else:
+            raise RuntimeError(f"Invalid instruction {i.word:08X} at IMEM {addr | 0x1000:04X}")
+
+    # ---------------------------------------------------------------- Task
+    def boot(self, dlAddr, dlSize=0):
+        """Emulate rspboot: load IMEM, DMEM, and the OSTask structure."""
+        self.reset()
+        self.writeRdram(UCODE_CODE_ADDR, self.code)
+        self.writeRdram(UCODE_DATA_ADDR, self.data)
+        n = min(len(self.code), 0xF80)
+        self.imem[0x80:0x80 + n] = self.code[:n]
+        n = min(len(self.data), 0x1000)
+        self.dmem[0:n] = self.data[:n]
+        ostask = self.syms["OSTask"]
+        task = struct.pack(">16I",
+            M_GFXTASK, 0, 0, 0,
+            UCODE_CODE_ADDR, len(self.code), UCODE_DATA_ADDR, len(self.data),
+            DRAM_STACK_ADDR, 0x400, FIFO_START_ADDR, FIFO_END_ADDR,
+            dlAddr, dlSize, YIELD_DATA_ADDR, OS_YIELD_DATA_SIZE)
+        self.dmem[ostask:ostask + 0x40] = task
+        self.pc = self.syms["start"] & 0xFFC
+        self.npc = (self.pc + 4) & 0xFFC
+        self.status = 0
+
+    def runTask(self, dlAddr, maxInstructions=50000000, trace=None, watch=None):
+        """Run one graphics task. Returns a TaskResult.
+
+        watch is an optional list of IMEM label names; the cycle of every
+        arrival at each of them is recorded in TaskResult.labelHits. Overlay
+        labels are matched by IMEM address only, so a label in one overlay also
+        matches code at the same address in whichever overlay is loaded.
+        """
+        self.boot(dlAddr)
+        res = TaskResult()
+        dispatch = self.syms["run_next_DL_command"] & 0xFFC
+        inputBufferEnd = self.syms["inputBufferEnd"]
+        taskDataPtrReg = 26
+        inputBufferPosReg = 27
+        cur = None
+        count = 0
+        labels = None
+        if trace is not None:
+            labels = {}
+            for k, v in self.syms.items():
+                if v >= 0x1000 and not k.startswith("@"):
+                    labels.setdefault(v & 0xFFC, k)
+        watchAddrs = {}
+        if watch is not None:
+            for name in watch:
+                watchAddrs.setdefault(self.syms[name] & 0xFFC, []).append(name)
+                res.labelHits[name] = []
+        while not self.halted:
+            # Arrivals are timed at the cycle the instruction there issues, so
+            # that a taken branch penalty or a stall before it counts towards
+            # the code which came before, like in the hand-counted tables.
+            pc = self.pc
+            newCmd = None
+            if pc == dispatch:
+                pos = s32(self.r[inputBufferPosReg])
+                if pos != 0:
+                    a = (inputBufferEnd + pos) & 0xFFF
+                    w0, w1 = struct.unpack(">II", self.dmemRead(a, 8))
+                    dlPos = (self.r[taskDataPtrReg] + pos) & 0xFFFFFFFF
+                    # The sampling profiler build dispatches the same command
+                    # again after taking a sample; that is part of the command.
+                    if cur is None or cur.addr != dlPos:
+                        newCmd = CommandRecord(count, dlPos, w0, w1, 0)
+                        newCmd.rdpTris = self.rdpTris
+                        newCmd.rdpCmds = self.rdpCmds
+            self.step()
+            now = self.t
+            if newCmd is not None:
+                if cur is not None:
+                    cur.cycles = now - cur.start
+                    cur.rdpTris = newCmd.rdpTris - cur.rdpTris
+                    cur.rdpCmds = newCmd.rdpCmds - cur.rdpCmds
+                cur = newCmd
+                cur.start = now
+                res.commands.append(cur)
+                count += 1
+            if trace is not None and (pc in labels):
+                trace.write(f"{now:8d} {pc | 0x1000:04X} {labels[pc]}\n")
+            if pc in watchAddrs:
+                for name in watchAddrs[pc]:
+                    res.labelHits[name].append(now)
+            if self.instructions > maxInstructions:
+                raise RuntimeError("Instruction limit exceeded; task did not finish")
+        self.rdpUpdate()
+        end = self.t + 1
+        if cur is not None:
+            cur.cycles = end - cur.start
+            cur.rdpTris = self.rdpTris - cur.rdpTris
+            cur.rdpCmds = self.rdpCmds - cur.rdpCmds
+        res.cycles = end
+        res.instructions = self.instructions
+        res.rdpTris = self.rdpTris
+        res.rdpCmds = self.rdpCmds
+        res.dmas = list(self.dmaLog)
+        res.waits = [tuple(w) for w in self.waits]
+        footer = YIELD_DATA_ADDR + OS_YIELD_DATA_SIZE - YIELD_DATA_FOOTER_SIZE
+        res.perfCounters = [self.readRdram32(footer + 4 * k) for k in range(4)]
+        return res
+
+
+def waitTotals(res):
+    totals = {}
+    for kind, start, end in res.waits:
+        totals[kind] = totals.get(kind, 0) + end - start
+    return totals
+
+
+def writeTimeline(res, f):
+    """Writes the commands and stalls of a task as Chrome trace event JSON."""
+    def us(cycles):
+        return round(cycles / RCP_CYCLES_PER_US, 3)
+    events = []
+    events.append({"name": "process_name", "ph": "M", "pid": 1,
+        "args": {"name": "F3DEX3 (simulated RSP timing)"}})
+    for tid, name in [(1, "DL commands"), (2, "Stalls")]:
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid,
+            "args": {"name": name}})
+    for c in res.commands:
+        events.append({"name": CMD_NAMES.get(c.w0 >> 24, f"{c.w0 >> 24:02X}"), "ph": "X",
+            "pid": 1, "tid": 1, "ts": us(c.start), "dur": us(c.cycles),
+            "args": {"addr": f"{c.addr:08X}", "w0": f"{c.w0:08X}", "w1": f"{c.w1:08X}",
+                "cycles": c.cycles, "rdpTris": c.rdpTris}})
+    for kind, start, end in res.waits:
+        events.append({"name": kind, "ph": "X", "pid": 1, "tid": 2, "ts": us(start),
+            "dur": us(end - start), "args": {"cycles": end - start}})
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, f)
+
+
+def parseLoadArg(s):
+    if "@" not in s:
+        raise argparse.ArgumentTypeError("--load expects FILE@ADDR")
+    path, addr = s.rsplit("@", 1)
+    return path, int(addr, 0)
+
+
+def makeTimingArgs(parser):
+    tm = Timing()
+    for k, v in vars(tm).items():
+        parser.add_argument("--" + k, type=type(v), default=v,
+            help=f"Timing parameter (default {v})")
+
+
+def timingFromArgs(args):
+    tm = Timing()
+    for k in vars(tm).keys():
+        setattr(tm, k, getattr(args, k))
+    return tm
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run a display list through F3DEX3 on a simulated RSP")
+    parser.add_argument("ucode", help="Microcode name, e.g. F3DEX3_BrZ")
+    parser.add_argument("--build-dir", default="build")
+    parser.add_argument("--load", type=parseLoadArg, action="append", default=[],
+        help="Load a binary file into RDRAM, FILE@ADDR")
+    parser.add_argument("--dl", type=lambda x: int(x, 0), required=True,
+        help="Physical address of the root display list")
+    parser.add_argument("--trace", action="store_true",
+        help="Print every labeled IMEM address reached, with the cycle")
+    parser.add_argument("--timeline", help="Write a Perfetto / Chrome trace JSON of the commands and stalls")
+    makeTimingArgs(parser)
+    args = parser.parse_args()
+
+    code, data, syms = loadUcode(args.ucode, args.build_dir)
+    rsp = RSP(code, data, syms, timingFromArgs(args))
+    for path, addr in args.load:
+        with open(path, "rb") as f:
+            rsp.writeRdram(addr, f.read())
+    res = rsp.runTask(args.dl, trace=sys.stdout if args.trace else None)
+
+    print(f"{'#':>5} {'DL addr':>8} {'w0':>8} {'w1':>8} {'cycles':>7} {'RDP tris':>8}")
+    for c in res.commands:
+        print(f"{c.index:5d} {c.addr:08X} {c.w0:08X} {c.w1:08X} {c.cycles:7d} {c.rdpTris:8d}")
+    print(f"Total: {res.cycles} cycles, {res.instructions} instructions, "
+        + f"{len(res.commands)} commands, {res.rdpTris} RDP tris")
+    print("Perf counters: " + " ".join(f"{x:08X}" for x in res.perfCounters))
+    totals = waitTotals(res)
+    if len(totals) > 0:
+        print("Stalls: " + ", ".join(f"{k} {v} cycles" for k, v in sorted(totals.items())))
+    if args.timeline is not None:
+        with open(args.timeline, "w") as f:
+            writeTimeline(res, f)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,241 @@
+#!python3
+
+"""
+Skinned mesh batcher for F3DEX3.
+
+F3DEX3 transforms each gsSPVertex with the current model matrix, so a skinned
+mesh is drawn by loading each bone's matrix and then that bone's vertices. The
+usual export is one display list per limb: its own vertices, plus for every tri
+which also uses vertices of other bones, another gsSPMatrix + gsSPVertex for
+each of those bones. Every matrix change costs a matrix DMA, an MVP recompute at
+the next gsSPVertex, and with lighting, a light direction transform.
+
+This tool instead packs whole bone groups into the 56-entry vertex buffer: tris
+are batched so that each batch uses as few bones as possible, each bone's
+vertices in a batch are loaded with one gsSPMatrix + gsSPVertex into a contiguous
+range of slots, and the tris spanning bones are drawn once all their bones are
+loaded. The matrix of the last bone of a batch is reused by the next batch if it
+starts with the same bone.
+
+The input is an OBJ file and a bones file with one bone (limb) index per OBJ
+vertex, one per line. The bone matrices are expected at consecutive Mtx in a
+segment, as for OoT's flexible skeletons (segment 0x0D by default).
+
+Usage:
+python3 skinpartition.py body.obj body_bones.txt --name body > body.inc.c
+
+Other scripts can import this module and use partition directly.
+"""
+
+import argparse
+import sys
+
+import costs
+import trisnake
+import vtxpartition
+
+VERTEX_BUFFER_SIZE = 56
+MTX_SIZE = 0x40
+
+
+class Group:
+    """One bone's vertices in a batch: gsSPMatrix (unless reused), gsSPVertex."""
+    def __init__(self, bone, start, count, v0, loadMtx):
+        self.bone = bone
+        self.start = start  # In the output vertex array
+        self.count = count
+        self.v0 = v0
+        self.loadMtx = loadMtx
+
+
+class Batch:
+    def __init__(self):
+        self.groups = []
+        self.tris = []  # In vertex buffer slot indices
+
+
+class Partition:
+    def __init__(self):
+        self.vertices = []  # Output vertex array, as source vertex indices
+        self.batches = []
+
+    def groups(self):
+        return [g for b in self.batches for g in b.groups]
+
+    def numMtx(self):
+        return sum(1 for g in self.groups() if g.loadMtx)
+
+
+def layoutBatch(res, batchTris, bones, prevBone):
+    """Appends a batch drawing batchTris (source indices) to res."""
+    batch = Batch()
+    verts = sorted(set(v for t in batchTris for v in t))
+    order = sorted(set(bones[v] for v in verts), key=lambda b: (b != prevBone, b))
+    slotOf = {}
+    for b in order:
+        group = [v for v in verts if bones[v] == b]
+        batch.groups.append(Group(b, len(res.vertices), len(group), len(slotOf), b != prevBone))
+        for v in group:
+            slotOf[v] = len(slotOf)
+        res.vertices += group
+    batch.tris = [tuple(slotOf[v] for v in t) for t in batchTris]
+    res.batches.append(batch)
+    return order[-1]
+
+
+def partition(tris, bones, bufferSize=VERTEX_BUFFER_SIZE):
+    """
+    tris are in source vertex indices, bones is the bone of each source vertex.
+    Returns a Partition; every input tri appears in exactly one batch, with its
+    winding and vertex order preserved.
+    """
+    tris = [tuple(t) for t in tris]
+    for t in tris:
+        if len(set(t)) != 3:
+            raise RuntimeError(f"Tri {t} has repeated vertices")
+    done = [False] * len(tris)
+    res = Partition()
+    prevBone = None
+    while not all(done):
+        batchVerts = set()
+        batchBones = set()
+        chosen = []
+        while True:
+            best = None
+            for i in range(len(tris)):
+                if done[i]:
+                    continue
+                nv = [v for v in tris[i] if v not in batchVerts]
+                if len(batchVerts) + len(nv) > bufferSize:
+                    continue
+                nb = set(bones[v] for v in nv) - batchBones
+                # Start each batch from the bone the previous one ended with
+                seed = 0 if len(chosen) > 0 or bones[tris[i][0]] == prevBone else 1
+                score = (len(nb), seed, len(nv), i)
+                if best is None or score < best[0]:
+                    best = (score, i)
+            if best is None:
+                break
+            i = best[1]
+            done[i] = True
+            chosen.append(i)
+            batchVerts.update(tris[i])
+            batchBones.update(bones[v] for v in tris[i])
+        if len(chosen) == 0:
+            raise RuntimeError("Internal error: no tri fits in the vertex buffer")
+        prevBone = layoutBatch(res, [tris[i] for i in sorted(chosen)], bones, prevBone)
+    return res
+
+
+def perLimbPartition(tris, bones, bufferSize=VERTEX_BUFFER_SIZE):
+    """
+    The usual export for comparison: each tri belongs to the limb of its first
+    vertex, and each limb is drawn separately, loading the other bones' vertices
+    it needs with their own matrices before its own (so the limb's matrix is
+    current afterwards).
+    """
+    limbs = {}
+    for t in tris:
+        limbs.setdefault(bones[t[0]], []).append(tuple(t))
+    res = Partition()
+    for limb in sorted(limbs):
+        batchTris = []
+        batchVerts = set()
+        for t in limbs[limb] + [None]:
+            if t is None or len(batchVerts | set(t)) > bufferSize:
+                verts = sorted(batchVerts)
+                foreign = sorted(set(bones[v] for v in verts) - {limb})
+                batch = Batch()
+                slot = 0
+                for b in foreign + [limb]:
+                    group = [v for v in verts if bones[v] == b]
+                    batch.groups.append(Group(b, len(res.vertices), len(group), slot, True))
+                    slot += len(group)
+                    res.vertices += group
+                res.batches.append(batch)
+                batchTris = []
+                batchVerts = set()
+            if t is not None:
+                batchTris.append(t)
+                batchVerts |= set(t)
+    return res
+
+
+def estimateCycles(part, perPair, lightXfrm):
+    loads = [g.count for g in part.groups()]
+    return (vtxpartition.estimateCycles(loads, perPair)
+        + part.numMtx() * (costs.MTX_CYCLES + costs.MVP_RECOMPUTE_CYCLES + lightXfrm))
+
+
+def readBones(path, numVerts):
+    bones = []
+    with open(path, "r") as f:
+        for l in f:
+            l = l.split("#")[0].strip()
+            if len(l) > 0:
+                bones.append(int(l, 0))
+    if len(bones) != numVerts:
+        raise RuntimeError(f"{path}: {len(bones)} bones for {numVerts} vertices")
+    return bones
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Batch a skinned mesh for F3DEX3 by bone")
+    parser.add_argument("input", help="OBJ file")
+    parser.add_argument("bones", help="Text file with the bone index of each OBJ vertex")
+    parser.add_argument("--name", default="mesh", help="C name prefix")
+    parser.add_argument("--scale", type=float, default=1.0, help="Position scale to model units")
+    parser.add_argument("--mtx-segment", type=lambda x: int(x, 0), default=0x0D,
+        help="Segment holding the bone matrices (default 0x0D)")
+    parser.add_argument("--snakes", action="store_true",
+        help="Draw each batch with triangle snakes (trisnake.py)")
+    parser.add_argument("--lighting", nargs="+", default=["none"],
+        help="none, dir N, or point N; for the cycle estimate")
+    parser.add_argument("--noc", action="store_true", help="Estimate for F3DEX3_NOC")
+    args = parser.parse_args()
+
+    lighting = args.lighting[0]
+    numLights = int(args.lighting[1]) if len(args.lighting) > 1 else 0
+    if lighting not in ["none", "dir", "point"] or not (0 <= numLights <= 9):
+        raise RuntimeError("--lighting must be none, dir N, or point N with N 0-9")
+    positions, tris = vtxpartition.readObj(args.input)
+    bones = readBones(args.bones, len(positions))
+    part = partition(tris, bones)
+
+    print(f"Vtx {args.name}_vtx[{len(part.vertices)}] = {{")
+    for k, v in enumerate(part.vertices):
+        x, y, z = (int(round(c * args.scale)) for c in positions[v])
+        print(f"    {{{{{{{x}, {y}, {z}}}, 0, {{0, 0}}, {{0xFF, 0xFF, 0xFF, 0xFF}}}}}}, // {k}: source vertex {v}, bone {bones[v]}")
+    print("};\n")
+    print(f"Gfx {args.name}_dl[] = {{")
+    for b in part.batches:
+        for g in b.groups:
+            if g.loadMtx:
+                addr = (args.mtx_segment << 24) + g.bone * MTX_SIZE
+                print(f"    gsSPMatrix((Mtx*)0x{addr:08X}, G_MTX_MODEL | G_MTX_LOAD | G_MTX_NOPUSH),")
+            print(f"    gsSPVertex(&{args.name}_vtx[{g.start}], {g.count}, {g.v0}),")
+        if args.snakes:
+            snakes, loose = trisnake.makeSnakes(b.tris)
+            lines = [m for s in snakes for m in s.macros()] + trisnake.looseMacros(loose)
+        else:
+            lines = trisnake.looseMacros(b.tris)
+        for m in lines:
+            print("    " + m)
+    print("    gsSPEndDisplayList(),")
+    print("};")
+
+    perPair = costs.pairCycles(lighting, numLights, args.noc)
+    lightXfrm = costs.LIGHT_XFRM_CYCLES[numLights] if lighting != "none" else 0
+    limb = perLimbPartition(tris, bones)
+    print(f"{len(tris)} tris, {len(set(bones))} bones, {len(part.batches)} batches", file=sys.stderr)
+    for label, p in [("This:    ", part), ("Per limb:", limb)]:
+        print(f"{label} {p.numMtx()} gsSPMatrix, {len(p.groups())} gsSPVertex, "
+            + f"{len(p.vertices)} vertices, ~{estimateCycles(p, perPair, lightXfrm)} cycles",
+            file=sys.stderr)
+    mtxChange = costs.MTX_CYCLES + costs.MVP_RECOMPUTE_CYCLES + lightXfrm
+    print(f"({perPair} cycles per vertex pair, ~{costs.LOAD_OVERHEAD_CYCLES} per load, "
+        + f"~{mtxChange} per matrix change)", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,360 @@
+#!python3
+
+"""
+Triangle snake generator.
+
+Converts a list of triangles, whose indices are slots in the vertex buffer
+(0-55), into gsSPTriSnake / gsSPContinueSnake sequences, with gsSP2Triangles /
+gsSP1Triangle for tris which do not fit well into a snake. See Triangle Snake in
+the documentation for the command format.
+
+The input is either a Wavefront OBJ file (only the f lines are used, and the
+1-based indices are converted to vertex buffer slots), or a text file with one
+triangle per line as three 0-based indices. Tris must have consistent winding;
+the winding of each tri is preserved. With --flat, the first vertex of each tri
+is also preserved, as it determines the color / normal in flat shading mode;
+this gives shorter snakes.
+
+Usage:
+python3 trisnake.py mesh.obj > mesh_tris.inc.c
+
+Other scripts can import this module and use makeSnakes / encodeTris directly.
+"""
+
+import argparse
+import sys
+
+import gbi
+
+VERTEX_BUFFER_SIZE = 56
+
+RIGHT = gbi.G_SNAKE_RIGHT
+LEFT = gbi.G_SNAKE_LEFT
+
+
+class Snake:
+    """
+    One snake: the first tri drawn, as (A, B, C), and then each further index
+    with its direction. The stored indices A-B-C are updated as in gbi.h: for
+    G_SNAKE_RIGHT B = A, for G_SNAKE_LEFT C = A, then A = the new index.
+    """
+    def __init__(self, first):
+        self.first = first
+        self.rest = []
+
+    def numTris(self):
+        return 1 + len(self.rest)
+
+    def tris(self):
+        """The tris drawn, in order, as (A, B, C)."""
+        a, b, c = self.first
+        ret = [(a, b, c)]
+        for n, d in self.rest:
+            if d == RIGHT:
+                b = a
+            else:
+                c = a
+            a = n
+            ret.append((a, b, c))
+        return ret
+
+    def numCmds(self):
+        # SPTriSnake holds 4 indices after the first tri, SPContinueSnake 8
+        return 1 + max(0, (len(self.rest) - 4 + 7) // 8)
+
+    def cmds(self):
+        a, b, c = self.first
+        return gbi.triSnake((b, c, a), self.rest)
+
+    def macros(self):
+        a, b, c = self.first
+        idx = [str(b), str(c), str(a)]
+        for k, (n, d) in enumerate(self.rest):
+            last = " | G_SNAKE_LAST" if k == len(self.rest) - 1 else ""
+            idx.append(f"{n}{last}, {'G_SNAKE_LEFT' if d == LEFT else 'G_SNAKE_RIGHT'}")
+        if len(self.rest) == 0:
+            idx[2] += " | G_SNAKE_LAST"
+        while len(idx) < 7 or (len(idx) - 7) % 8 != 0:
+            idx.append("0, 0")
+        ret = [f"gsSPTriSnake({', '.join(idx[:7])}),"]
+        for i in range(7, len(idx), 8):
+            ret.append(f"gsSPContinueSnake({', '.join(idx[i:i + 8])}),")
+        return ret
+
+
+def rotations(t):
+    return [t, (t[1], t[2], t[0]), (t[2], t[0], t[1])]
+
+
+def sameTri(t, u, flat):
+    return t == u if flat else u in rotations(t)
+
+
+class Mesh:
+    def __init__(self, tris):
+        self.tris = [tuple(t) for t in tris]
+        self.edges = {}
+        for i, (a, b, c) in enumerate(self.tris):
+            for e in [(a, b), (b, c), (c, a)]:
+                self.edges.setdefault(e, []).append(i)
+        self.neighbors = []
+        for a, b, c in self.tris:
+            nb = set()
+            for u, v in [(a, b), (b, c), (c, a)]:
+                nb.update(self.edges.get((v, u), []))
+                nb.update(self.edges.get((u, v), []))
+            self.neighbors.append(nb)
+        for i in range(len(self.tris)):
+            self.neighbors[i].discard(i)
+
+    def freeNeighbors(self, i, used):
+        return sum(1 for j in self.neighbors[i] if not used[j])
+
+    def moves(self, state, used, flat):
+        """Possible next tris from drawn tri state = (A, B, C)."""
+        a, b, c = state
+        ret = []
+        # The new tri N-A-C contains directed edge A->C, N-B-A contains B->A
+        for d, edge, mk in [(RIGHT, (a, c), lambda n: (n, a, c)),
+                            (LEFT, (b, a), lambda n: (n, b, a))]:
+            for i in self.edges.get(edge, []):
+                if used[i]:
+                    continue
+                t = self.tris[i]
+                n = [x for x in t if x not in edge]
+                if len(n) != 1:
+                    continue
+                newState = mk(n[0])
+                if not sameTri(t, newState, flat):
+                    continue
+                ret.append((d, i, newState))
+        return ret
+
+    def reach(self, state, used, flat, depth):
+        """Longest continuation from state, searching depth tris ahead."""
+        if depth == 0:
+            return 0
+        best = 0
+        for d, i, newState in self.moves(state, used, flat):
+            used[i] = True
+            best = max(best, 1 + self.reach(newState, used, flat, depth - 1))
+            used[i] = False
+            if best == depth:
+                break
+        return best
+
+    def grow(self, start, used, flat, lookahead, maxTris):
+        """Builds a snake from drawn tri start; marks its tris used."""
+        snake = Snake(start)
+        state = start
+        while maxTris <= 0 or snake.numTris() < maxTris:
+            best = None
+            for d, i, newState in self.moves(state, used, flat):
+                used[i] = True
+                score = (self.reach(newState, used, flat, lookahead),
+                    -self.freeNeighbors(i, used))
+                used[i] = False
+                if best is None or score > best[0]:
+                    best = (score, d, i, newState)
+            if best is None:
+                break
+            _, d, i, state = best
+            used[i] = True
+            snake.rest.append((state[0], d))
+        return snake
+
+
+def makeSnakes(tris, flat=False, lookahead=3, minSnake=3, maxSnake=0):
+    """
+    Splits tris into snakes and loose tris. Returns (snakes, loose), where
+    loose is a list of tris (in their original vertex order) to be drawn with
+    gsSP2Triangles / gsSP1Triangle.
+    """
+    mesh = Mesh(tris)
+    used = [False] * len(mesh.tris)
+    snakes = []
+    loose = []
+    while True:
+        # Start from the tri with the fewest free neighbors, i.e. at an end
+        cands = [i for i in range(len(mesh.tris)) if not used[i]]
+        if len(cands) == 0:
+            break
+        s = min(cands, key=lambda i: (mesh.freeNeighbors(i, used), i))
+        used[s] = True
+        best = None
+        starts = [mesh.tris[s]] if flat else rotations(mesh.tris[s])
+        for start in starts:
+            trial = list(used)
+            snake = mesh.grow(start, trial, flat, lookahead, maxSnake)
+            if best is None or snake.numTris() > best[0].numTris():
+                best = (snake, trial)
+        snake, used = best
+        # If the last SPContinueSnake would hold only 1 or 2 indices, those
+        # tris are no cheaper in the snake than as separate tris.
+        extra = (len(snake.rest) - 4) % 8
+        if len(snake.rest) > 4 and extra <= 2:
+            drawn = snake.tris()
+            snake.rest = snake.rest[:len(snake.rest) - extra]
+            for t in drawn[len(drawn) - extra:]:
+                loose.append(originalTri(mesh, t, flat))
+        if snake.numTris() < minSnake:
+            for t in snake.tris():
+                loose.append(originalTri(mesh, t, flat))
+        else:
+            snakes.append(snake)
+    return snakes, loose
+
+
+def originalTri(mesh, t, flat):
+    for u in mesh.tris:
+        if sameTri(u, t, flat):
+            return u
+    raise RuntimeError(f"Tri {t} not in mesh")
+
+
+def looseCmds(loose):
+    ret = []
+    for i in range(0, len(loose), 2):
+        if i + 1 < len(loose):
+            ret.append(gbi.gsSP2Triangles(*loose[i], 0, *loose[i + 1], 0))
+        else:
+            ret.append(gbi.gsSP1Triangle(*loose[i], 0))
+    return ret
+
+
+def looseMacros(loose):
+    ret = []
+    for i in range(0, len(loose), 2):
+        a = ", ".join(str(x) for x in loose[i])
+        if i + 1 < len(loose):
+            b = ", ".join(str(x) for x in loose[i + 1])
+            ret.append(f"gsSP2Triangles({a}, 0, {b}, 0),")
+        else:
+            ret.append(f"gsSP1Triangle({a}, 0),")
+    return ret
+
+
+def encodeTris(tris, **kwargs):
+    """Returns the display list commands (w0, w1) drawing tris."""
+    snakes, loose = makeSnakes(tris, **kwargs)
+    cmds = []
+    for s in snakes:
+        cmds += s.cmds()
+    return cmds + looseCmds(loose)
+
+
+def decodeCmds(cmds):
+    """Tris drawn by encoded tri and snake commands, as the microcode would draw them."""
+    b = gbi.cmdsToBytes(cmds)
+    ret = []
+    p = 0
+    while p < len(b):
+        op = b[p]
+        if op == gbi.G_TRI1 or op == gbi.G_TRI2:
+            ret.append(tuple(x >> 1 for x in b[p + 1:p + 4]))
+            if op == gbi.G_TRI2:
+                ret.append(tuple(x >> 1 for x in b[p + 5:p + 8]))
+            p += 8
+            continue
+        if op != gbi.G_TRISNAKE:
+            raise RuntimeError(f"Unexpected command {op:02X} in tris")
+        a, bb, c = b[p + 1] >> 1, b[p + 2] >> 1, b[p + 3] >> 1
+        # Stored i2-i1-i3, then processed i3 as G_SNAKE_LEFT
+        c = a
+        a = (b[p + 3] >> 1) & 0x3F
+        ret.append((a, bb, c))
+        last = b[p + 3] & 0x80
+        p += 4
+        while not last:
+            n, d, last = (b[p] >> 1) & 0x3F, b[p] & 1, b[p] & 0x80
+            p += 1
+            if d == RIGHT:
+                bb = a
+            else:
+                c = a
+            a = n
+            ret.append((a, bb, c))
+        # The rest of the last command is padding
+        p = (p + 7) & ~7
+    return ret
+
+
+def verify(tris, lines, flat):
+    """
+    Checks that the emitted macros draw exactly tris, with the same winding.
+    Each line is evaluated with the gbi.py function of the same name, which
+    gbi_test.py checks against gbi.h, and the commands are decoded like the
+    microcode does.
+    """
+    key = (lambda t: tuple(t)) if flat else (lambda t: min(rotations(tuple(t))))
+    cmds = []
+    for l in lines:
+        r = eval(l.rstrip(","), vars(gbi))
+        cmds += r if isinstance(r, list) else [r]
+    got = [key(t) for t in decodeCmds(cmds)]
+    if sorted(got) != sorted(key(t) for t in tris):
+        raise RuntimeError("Internal error: generated tris do not match input")
+
+
+def readTris(path):
+    tris = []
+    obj = path.lower().endswith(".obj")
+    with open(path, "r") as f:
+        for lineNum, l in enumerate(f):
+            l = l.split("#")[0].strip()
+            if len(l) == 0:
+                continue
+            toks = l.split()
+            if obj:
+                if toks[0] != "f":
+                    continue
+                idx = [int(t.split("/")[0]) - 1 for t in toks[1:]]
+                # Fan-triangulate polygons
+                for k in range(1, len(idx) - 1):
+                    tris.append((idx[0], idx[k], idx[k + 1]))
+                continue
+            if len(toks) != 3:
+                raise RuntimeError(f"{path}:{lineNum + 1}: expected three indices")
+            tris.append(tuple(int(t, 0) for t in toks))
+    for t in tris:
+        for x in t:
+            if x < 0 or x >= VERTEX_BUFFER_SIZE:
+                raise RuntimeError(f"Index {x} out of vertex buffer range 0-{VERTEX_BUFFER_SIZE - 1}")
+        if len(set(t)) != 3:
+            raise RuntimeError(f"Tri {t} has repeated indices")
+    return tris
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert tris to F3DEX3 triangle snakes")
+    parser.add_argument("input", help="OBJ file, or text file with 3 indices per line")
+    parser.add_argument("--flat", action="store_true",
+        help="Preserve the first vertex of each tri (for flat shading)")
+    parser.add_argument("--lookahead", type=int, default=3,
+        help="Number of tris to search ahead at each turn (default 3)")
+    parser.add_argument("--min-snake", type=int, default=3,
+        help="Shorter snakes are emitted as SP2Triangles (default 3)")
+    parser.add_argument("--max-snake", type=int, default=0,
+        help="Maximum tris per snake, to bound the time between yield checks (default no limit)")
+    args = parser.parse_args()
+
+    tris = readTris(args.input)
+    snakes, loose = makeSnakes(tris, args.flat, args.lookahead, max(2, args.min_snake), args.max_snake)
+    lines = [m for s in snakes for m in s.macros()] + looseMacros(loose)
+    verify(tris, lines, args.flat)
+    for m in lines:
+        print(m)
+
+    numCmds = sum(s.numCmds() for s in snakes) + (len(loose) + 1) // 2
+    baseCmds = (len(tris) + 1) // 2
+    snakeTris = sum(s.numTris() for s in snakes)
+    print(f"{len(tris)} tris: {len(snakes)} snakes with {snakeTris} tris"
+        + (f" (avg {snakeTris / len(snakes):.1f})" if len(snakes) > 0 else "")
+        + f", {len(loose)} loose tris", file=sys.stderr)
+    print(f"{numCmds * 8} bytes vs. {baseCmds * 8} bytes with SP2Triangles: "
+        + f"saved {(baseCmds - numCmds) * 8} bytes"
+        + (f" ({baseCmds / numCmds:.2f}x less)" if numCmds > 0 else ""), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
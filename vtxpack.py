@@ -0,0 +1,289 @@
+#!python3
+
+"""
+Packed vertex converter for F3DEX3.
+
+Converts the Vtx arrays in a C file to the 8 byte VtxPacked format (see gbi.h
+and cpu/vtxpack.c), and reports the error the quantization introduces, so you
+can decide per mesh whether it is acceptable. The microcode does not load packed
+vertices; they are unpacked to Vtx on the CPU. See "Packed vertex format" in
+docs/Documentation/Design Tradeoffs.md.
+
+Each batch of vertices gets its own origin and scale. If the file has
+gsSPVertex(&name[start], count, v0) commands for an array, e.g. the output of
+vtxpartition.py, each load is a batch (overlapping loads are merged); other
+vertices are batched in groups of --batch-size. Smaller batches have smaller
+ranges and so less error, at 16 bytes per batch header.
+
+The errors are in model units for the positions, texels for the texture coords,
+0-255 for the colors, and degrees for the normals (--lit).
+
+Usage:
+python3 vtxpack.py mesh.inc.c > mesh_packed.inc.c
+python3 vtxpack.py object.c --array tree_vtx --lit
+"""
+
+import argparse
+import math
+import re
+import sys
+
+import dlhints
+
+VTX_ARRAY_RE = re.compile(r"\bVtx\s+(\w+)\s*\[[^\]]*\]\s*=\s*\{")
+VERTEX_BUFFER_SIZE = 56
+MAX_BATCH_COUNT = 255  # VtxPackedHeader.count is a byte
+POS_BITS = 10
+ST_BITS = 8
+MAX_POS_SHIFT = 6
+MAX_ST_SHIFT = 8
+VTX_SIZE = 16
+PACKED_SIZE = 8
+HEADER_SIZE = 16
+
+
+class Vertex:
+    def __init__(self, vals):
+        self.ob = vals[0:3]
+        self.flag = vals[3]
+        self.tc = vals[4:6]
+        self.cn = [c & 0xFF for c in vals[6:10]]
+
+
+class Batch:
+    def __init__(self, start, count):
+        self.start = start
+        self.count = count
+        self.origin = None
+        self.posShift = 0
+        self.stOrigin = None
+        self.stShift = 0
+
+
+def parseInt(text):
+    text = text.strip()
+    neg = text.startswith("-")
+    v = int(text.lstrip("-").strip(), 0)
+    return -v if neg else v
+
+
+def parseVtxArrays(masked):
+    """Returns {name: [Vertex]} for every initialized Vtx array."""
+    arrays = {}
+    for m in VTX_ARRAY_RE.finditer(masked):
+        lb = m.end() - 1
+        close = dlhints.matchClose(masked, lb)
+        verts = []
+        for a, b in dlhints.splitTopLevel(masked, lb + 1, close):
+            nums = re.findall(r"-?\s*(?:0[xX][0-9a-fA-F]+|\d+)", masked[a:b])
+            if len(nums) != 10:
+                raise RuntimeError(f"{m.group(1)}: cannot parse vertex {len(verts)}: {masked[a:b].strip()}")
+            verts.append(Vertex([parseInt(x) for x in nums]))
+        arrays[m.group(1)] = verts
+    return arrays
+
+
+def parseLoads(masked, arrays):
+    """Returns {name: [(start, count)]} of the gsSPVertex loads of each array."""
+    loads = {name: [] for name in arrays}
+    for dl in dlhints.parseDisplayLists(masked).values():
+        for e in dl.elements:
+            call = dlhints.macroCall(e.text)
+            if call is None or call[0] not in ("gsSPVertex", "gSPVertex") or len(call[1]) < 3:
+                continue
+            args = call[1][-3:]
+            m = re.fullmatch(r"\(?\s*&?\s*(\w+)\s*(?:\[\s*(\w+)\s*\]|\+\s*(\w+))?\s*\)?", args[0])
+            if m is None or m.group(1) not in arrays:
+                continue
+            idx = m.group(2) or m.group(3) or "0"
+            try:
+                start = parseInt(idx)
+                count = parseInt(args[1])
+            except ValueError:
+                continue
+            loads[m.group(1)].append((start, count))
+    return loads
+
+
+def makeBatches(numVerts, loads, batchSize):
+    ranges = sorted((s, s + c) for s, c in loads if c > 0 and 0 <= s and s + c <= numVerts)
+    merged = []
+    for s, e in ranges:
+        if len(merged) > 0 and s < merged[-1][1]:
+            merged[-1][1] = max(merged[-1][1], e)
+        else:
+            merged.append([s, e])
+    # Fill the gaps between loads
+    spans = []
+    pos = 0
+    for s, e in merged:
+        if pos < s:
+            spans.append((pos, s, batchSize))
+        spans.append((s, e, MAX_BATCH_COUNT))
+        pos = e
+    if pos < numVerts:
+        spans.append((pos, numVerts, batchSize))
+    batches = []
+    for s, e, size in spans:
+        for b in range(s, e, size):
+            batches.append(Batch(b, min(size, e - b)))
+    return batches
+
+
+def chooseShift(lo, hi, bits, maxShift):
+    shift = 0
+    while shift < maxShift and (hi - lo + (1 << shift >> 1)) >> shift >= (1 << bits):
+        shift += 1
+    return shift
+
+
+def quantize(v, origin, shift, bits):
+    q = (v - origin + (1 << shift >> 1)) >> shift
+    q = min(q, (0x7FFF - origin) >> shift)  # Unpacked value must fit in s16
+    return max(0, min(q, (1 << bits) - 1))
+
+
+def rgba5551(r, g, b, a):
+    return ((r >> 3) << 11) | ((g >> 3) << 6) | ((b >> 3) << 1) | (a >> 7)
+
+
+def expand5(c):
+    c &= 0x1F
+    return (c << 3) | (c >> 2)
+
+
+def packedNormal(x, y, z):
+    return (((x >> 3) & 0x1F) << 11) | (((y >> 2) & 0x3F) << 5) | ((z >> 3) & 0x1F)
+
+
+def signExtend(x, bits):
+    x &= (1 << bits) - 1
+    return x - (1 << bits) if x >= (1 << (bits - 1)) else x
+
+
+def toS8(x):
+    return signExtend(x, 8)
+
+
+def normalAngle(a, b):
+    la = math.sqrt(sum(c * c for c in a))
+    lb = math.sqrt(sum(c * c for c in b))
+    if la == 0.0 or lb == 0.0:
+        return 0.0
+    d = sum(x * y for x, y in zip(a, b)) / (la * lb)
+    return math.degrees(math.acos(max(-1.0, min(1.0, d))))
+
+
+class ErrorStats:
+    def __init__(self):
+        self.max = 0.0
+        self.sumSq = 0.0
+        self.n = 0
+
+    def add(self, e):
+        self.max = max(self.max, abs(e))
+        self.sumSq += e * e
+        self.n += 1
+
+    def rms(self):
+        return math.sqrt(self.sumSq / self.n) if self.n > 0 else 0.0
+
+    def __str__(self):
+        return f"max {self.max:.3g}, RMS {self.rms():.3g}"
+
+
+def pack(verts, batches, lit):
+    """Fills in the batch parameters; returns the packed words and errors."""
+    packed = [None] * len(verts)
+    err = {k: ErrorStats() for k in ("pos", "st", "color", "normal")}
+    alphaMismatches = 0
+    for b in batches:
+        vs = verts[b.start:b.start + b.count]
+        lo = [min(v.ob[i] for v in vs) for i in range(3)]
+        hi = [max(v.ob[i] for v in vs) for i in range(3)]
+        b.origin = lo
+        b.posShift = max(chooseShift(lo[i], hi[i], POS_BITS, MAX_POS_SHIFT) for i in range(3))
+        stLo = [min(v.tc[i] for v in vs) for i in range(2)]
+        stHi = [max(v.tc[i] for v in vs) for i in range(2)]
+        b.stOrigin = stLo
+        b.stShift = max(chooseShift(stLo[i], stHi[i], ST_BITS, MAX_ST_SHIFT) for i in range(2))
+        for k, v in enumerate(vs):
+            q = [quantize(v.ob[i], lo[i], b.posShift, POS_BITS) for i in range(3)]
+            st = [quantize(v.tc[i], stLo[i], b.stShift, ST_BITS) for i in range(2)]
+            for i in range(3):
+                err["pos"].add(lo[i] + (q[i] << b.posShift) - v.ob[i])
+            for i in range(2):
+                err["st"].add((stLo[i] + (st[i] << b.stShift) - v.tc[i]) / 32.0)
+            if lit:
+                n = [toS8(c) for c in v.cn[0:3]]
+                cn = packedNormal(*n)
+                un = [signExtend(cn >> 11, 5) << 3, signExtend(cn >> 5, 6) << 2, signExtend(cn, 5) << 3]
+                err["normal"].add(normalAngle(n, un))
+                alphaMismatches += v.cn[3] != 0xFF
+            else:
+                cn = rgba5551(*v.cn)
+                for i in range(3):
+                    err["color"].add(expand5(cn >> (11 - 5 * i)) - v.cn[i])
+                alphaMismatches += (0xFF if cn & 1 else 0) != v.cn[3]
+            packed[b.start + k] = (q, st, cn)
+    return packed, err, alphaMismatches
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert Vtx arrays to the packed vertex format")
+    parser.add_argument("input", help="C file with Vtx arrays")
+    parser.add_argument("--array", action="append", default=[],
+        help="Only convert this array (repeatable); default all")
+    parser.add_argument("--lit", action="store_true", help="Vertices have normals, not colors")
+    parser.add_argument("--batch-size", type=int, default=VERTEX_BUFFER_SIZE,
+        help="Vertices per batch which are not in a gsSPVertex load (default 56)")
+    args = parser.parse_args()
+
+    if not (1 <= args.batch_size <= MAX_BATCH_COUNT):
+        raise RuntimeError(f"--batch-size must be 1-{MAX_BATCH_COUNT}")
+    with open(args.input, "r") as f:
+        masked = dlhints.maskComments(f.read())
+    arrays = parseVtxArrays(masked)
+    if len(args.array) > 0:
+        for name in args.array:
+            if name not in arrays:
+                raise RuntimeError(f"No Vtx array {name} in {args.input}")
+        arrays = {name: arrays[name] for name in args.array}
+    if len(arrays) == 0:
+        raise RuntimeError(f"No Vtx arrays in {args.input}")
+    loads = parseLoads(masked, arrays)
+
+    flags = "VTXP_FLAG_NORMALS" if args.lit else "0"
+    for name, verts in arrays.items():
+        batches = makeBatches(len(verts), loads[name], args.batch_size)
+        packed, err, alphaMismatches = pack(verts, batches, args.lit)
+        print(f"VtxPackedHeader {name}_hdr[{len(batches)}] = {{")
+        for b in batches:
+            print(f"    gdSPDefVtxPackedHeader({b.origin[0]}, {b.origin[1]}, {b.origin[2]}, {b.posShift}, "
+                + f"{b.stOrigin[0]}, {b.stOrigin[1]}, {b.stShift}, {b.start}, {b.count}, {flags}),")
+        print("};\n")
+        print(f"VtxPacked {name}_packed[{len(verts)}] = {{")
+        for k, (q, st, cn) in enumerate(packed):
+            print(f"    gdSPDefVtxPacked({q[0]}, {q[1]}, {q[2]}, {st[0]}, {st[1]}, 0x{cn:04X}), // {k}")
+        print("};\n")
+
+        before = VTX_SIZE * len(verts)
+        after = PACKED_SIZE * len(verts) + HEADER_SIZE * len(batches)
+        print(f"{name}: {len(verts)} vertices in {len(batches)} batches, {before} -> {after} bytes "
+            + f"({100.0 * after / before:.0f}%)", file=sys.stderr)
+        print(f"  Position error (model units): {err['pos']}", file=sys.stderr)
+        print(f"  Texture coord error (texels): {err['st']}", file=sys.stderr)
+        if args.lit:
+            print(f"  Normal error (degrees):       {err['normal']}", file=sys.stderr)
+            print(f"  Alpha not 255 (lost):         {alphaMismatches} vertices", file=sys.stderr)
+        else:
+            print(f"  Color error (0-255):          {err['color']}", file=sys.stderr)
+            print(f"  Alpha changed:                {alphaMismatches} vertices", file=sys.stderr)
+        lostFlags = sum(1 for v in verts if v.flag != 0)
+        if lostFlags > 0:
+            print(f"  Warning: {lostFlags} vertices have a nonzero flag (packed normal), which is dropped",
+                file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
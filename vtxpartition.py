@@ -0,0 +1,307 @@
+#!python3
+
+"""
+Vertex cache partitioner for F3DEX3.
+
+Splits a mesh into batches of tris whose vertices fit in the 56-entry vertex
+buffer, and chooses which vertices to load for each batch with gsSPVertex.
+Vertices which are still needed by later batches are kept in the buffer when
+possible, so that the next batch only loads its new vertices, into the slots
+which are free (one gsSPVertex per contiguous range of slots, using v0). Tris are
+grown from the edge of the remaining mesh in round-ish regions, which keeps the
+set of vertices shared between batches small. A batch only evicts vertices
+which later batches still need if it could not fit even one tri otherwise. See
+"Vertex Cache Locality" in the Triangle Snake documentation.
+
+The output is a new vertex array (vertices which must be reloaded appear more
+than once) and the display list for the mesh. A report compares the number of
+vertices transformed and the estimated RSP vertex cycles against splitting the
+mesh into independent 32-vertex batches, as F3DEX2 exporters do.
+
+Usage:
+python3 vtxpartition.py mesh.obj --name mesh --lighting dir 2 > mesh.inc.c
+
+Other scripts can import this module and use partition directly.
+"""
+
+import argparse
+import sys
+
+import costs
+import trisnake
+
+VERTEX_BUFFER_SIZE = 56
+F3DEX2_BATCH_SIZE = 32
+
+
+class Load:
+    """One gsSPVertex: count vertices from the output array at start, to slot v0."""
+    def __init__(self, start, count, v0):
+        self.start = start
+        self.count = count
+        self.v0 = v0
+
+
+class Batch:
+    def __init__(self):
+        self.loads = []
+        self.tris = []  # In vertex buffer slot indices
+
+
+class Partition:
+    def __init__(self):
+        self.vertices = []  # Output vertex array, as source vertex indices
+        self.batches = []
+
+    def numLoaded(self):
+        return len(self.vertices)
+
+    def numLoads(self):
+        return sum(len(b.loads) for b in self.batches)
+
+    def loadCounts(self):
+        return [l.count for b in self.batches for l in b.loads]
+
+
+def partition(tris, bufferSize=VERTEX_BUFFER_SIZE, perVertexCycles=35,
+        loadOverhead=costs.LOAD_OVERHEAD_CYCLES):
+    """
+    tris are in source vertex indices. Returns a Partition; every input tri
+    appears in exactly one batch, with its winding and vertex order preserved.
+    The cycle costs are used to trade off extra gsSPVertex commands against
+    extra vertices transformed when placing each batch's new vertices. If the
+    estimated cycles are more than those of naivePartition, returns that.
+    """
+    tris = [tuple(t) for t in tris]
+    for t in tris:
+        if len(set(t)) != 3:
+            raise RuntimeError(f"Tri {t} has repeated vertices")
+    vtxTris = {}
+    for i, t in enumerate(tris):
+        for v in t:
+            vtxTris.setdefault(v, []).append(i)
+    done = [False] * len(tris)
+    remainingUses = {v: len(l) for v, l in vtxTris.items()}
+    slots = [None] * bufferSize  # Source vertex in each slot
+    res = Partition()
+
+    def openNeighbors(i):
+        return sum(1 for v in tris[i] for j in vtxTris[v] if not done[j] and j != i)
+
+    while not all(done):
+        resident = {v: s for s, v in enumerate(slots) if v is not None}
+        live = set(v for v in resident if remainingUses[v] > 0)
+        batch = Batch()
+        # First try to grow the batch without evicting any vertex which a later
+        # batch still needs; only if not even one tri fits that way, allow it.
+        for keepLive in (True, False):
+            batchVerts = set()
+            chosen = []
+            def fits(i):
+                verts = batchVerts | set(tris[i])
+                return len(verts) + (len(live - verts) if keepLive else 0) <= bufferSize
+            while True:
+                # Seed: most vertices already in the batch or resident, else at
+                # the edge of the mesh. When the region cannot grow any more,
+                # the batch continues with another seed, so that the leftover
+                # pieces of the mesh do not end up as tiny batches of their own.
+                cands = [i for i in range(len(tris)) if not done[i] and fits(i)]
+                if len(cands) == 0:
+                    break
+                seed = min(cands, key=lambda i: (
+                    -sum(1 for v in tris[i] if v in batchVerts or v in resident),
+                    openNeighbors(i), i))
+                frontier = {seed}
+                while len(frontier) > 0:
+                    def newVerts(i):
+                        return [v for v in tris[i] if v not in batchVerts]
+                    def score(i):
+                        nv = newVerts(i)
+                        return (sum(1 for v in nv if v not in resident), len(nv),
+                            sum(1 for v in tris[i] for j in vtxTris[v] if not done[j]), i)
+                    best = min(frontier, key=score)
+                    frontier.discard(best)
+                    if not fits(best):
+                        continue
+                    chosen.append(best)
+                    done[best] = True
+                    batchVerts.update(tris[best])
+                    for v in tris[best]:
+                        for j in vtxTris[v]:
+                            if not done[j]:
+                                frontier.add(j)
+            if len(chosen) > 0:
+                break
+        for i in chosen:
+            for v in tris[i]:
+                remainingUses[v] -= 1
+        toLoad = sorted(v for v in batchVerts if v not in resident)
+        free = chooseSlots(slots, batchVerts, remainingUses, len(toLoad),
+            perVertexCycles, loadOverhead)
+        for sl, v in zip(free, toLoad):
+            slots[sl] = v
+        # One load per contiguous run of slots
+        k = 0
+        while k < len(free):
+            e = k
+            while e + 1 < len(free) and free[e + 1] == free[e] + 1:
+                e += 1
+            batch.loads.append(Load(len(res.vertices), e - k + 1, free[k]))
+            res.vertices += toLoad[k:e + 1]
+            k = e + 1
+        slotOf = {v: s for s, v in enumerate(slots) if v is not None}
+        batch.tris = [tuple(slotOf[v] for v in tris[i]) for i in sorted(chosen)]
+        res.batches.append(batch)
+
+    # Never worse than the independent batches
+    naive = naivePartition(tris, min(F3DEX2_BATCH_SIZE, bufferSize))
+    perPair = 2 * perVertexCycles
+    if estimateCycles(naive.loadCounts(), perPair, loadOverhead) < estimateCycles(
+            res.loadCounts(), perPair, loadOverhead):
+        return naive
+    return res
+
+
+def chooseSlots(slots, batchVerts, remainingUses, n, perVertexCycles, loadOverhead):
+    """
+    Returns the sorted slots to load this batch's n new vertices into. Slots
+    holding the batch's resident vertices are never used, so those are never
+    sent again. Each contiguous run of slots costs one gsSPVertex, and evicting
+    a vertex which is needed later costs a later reload; the slots with the
+    lowest total cost are found by dynamic programming over the buffer.
+    """
+    if n == 0:
+        return []
+    size = len(slots)
+    INF = float("inf")
+    # best[c][inRun]: (cost, slots) with c slots chosen so far, inRun if the
+    # previous slot was chosen
+    best = [[(INF, None), (INF, None)] for _ in range(n + 1)]
+    best[0][0] = (0, ())
+    for s in range(size):
+        v = slots[s]
+        allowed = v not in batchVerts
+        evict = perVertexCycles if v is not None and remainingUses[v] > 0 else 0
+        nxt = [[(INF, None), (INF, None)] for _ in range(n + 1)]
+        for c in range(n + 1):
+            for inRun in (0, 1):
+                cost, sl = best[c][inRun]
+                if sl is None:
+                    continue
+                # Skip this slot
+                if cost < nxt[c][0][0]:
+                    nxt[c][0] = (cost, sl)
+                # Load into this slot
+                if allowed and c < n:
+                    cc = cost + evict + (0 if inRun else loadOverhead)
+                    if cc < nxt[c + 1][1][0]:
+                        nxt[c + 1][1] = (cc, sl + (s,))
+        best = nxt
+    res = min(best[n], key=lambda x: x[0])
+    if res[1] is None:
+        raise RuntimeError("Batch does not fit in the vertex buffer")
+    return list(res[1])
+
+
+def naivePartition(tris, batchSize=F3DEX2_BATCH_SIZE):
+    """Input order, independent batches of up to batchSize vertices, as a Partition."""
+    res = Partition()
+    def flush(batch, verts):
+        if len(verts) == 0:
+            return
+        batch.loads.append(Load(len(res.vertices), len(verts), 0))
+        res.vertices += verts
+        res.batches.append(batch)
+    batch = Batch()
+    verts = []
+    for t in tris:
+        t = tuple(t)
+        if len(set(verts) | set(t)) > batchSize:
+            flush(batch, verts)
+            batch = Batch()
+            verts = []
+        for v in t:
+            if v not in verts:
+                verts.append(v)
+        batch.tris.append(tuple(verts.index(v) for v in t))
+    flush(batch, verts)
+    return res
+
+
+def estimateCycles(loadCounts, perPair, overhead=costs.LOAD_OVERHEAD_CYCLES):
+    return sum(overhead + ((n + 1) // 2) * perPair for n in loadCounts)
+
+
+def readObj(path):
+    positions = []
+    tris = []
+    with open(path, "r") as f:
+        for l in f:
+            toks = l.split("#")[0].split()
+            if len(toks) == 0:
+                continue
+            if toks[0] == "v":
+                positions.append(tuple(float(x) for x in toks[1:4]))
+            elif toks[0] == "f":
+                idx = [int(t.split("/")[0]) for t in toks[1:]]
+                idx = [i - 1 if i > 0 else len(positions) + i for i in idx]
+                for k in range(1, len(idx) - 1):
+                    tris.append((idx[0], idx[k], idx[k + 1]))
+    return positions, tris
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Partition a mesh for the F3DEX3 vertex buffer")
+    parser.add_argument("input", help="OBJ file")
+    parser.add_argument("--name", default="mesh", help="C name prefix")
+    parser.add_argument("--scale", type=float, default=1.0, help="Position scale to model units")
+    parser.add_argument("--buffer-size", type=int, default=VERTEX_BUFFER_SIZE)
+    parser.add_argument("--snakes", action="store_true",
+        help="Draw each batch with triangle snakes (trisnake.py)")
+    parser.add_argument("--lighting", nargs="+", default=["none"],
+        help="none, dir N, or point N; for the cycle estimate")
+    parser.add_argument("--noc", action="store_true", help="Estimate for F3DEX3_NOC")
+    args = parser.parse_args()
+
+    lighting = args.lighting[0]
+    numLights = int(args.lighting[1]) if len(args.lighting) > 1 else 0
+    if lighting not in ["none", "dir", "point"] or not (0 <= numLights <= 9):
+        raise RuntimeError("--lighting must be none, dir N, or point N with N 0-9")
+    positions, tris = readObj(args.input)
+    perPair = costs.pairCycles(lighting, numLights, args.noc)
+    part = partition(tris, args.buffer_size, perPair / 2)
+
+    print(f"Vtx {args.name}_vtx[{part.numLoaded()}] = {{")
+    for k, v in enumerate(part.vertices):
+        x, y, z = (int(round(c * args.scale)) for c in positions[v])
+        print(f"    {{{{{{{x}, {y}, {z}}}, 0, {{0, 0}}, {{0xFF, 0xFF, 0xFF, 0xFF}}}}}}, // {k}: source vertex {v}")
+    print("};\n")
+    print(f"Gfx {args.name}_dl[] = {{")
+    for b in part.batches:
+        for l in b.loads:
+            print(f"    gsSPVertex(&{args.name}_vtx[{l.start}], {l.count}, {l.v0}),")
+        if args.snakes:
+            snakes, loose = trisnake.makeSnakes(b.tris)
+            lines = [m for s in snakes for m in s.macros()] + trisnake.looseMacros(loose)
+        else:
+            lines = trisnake.looseMacros(b.tris)
+        for m in lines:
+            print("    " + m)
+    print("    gsSPEndDisplayList(),")
+    print("};")
+
+    loads = part.loadCounts()
+    naive = naivePartition(tris).loadCounts()
+    uniq = len(set(v for t in tris for v in t))
+    cyc = estimateCycles(loads, perPair)
+    naiveCyc = estimateCycles(naive, perPair)
+    print(f"{len(tris)} tris, {uniq} unique vertices, {len(part.batches)} batches", file=sys.stderr)
+    print(f"This:   {part.numLoaded()} vertices transformed in {len(loads)} loads, "
+        + f"~{cyc} cycles", file=sys.stderr)
+    print(f"F3DEX2: {sum(naive)} vertices transformed in {len(naive)} loads of up to "
+        + f"{F3DEX2_BATCH_SIZE}, ~{naiveCyc} cycles", file=sys.stderr)
+    print(f"({perPair} cycles per vertex pair, ~{costs.LOAD_OVERHEAD_CYCLES} per load)", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()